@@ -31,6 +31,40 @@ extern "C" void bmw_hash(void *state, const void *input)
 	memcpy(state, hash, 32);
 }
 
+// CPU Hash of count nonces for the same (big endian encoded) header, the
+// groups of 8 on the 8-way midstate path, the rest one by one
+extern "C" void bmw_hash_batch(void *output, const void *input, const uint32_t *nonces, int count)
+{
+	uint32_t _ALIGN(64) hash[8*8];
+	uint32_t _ALIGN(32) lanes[8];
+	sph_bmw256_context ctx_mid, ctx_bmw;
+	int i = 0;
+
+	sph_bmw256_init(&ctx_mid);
+	sph_bmw256(&ctx_mid, input, 64);
+
+	for (; i + 8 <= count; i += 8) {
+		for (int k = 0; k < 8; k++)
+			lanes[k] = swab32(nonces[i + k]);
+		sph_bmw256_80_8way(&ctx_mid, input, lanes, hash);
+		memcpy((uint8_t*) output + i * 32, hash, 8 * 32);
+	}
+	for (; i < count; i++) {
+		memcpy(lanes, (const uint8_t*) input + 64, 12);
+		be32enc(&lanes[3], nonces[i]);
+		memcpy(&ctx_bmw, &ctx_mid, sizeof(ctx_mid));
+		sph_bmw256(&ctx_bmw, lanes, 16);
+		sph_bmw256_close(&ctx_bmw, hash);
+		memcpy((uint8_t*) output + i * 32, hash, 32);
+	}
+}
+
+// CPU scan (--cpu-scan), 8 nonces per pass on the header midstate
+extern "C" int scanhash_bmw_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done)
+{
+	return scanhash_cpu_batch(thr_id, work, max_nonce, hashes_done, bmw_hash_batch);
+}
+
 static bool init[MAX_GPUS] = { 0 };
 
 extern "C" int scanhash_bmw(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done)
@@ -81,16 +115,14 @@ extern "C" int scanhash_bmw(int thr_id, struct work* work, uint32_t max_nonce, u
 		{
 			const uint32_t Htarg = ptarget[7];
 			uint32_t _ALIGN(64) vhash[8];
-			be32enc(&endiandata[19], work->nonces[0]);
-			bmw_hash(vhash, endiandata);
+			bmw_hash_batch(vhash, endiandata, &work->nonces[0], 1);
 
 			if (vhash[7] <= Htarg && fulltest(vhash, ptarget)) {
 				work->valid_nonces = 1;
 				work_set_target_ratio(work, vhash);
 				work->nonces[1] = cuda_check_hash_suppl(thr_id, throughput, pdata[19], d_hash[thr_id], 1);
 				if (work->nonces[1] != 0) {
-					be32enc(&endiandata[19], work->nonces[1]);
-					bmw_hash(vhash, endiandata);
+					bmw_hash_batch(vhash, endiandata, &work->nonces[1], 1);
 					bn_set_target_ratio(work, vhash, 1);
 					work->valid_nonces++;
 					pdata[19] = max(work->nonces[0], work->nonces[1]) + 1;
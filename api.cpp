@@ -242,13 +242,22 @@ static char *getpoolnfo(char *params)
 	}
 
 	snprintf(s, MYBUFSIZ, "POOL=%s;ALGO=%s;URL=%s;USER=%s;SOLV=%d;ACC=%d;REJ=%d;STALE=%u;H=%u;JOB=%s;DIFF=%.6f;"
-		"BEST=%.6f;N2SZ=%d;N2=%s;PING=%u;DISCO=%u;WAIT=%u;UPTIME=%u;LAST=%u|",
+		"BEST=%.6f;N2SZ=%d;N2=%s;PING=%u;DISCO=%u;WAIT=%u;UPTIME=%u;LAST=%u;"
+		"GENW=%u;GENUS=%.1f;SWITCH=%u;SWITCHMS=%.2f;INFL=%d;"
+		"CONN=%u;NDELAY=%.1f;RTT=%.1f;RTTH=%u,%u,%u,%u,%u,%u;RISK=%.1f|",
 		strlen(p->name) ? p->name : p->short_url, algo_names[p->algo],
 		p->url, p->type & POOL_STRATUM ? p->user : "",
 		p->solved_count, p->accepted_count, p->rejected_count, p->stales_count,
 		stratum.job.height, jobid, stratum_diff, p->best_share,
 		(int) stratum.xnonce2_size, extra, stratum.answer_msec,
-		p->disconnects, p->wait_time, p->work_time, last_share);
+		p->disconnects, p->wait_time, p->work_time, last_share,
+		p->work_gen_count, p->work_gen_count ? (double) p->work_gen_usec / p->work_gen_count : 0.,
+		p->job_switch_count, p->job_switch_count ? (double) p->job_switch_usec / p->job_switch_count / 1000. : 0.,
+		share_inflight_count(),
+		p->connect_msec, p->notify_delay, p->answer_avg,
+		p->answer_hist[0], p->answer_hist[1], p->answer_hist[2],
+		p->answer_hist[3], p->answer_hist[4], p->answer_hist[5],
+		pool_stale_risk(p->id));
 
 	return s;
 }
@@ -424,6 +433,25 @@ static char *getmeminfo(char *params)
 	return buffer;
 }
 
+/**
+ * Latency of the http requests (getwork, gbt, sia...), by endpoint
+ */
+static char *getrpcstats(char *params)
+{
+	struct curl_stat_data data[16];
+	char *p = buffer;
+	int records = curl_conn_get_stats(data, ARRAY_SIZE(data));
+	*buffer = '\0';
+	for (int i = 0; i < records; i++) {
+		p += sprintf(p, "NAME=%s;COUNT=%u;ERRORS=%u;CONNECTS=%u;"
+				"LAST=%u;MAX=%u;AVG=%.1f|",
+			data[i].endpoint, data[i].count, data[i].errors, data[i].connects,
+			data[i].last_ms, data[i].max_ms,
+			data[i].count ? (double) data[i].total_ms / data[i].count : 0.);
+	}
+	return buffer;
+}
+
 /*****************************************************************************/
 
 /**
@@ -492,6 +520,7 @@ struct CMDS {
 	{ "hwinfo",  gethwinfos, false },
 	{ "meminfo", getmeminfo, false },
 	{ "scanlog", getscanlog, false },
+	{ "rpcstats", getrpcstats, false },
 
 	/* remote functions */
 	{ "seturl",  remote_seturl, true }, /* prefer switchpool, deprecated */
@@ -80,6 +80,16 @@ function translateField($key)
 	$intl['PING'] = 'Ping (ms)';
 	$intl['DISCO'] = 'Disconnects';
 	$intl['USER'] = 'User';
+	$intl['GENW'] = 'Work regens';
+	$intl['GENUS'] = 'Regen time (us)';
+	$intl['SWITCH'] = 'Job switches';
+	$intl['SWITCHMS'] = 'Job switch (ms)';
+	$intl['INFL'] = 'Shares in flight';
+	$intl['CONN'] = 'Connect (ms)';
+	$intl['NDELAY'] = 'Notify delay (ms)';
+	$intl['RTT'] = 'Submit RTT (ms)';
+	$intl['RTTH'] = 'RTT <50,100,200,500,1000ms,more';
+	$intl['RISK'] = 'Stale risk (ms)';
 
 	if (isset($intl[$key]))
 		return $intl[$key];
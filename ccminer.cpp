@@ -31,6 +31,10 @@
 #else
 #include <errno.h>
 #include <sys/resource.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 #if HAVE_SYS_SYSCTL_H
 #include <sys/types.h>
 #if HAVE_SYS_PARAM_H
@@ -78,6 +82,9 @@ struct workio_cmd {
 		struct work	*work;
 	} u;
 	int pooln;
+	// preallocated submit, see submit_work()
+	bool pooled;
+	struct workio_cmd *next;
 };
 
 bool opt_debug = false;
@@ -122,6 +129,9 @@ int64_t opt_affinity = -1L;
 int opt_priority = 0;
 static double opt_difficulty = 1.;
 bool opt_extranonce = true;
+bool opt_version_rolling = true;
+static bool opt_cpu_scan = false;
+int opt_share_interval = 0;
 bool opt_trust_pool = false;
 uint16_t opt_vote = 9999;
 int num_cpus;
@@ -182,6 +192,7 @@ pthread_mutex_t stratum_sock_lock;
 pthread_mutex_t stratum_work_lock;
 
 char *opt_cert;
+bool opt_no_cert_check = false;
 char *opt_proxy;
 long opt_proxy_type;
 struct thr_info *thr_info = NULL;
@@ -313,11 +324,19 @@ Options:\n\
   -u, --user=USERNAME   username for mining server\n\
   -p, --pass=PASSWORD   password for mining server\n\
       --cert=FILE       certificate for mining server using SSL\n\
+      --no-cert-check   accept any stratum+ssl pool certificate (self-signed)\n\
   -x, --proxy=[PROTOCOL://]HOST[:PORT]  connect through a proxy\n\
   -t, --threads=N       number of miner threads (default: number of nVidia GPUs)\n\
   -r, --retries=N       number of times to retry if a network call fails\n\
                           (default: retry indefinitely)\n\
   -R, --retry-pause=N   time to pause between retries, in seconds (default: 30)\n\
+      --pool-standby=N  keep N backup stratum pools connected for failover\n\
+      --pool-select=latency  switch to the pool with the lowest stale risk\n\
+                          (notify delay and submit time), default: order\n\
+      --stratum-proxy=[IP:]PORT  serve the stratum pool to other miners\n\
+      --stratum-record=FILE  save the stratum session lines to a jsonl file\n\
+      --stratum-replay=FILE  replay a recorded stratum session, then exit\n\
+      --replay-speed=N  replay time factor, 0 for no delays (default: 1)\n\
       --shares-limit    maximum shares [s] to mine before exiting the program.\n\
       --time-limit      maximum time [s] to mine before exiting the program.\n\
   -T, --timeout=N       network timeout, in seconds (default: 300)\n\
@@ -327,9 +346,14 @@ Options:\n\
   -n, --ndevs           list cuda devices\n\
   -N, --statsavg        number of samples used to compute hashrate (default: 30)\n\
       --no-gbt          disable getblocktemplate support (height check in solo)\n\
+      --coinbase-addr=ADDR  solo mining with getblocktemplate, paid to ADDR\n\
+      --coinbase-script=HEX  same, with the coinbase output script\n\
       --no-longpoll     disable X-Long-Polling support\n\
       --no-stratum      disable X-Stratum support\n\
       --no-extranonce   disable extranonce subscribe on stratum\n\
+      --no-version-rolling  disable the stratum version-rolling (sha256)\n\
+      --share-interval=N  suggest the pool a difficulty for one share every\n\
+                          N seconds at the measured hashrate (stratum)\n\
   -q, --quiet           disable per-thread hashmeter output\n\
       --no-color        disable colored output\n\
   -D, --debug           enable debug output\n\
@@ -369,6 +393,7 @@ Options:\n\
   -B, --background      run the miner in the background\n\
       --benchmark       run in offline benchmark mode\n\
       --cputest         debug hashes from cpu algorithms\n\
+      --cpu-scan        scan the nonces on the cpu (bmw deep hsr luffa qubit)\n\
   -c, --config=FILE     load a JSON-format configuration file\n\
   -V, --version         display version information and exit\n\
   -h, --help            display this help text and exit\n\
@@ -394,8 +419,10 @@ struct option options[] = {
 	{ "background", 0, NULL, 'B' },
 	{ "benchmark", 0, NULL, 1005 },
 	{ "cert", 1, NULL, 1001 },
+	{ "no-cert-check", 0, NULL, 1045 },
 	{ "config", 1, NULL, 'c' },
 	{ "cputest", 0, NULL, 1006 },
+	{ "cpu-scan", 0, NULL, 1044 },
 	{ "cpu-affinity", 1, NULL, 1020 },
 	{ "cpu-priority", 1, NULL, 1021 },
 	{ "cuda-schedule", 1, NULL, 1025 },
@@ -405,6 +432,10 @@ struct option options[] = {
 	{ "ndevs", 0, NULL, 'n' },
 	{ "no-color", 0, NULL, 1002 },
 	{ "no-extranonce", 0, NULL, 1012 },
+	{ "no-version-rolling", 0, NULL, 1040 },
+	{ "share-interval", 1, NULL, 1041 },
+	{ "coinbase-addr", 1, NULL, 1042 },
+	{ "coinbase-script", 1, NULL, 1043 },
 	{ "no-gbt", 0, NULL, 1011 },
 	{ "no-longpoll", 0, NULL, 1003 },
 	{ "no-stratum", 0, NULL, 1007 },
@@ -430,6 +461,12 @@ struct option options[] = {
 	{ "pool-max-diff", 1, NULL, 1161 }, // pool
 	{ "pool-max-rate", 1, NULL, 1162 }, // pool
 	{ "pool-disabled", 1, NULL, 1199 }, // pool
+	{ "pool-standby", 1, NULL, 1026 },
+	{ "pool-select", 1, NULL, 1027 },
+	{ "stratum-proxy", 1, NULL, 1028 },
+	{ "stratum-record", 1, NULL, 1029 },
+	{ "stratum-replay", 1, NULL, 1038 },
+	{ "replay-speed", 1, NULL, 1039 },
 	{ "protocol-dump", 0, NULL, 'P' },
 	{ "proxy", 1, NULL, 'x' },
 	{ "quiet", 0, NULL, 'q' },
@@ -505,6 +542,58 @@ struct work _ALIGN(64) g_work;
 volatile time_t g_work_time;
 pthread_mutex_t g_work_lock;
 
+/* g_work generation, odd while a writer updates it. Writers serialize on
+ * g_work_lock, miner threads read it with g_work_snapshot() */
+volatile uint32_t g_work_seq;
+
+void g_work_write_lock()
+{
+	pthread_mutex_lock(&g_work_lock);
+	g_work_seq++;
+	memory_barrier();
+}
+
+void g_work_write_unlock()
+{
+	memory_barrier();
+	g_work_seq++;
+	pthread_mutex_unlock(&g_work_lock);
+	work_restart_notify();
+}
+
+// the header part, and the pok txs only when present (~66KB otherwise)
+static void work_copy(struct work *dest, const struct work *src)
+{
+	memcpy(dest, src, offsetof(struct work, txs));
+	if (src->tx_count)
+		memcpy(dest->txs, src->txs, src->tx_count * sizeof(struct tx));
+}
+
+/* copy g_work to a thread local snapshot if its generation changed,
+ * without taking the lock unless a writer is busy with it */
+static uint32_t g_work_snapshot(struct work *dest, uint32_t known_seq)
+{
+	for (;;) {
+		uint32_t seq = g_work_seq;
+		memory_barrier();
+		if (seq & 1) {
+			// the update can be long (getwork), wait for it
+			pthread_mutex_lock(&g_work_lock);
+			seq = g_work_seq;
+			if (seq != known_seq)
+				work_copy(dest, &g_work);
+			pthread_mutex_unlock(&g_work_lock);
+			return seq;
+		}
+		if (seq == known_seq)
+			return seq;
+		work_copy(dest, &g_work);
+		memory_barrier();
+		if (seq == g_work_seq)
+			return seq;
+	}
+}
+
 // get const array size (defined in ccminer.cpp)
 int options_count()
 {
@@ -919,7 +1008,7 @@ static bool submit_upstream_work(CURL *curl, struct work *work)
 		pthread_mutex_unlock(&g_work_lock);
 	}
 
-	if (!have_stratum && !stale_work && allow_gbt) {
+	if (!have_stratum && !stale_work && allow_gbt && !opt_coinbase_addr && !opt_coinbase_script) {
 		struct work wheight = { 0 };
 		if (get_blocktemplate(curl, &wheight)) {
 			if (work->height && work->height < wheight.height) {
@@ -941,7 +1030,7 @@ static bool submit_upstream_work(CURL *curl, struct work *work)
 	}
 
 	if (pool->type & POOL_STRATUM) {
-		uint32_t sent = 0;
+		uint32_t sent = 0, share_id;
 		uint32_t ntime, nonce = work->nonces[idnonce];
 		char *ntimestr, *noncestr, *xnonce2str, *nvotestr;
 		uint16_t nvote = 0;
@@ -1015,34 +1104,40 @@ static bool submit_upstream_work(CURL *curl, struct work *work)
 			xnonce2str = bin2hex(work->xnonce2, work->xnonce2_len);
 		}
 
-		// store to keep/display the solved ratio/diff
-		stratum.sharediff = work->sharediff[idnonce];
-
-		if (net_diff && stratum.sharediff > net_diff && (opt_debug || opt_debug_diff))
+		if (net_diff && work->sharediff[idnonce] > net_diff && (opt_debug || opt_debug_diff))
 			applog(LOG_INFO, "share diff: %.5f, possible block found!!!",
-				stratum.sharediff);
+				work->sharediff[idnonce]);
 		else if (opt_debug_diff)
 			applog(LOG_DEBUG, "share diff: %.5f (x %.1f)",
-				stratum.sharediff, work->shareratio[idnonce]);
+				work->sharediff[idnonce], work->shareratio[idnonce]);
+
+		// keep the solved ratio/diff until the pool answer
+		share_id = share_inflight_add(work->pooln, work->job_id, nonce, work->sharediff[idnonce]);
 
 		if (opt_vote) { // ALGO_HEAVY
 			nvotestr = bin2hex((const uchar*)(&nvote), 2);
 			sprintf(s, "{\"method\": \"mining.submit\", \"params\": ["
 					"\"%s\", \"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%u}",
-					pool->user, work->job_id + 8, xnonce2str, ntimestr, noncestr, nvotestr, stratum.job.shares_count + 10);
+					pool->user, work->job_id + 8, xnonce2str, ntimestr, noncestr, nvotestr, share_id);
 			free(nvotestr);
+		} else if (work->vr_mask) {
+			// version-rolling bits of the header, in the mask of the roll
+			sprintf(s, "{\"method\": \"mining.submit\", \"params\": ["
+					"\"%s\", \"%s\", \"%s\", \"%s\", \"%s\", \"%08x\"], \"id\":%u}",
+					pool->user, work->job_id + 8, xnonce2str, ntimestr, noncestr,
+					swab32(work->data[0]) & work->vr_mask, share_id);
 		} else {
 			sprintf(s, "{\"method\": \"mining.submit\", \"params\": ["
 					"\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%u}",
-					pool->user, work->job_id + 8, xnonce2str, ntimestr, noncestr, stratum.job.shares_count + 10);
+					pool->user, work->job_id + 8, xnonce2str, ntimestr, noncestr, share_id);
 		}
 		free(xnonce2str);
 		free(ntimestr);
 		free(noncestr);
 
-		gettimeofday(&stratum.tv_submit, NULL);
 		if (unlikely(!stratum_send_line(&stratum, s))) {
 			applog(LOG_ERR, "submit_upstream_work stratum_send_line failed");
+			share_inflight_done(share_id, NULL);
 			return false;
 		}
 
@@ -1068,6 +1163,23 @@ static bool submit_upstream_work(CURL *curl, struct work *work)
 			return sia_submit(curl, pool, work);
 		}
 
+		if (opt_coinbase_addr || opt_coinbase_script) {
+			// solo, the block of the local template
+			char reason[128] = { 0 };
+			int rc = gbt_solo_submit(curl, pool, work, reason, sizeof(reason));
+			if (rc == -2) {
+				applog(LOG_ERR, "submit_upstream_work submitblock failed");
+				return false;
+			}
+			if (rc == -1) {
+				if (opt_debug)
+					applog(LOG_WARNING, "stale work detected, discarding");
+				return true;
+			}
+			share_result(rc, work->pooln, work->sharediff[0], rc ? NULL : reason);
+			return true;
+		}
+
 		if (opt_algo != ALGO_HEAVY && opt_algo != ALGO_MJOLLNIR) {
 			for (int i = 0; i < adata_sz; i++)
 				le32enc(work->data + i, work->data[i]);
@@ -1255,6 +1367,14 @@ static bool get_upstream_work(CURL *curl, struct work *work)
 		return rc;
 	}
 
+	if (opt_coinbase_addr || opt_coinbase_script) {
+		// built from the block template, no rpc
+		rc = gbt_solo_work(work);
+		if (rc && (opt_showdiff || opt_max_diff > 0.))
+			calc_network_diff(work);
+		return rc;
+	}
+
 	if (opt_debug_threads)
 		applog(LOG_DEBUG, "%s: want_longpoll=%d have_longpoll=%d",
 			__func__, want_longpoll, have_longpoll);
@@ -1289,11 +1409,54 @@ static bool get_upstream_work(CURL *curl, struct work *work)
 	return rc;
 }
 
+/* submit commands and their work, reused to keep allocations out of
+ * the share path (more are allocated when all are in the queue) */
+#define SUBMIT_POOL_SIZE 16
+static struct workio_cmd submit_cmds[SUBMIT_POOL_SIZE];
+static struct workio_cmd *submit_free_list = NULL;
+static int submit_cmds_init = 0;
+static pthread_mutex_t submit_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct workio_cmd* submit_cmd_get()
+{
+	struct workio_cmd *wc;
+
+	pthread_mutex_lock(&submit_pool_lock);
+	wc = submit_free_list;
+	if (wc)
+		submit_free_list = wc->next;
+	else if (submit_cmds_init < SUBMIT_POOL_SIZE) {
+		// the work is allocated once, at first use
+		wc = &submit_cmds[submit_cmds_init];
+		wc->u.work = (struct work *)aligned_calloc(sizeof(struct work));
+		if (wc->u.work) {
+			wc->pooled = true;
+			submit_cmds_init++;
+		} else
+			wc = NULL;
+	}
+	pthread_mutex_unlock(&submit_pool_lock);
+	return wc;
+}
+
+static void submit_cmd_put(struct workio_cmd *wc)
+{
+	pthread_mutex_lock(&submit_pool_lock);
+	wc->next = submit_free_list;
+	submit_free_list = wc;
+	pthread_mutex_unlock(&submit_pool_lock);
+}
+
 static void workio_cmd_free(struct workio_cmd *wc)
 {
 	if (!wc)
 		return;
 
+	if (wc->pooled) {
+		submit_cmd_put(wc);
+		return;
+	}
+
 	switch (wc->cmd) {
 	case WC_SUBMIT_WORK:
 		aligned_free(wc->u.work);
@@ -1342,7 +1505,8 @@ static bool workio_get_work(struct workio_cmd *wc, CURL *curl)
 		if (unlikely(ret_work->pooln != cur_pooln)) {
 			applog(LOG_ERR, "get_work json_rpc_call failed");
 			aligned_free(ret_work);
-			tq_push(wc->thr->q, NULL);
+			if (wc->thr)
+				tq_push(wc->thr->q, NULL);
 			return true;
 		}
 
@@ -1358,6 +1522,15 @@ static bool workio_get_work(struct workio_cmd *wc, CURL *curl)
 		sleep(opt_fail_pause);
 	}
 
+	if (!wc->thr) {
+		// get_work_async(), no thread waits for it
+		g_work_write_lock();
+		memcpy(&g_work, ret_work, sizeof(g_work));
+		g_work_write_unlock();
+		aligned_free(ret_work);
+		return true;
+	}
+
 	/* send work to requesting thread */
 	if (!tq_push(wc->thr->q, ret_work))
 		aligned_free(ret_work);
@@ -1397,7 +1570,7 @@ static void *workio_thread(void *userdata)
 	CURL *curl;
 	bool ok = true;
 
-	curl = curl_easy_init();
+	curl = curl_conn_get();
 	if (unlikely(!curl)) {
 		applog(LOG_ERR, "CURL initialization failed");
 		return NULL;
@@ -1435,7 +1608,8 @@ static void *workio_thread(void *userdata)
 			if (opt_debug_threads)
 				applog(LOG_DEBUG, "%s died, failover", __func__);
 			ok = pool_switch_next(-1);
-			tq_push(wc->thr->q, NULL); // get_work() will return false
+			if (wc->thr)
+				tq_push(wc->thr->q, NULL); // get_work() will return false
 		}
 
 		workio_cmd_free(wc);
@@ -1443,7 +1617,7 @@ static void *workio_thread(void *userdata)
 
 	if (opt_debug_threads)
 		applog(LOG_DEBUG, "%s() died", __func__);
-	curl_easy_cleanup(curl);
+	curl_conn_put(curl);
 	tq_freeze(mythr->q);
 	return NULL;
 }
@@ -1496,21 +1670,54 @@ bool get_work(struct thr_info *thr, struct work *work)
 	return true;
 }
 
-static bool submit_work(struct thr_info *thr, const struct work *work_in)
+/* a work for g_work, fetched and published by the workio thread: for the
+ * callers not owning a thread queue (pool switch), its consumer is unique */
+bool get_work_async()
 {
 	struct workio_cmd *wc;
-	/* fill out work request message */
+
+	if (opt_benchmark)
+		return true;
+
 	wc = (struct workio_cmd *)calloc(1, sizeof(*wc));
 	if (!wc)
 		return false;
 
-	wc->u.work = (struct work *)aligned_calloc(sizeof(*work_in));
-	if (!wc->u.work)
-		goto err_out;
+	wc->cmd = WC_GET_WORK;
+	wc->thr = NULL;
+	wc->pooln = cur_pooln;
+
+	if (!tq_push(thr_info[work_thr_id].q, wc)) {
+		workio_cmd_free(wc);
+		return false;
+	}
+	return true;
+}
+
+static bool submit_work(struct thr_info *thr, const struct work *work_in)
+{
+	struct workio_cmd *wc;
+	/* fill out work request message */
+	wc = submit_cmd_get();
+	if (wc) {
+		// the header, and the txs only if any (pok)
+		work_copy(wc->u.work, work_in);
+		// the equihash solution is submitted from the extra data
+		if (opt_algo == ALGO_EQUIHASH)
+			memcpy(wc->u.work->extra, work_in->extra, sizeof(work_in->extra));
+	} else {
+		wc = (struct workio_cmd *)calloc(1, sizeof(*wc));
+		if (!wc)
+			return false;
+
+		wc->u.work = (struct work *)aligned_calloc(sizeof(*work_in));
+		if (!wc->u.work)
+			goto err_out;
+		memcpy(wc->u.work, work_in, sizeof(struct work));
+	}
 
 	wc->cmd = WC_SUBMIT_WORK;
 	wc->thr = thr;
-	memcpy(wc->u.work, work_in, sizeof(struct work));
 	wc->pooln = work_in->pooln;
 
 	/* send solution to workio thread */
@@ -1524,8 +1731,320 @@ err_out:
 	return false;
 }
 
+#ifdef WITH_HEAVY_ALGO
+/* heavy merkle roots of the next extranonce2 values, computed in one batch */
+#define HEAVY_MERKLE_LANES 8
+static struct {
+	char *job_id;
+	int pooln;
+	uchar *coinbase;
+	size_t coinbase_size;
+	int count;
+	uchar xnonce2[HEAVY_MERKLE_LANES][32];
+	uchar root[HEAVY_MERKLE_LANES][32];
+} heavy_merkle = { 0 };
+
+// called with stratum_work_lock held
+static void heavy_merkle_root(struct stratum_ctx *sctx, uchar *merkle_root)
+{
+	const size_t xn2_size = sctx->xnonce2_size;
+	const size_t cb_size = sctx->job.coinbase_size;
+	const size_t xn2_offset = sctx->job.xnonce2 - sctx->job.coinbase;
+	uchar *coinbases;
+	int i, k;
+
+	if (heavy_merkle.job_id && !strcmp(heavy_merkle.job_id, sctx->job.job_id) &&
+	    heavy_merkle.pooln == sctx->pooln && heavy_merkle.coinbase_size == cb_size &&
+	    !memcmp(heavy_merkle.coinbase, sctx->job.coinbase, xn2_offset) &&
+	    !memcmp(heavy_merkle.coinbase + xn2_offset + xn2_size, sctx->job.xnonce2 + xn2_size,
+	            cb_size - xn2_offset - xn2_size)) {
+		for (k = 0; k < heavy_merkle.count; k++) {
+			if (!memcmp(heavy_merkle.xnonce2[k], sctx->job.xnonce2, xn2_size)) {
+				memcpy(merkle_root, heavy_merkle.root[k], 32);
+				return;
+			}
+		}
+	}
+
+	coinbases = (uchar*) malloc(cb_size * HEAVY_MERKLE_LANES);
+	if (!coinbases || xn2_size > sizeof(heavy_merkle.xnonce2[0])) {
+		free(coinbases);
+		heavycoin_hash(merkle_root, sctx->job.coinbase, (int)cb_size);
+		for (i = 0; i < sctx->job.merkle_count; i++) {
+			memcpy(merkle_root + 32, sctx->job.merkle[i], 32);
+			heavycoin_hash(merkle_root, merkle_root, 64);
+		}
+		return;
+	}
+
+	/* coinbases for xnonce2, xnonce2+1, ... as stratum_gen_work increments it */
+	for (k = 0; k < HEAVY_MERKLE_LANES; k++) {
+		uchar *cb = &coinbases[cb_size * k];
+		uchar *xn2 = cb + xn2_offset;
+		memcpy(cb, k ? cb - cb_size : sctx->job.coinbase, cb_size);
+		if (k) for (i = 0; i < (int)xn2_size && !++xn2[i]; i++);
+		memcpy(heavy_merkle.xnonce2[k], xn2, xn2_size);
+	}
+
+	heavycoin_hash_batch(heavy_merkle.root[0], coinbases, cb_size, (int)cb_size, HEAVY_MERKLE_LANES);
+	free(heavy_merkle.coinbase);
+	heavy_merkle.coinbase = coinbases; // lane 0, to detect a changed xnonce1
+
+	for (i = 0; i < sctx->job.merkle_count; i++) {
+		uchar branch[HEAVY_MERKLE_LANES][64];
+		for (k = 0; k < HEAVY_MERKLE_LANES; k++) {
+			memcpy(branch[k], heavy_merkle.root[k], 32);
+			memcpy(branch[k] + 32, sctx->job.merkle[i], 32);
+		}
+		heavycoin_hash_batch(heavy_merkle.root[0], branch[0], sizeof(branch[0]), 64, HEAVY_MERKLE_LANES);
+	}
+
+	free(heavy_merkle.job_id);
+	heavy_merkle.job_id = strdup(sctx->job.job_id);
+	heavy_merkle.pooln = sctx->pooln;
+	heavy_merkle.coinbase_size = cb_size;
+	heavy_merkle.count = HEAVY_MERKLE_LANES;
+
+	memcpy(merkle_root, heavy_merkle.root[0], 32);
+}
+#endif
+
+/* coinbase midstate (up to xnonce2) and branch words of the current job */
+static struct {
+	int pooln;
+	uint32_t job_seq;
+	const uchar *coinbase;
+	int done;
+	uint32_t midstate[8];
+	int merkle_count;
+	int merkle_alloc;
+	uint32_t (*branch)[8];
+} job_merkle = { 0 };
+
+// called with stratum_work_lock held
+static bool job_merkle_update(struct stratum_ctx *sctx)
+{
+	const int count = sctx->job.merkle_count;
+	int i, k;
+
+	if (job_merkle.coinbase == sctx->job.coinbase && job_merkle.job_seq == sctx->job_seq &&
+	    job_merkle.pooln == sctx->pooln)
+		return true;
+
+	if (count > job_merkle.merkle_alloc) {
+		void *p = realloc(job_merkle.branch, count * sizeof(job_merkle.branch[0]));
+		if (!p) {
+			job_merkle.coinbase = NULL;
+			return false;
+		}
+		job_merkle.branch = (uint32_t (*)[8]) p;
+		job_merkle.merkle_alloc = count;
+	}
+	for (i = 0; i < count; i++)
+		for (k = 0; k < 8; k++)
+			job_merkle.branch[i][k] = be32dec(sctx->job.merkle[i] + 4 * k);
+	job_merkle.merkle_count = count;
+	job_merkle.done = sha256_midstate(job_merkle.midstate, sctx->job.coinbase,
+		(int) (sctx->job.xnonce2 - sctx->job.coinbase));
+	job_merkle.coinbase = sctx->job.coinbase;
+	job_merkle.job_seq = sctx->job_seq;
+	job_merkle.pooln = sctx->pooln;
+	return true;
+}
+
+// merkle root words of a coinbase, from the midstate of its first done bytes
+static void merkle_root_words(uint32_t *root, const uint32_t *midstate, const uchar *coinbase,
+	int done, int cb_size, bool dbl, uint32_t (*branch)[8], int count)
+{
+	uchar hash[32];
+	int i;
+
+	sha256_resume(hash, midstate, coinbase, done, cb_size, dbl);
+	for (i = 0; i < 8; i++)
+		root[i] = be32dec(hash + 4 * i);
+	for (i = 0; i < count; i++)
+		sha256d_merkle_step(root, branch[i]);
+}
+
+// called with stratum_work_lock held
+static void stratum_merkle_root(struct stratum_ctx *sctx, uchar *merkle_root, bool dbl)
+{
+	const int cb_size = (int) sctx->job.coinbase_size;
+	uint32_t root[8];
+	int i;
+
+	if (!job_merkle_update(sctx)) {
+		sha256_init(root);
+		sha256_resume(merkle_root, root, sctx->job.coinbase, 0, cb_size, dbl);
+		for (i = 0; i < sctx->job.merkle_count; i++) {
+			memcpy(merkle_root + 32, sctx->job.merkle[i], 32);
+			sha256d(merkle_root, merkle_root, 64);
+		}
+		return;
+	}
+
+	merkle_root_words(root, job_merkle.midstate, sctx->job.coinbase, job_merkle.done,
+		cb_size, dbl, job_merkle.branch, job_merkle.merkle_count);
+	for (i = 0; i < 8; i++)
+		be32enc(merkle_root + 4 * i, root[i]);
+}
+
+// the coinbase hash is a single sha256 for these algos
+static bool coinbase_single_sha256()
+{
+	switch (opt_algo) {
+		case ALGO_FUGUE256:
+		case ALGO_GROESTL:
+		case ALGO_KECCAK:
+		case ALGO_BLAKECOIN:
+		case ALGO_WHIRLCOIN:
+			return true;
+	}
+	return false;
+}
+
+/* per thread extranonce2 space: the top byte of xnonce2 is the thread
+ * number + 1 (stratum_gen_work() leaves it to 0), so each miner thread
+ * can build headers from its own copy of the job coinbase and branch */
+struct thr_job {
+	char job_id[128]; // of the g_work the copy was taken for
+	uchar *coinbase;
+	size_t coinbase_alloc;
+	int cb_size;
+	int xn2_offset;
+	int xn2_size;
+	int done;
+	uint32_t midstate[8];
+	int merkle_count;
+	int merkle_alloc;
+	uint32_t (*branch)[8];
+	uint32_t counter;
+};
+
+static bool thr_job_allowed(struct stratum_ctx *sctx)
+{
+	if (sctx->rpc2 || opt_n_threads >= 255)
+		return false;
+	if (sctx->xnonce2_size < 3 + (opt_stratum_proxy ? STRATUM_PROXY_XN2 : 0) ||
+	    sctx->xnonce2_size > sizeof(((struct work*)0)->xnonce2))
+		return false;
+	switch (opt_algo) {
+		case ALGO_DECRED:
+		case ALGO_EQUIHASH:
+		case ALGO_SIA:
+		case ALGO_HEAVY:
+		case ALGO_MJOLLNIR:
+		case ALGO_ZR5:
+		case ALGO_WILDKECCAK:
+		case ALGO_CRYPTOLIGHT:
+		case ALGO_CRYPTONIGHT:
+			return false; // specific headers
+	}
+	return true;
+}
+
+// copy the stratum job of a g_work snapshot, once per job
+static bool thr_job_fetch(struct thr_job *tj, struct stratum_ctx *sctx, const struct work *gwork)
+{
+	bool ret = false;
+
+	pthread_mutex_lock(&stratum_work_lock);
+	if (!sctx->job.job_id || strcmp(sctx->job.job_id, gwork->job_id + 8) ||
+	    sctx->pooln != gwork->pooln || !job_merkle_update(sctx))
+		goto out; // g_work not yet regenerated for a new job
+
+	if (sctx->job.coinbase_size > tj->coinbase_alloc) {
+		uchar *p = (uchar*) realloc(tj->coinbase, sctx->job.coinbase_size);
+		if (!p) goto out;
+		tj->coinbase = p;
+		tj->coinbase_alloc = sctx->job.coinbase_size;
+	}
+	if (job_merkle.merkle_count > tj->merkle_alloc) {
+		void *p = realloc(tj->branch, job_merkle.merkle_count * sizeof(tj->branch[0]));
+		if (!p) goto out;
+		tj->branch = (uint32_t (*)[8]) p;
+		tj->merkle_alloc = job_merkle.merkle_count;
+	}
+	memcpy(tj->coinbase, sctx->job.coinbase, sctx->job.coinbase_size);
+	tj->cb_size = (int) sctx->job.coinbase_size;
+	tj->xn2_offset = (int) (sctx->job.xnonce2 - sctx->job.coinbase);
+	tj->xn2_size = (int) sctx->xnonce2_size;
+	tj->done = job_merkle.done;
+	memcpy(tj->midstate, job_merkle.midstate, sizeof(tj->midstate));
+	memcpy(tj->branch, job_merkle.branch, job_merkle.merkle_count * sizeof(tj->branch[0]));
+	tj->merkle_count = job_merkle.merkle_count;
+	strcpy(tj->job_id, gwork->job_id);
+	tj->counter = 0;
+	ret = true;
+out:
+	pthread_mutex_unlock(&stratum_work_lock);
+	return ret;
+}
+
+/* build a new work from the g_work snapshot with the next xnonce2 of the
+ * thread, without touching shared state (except once per job) */
+static bool thr_gen_work(struct thr_job *tj, struct stratum_ctx *sctx, struct work *work,
+	const struct work *gwork, int thr_id)
+{
+	// the first bytes are the client number of the proxy mode
+	const int lo = opt_stratum_proxy ? STRATUM_PROXY_XN2 : 0;
+	uint32_t root[8];
+	uchar *xnonce2;
+	int i;
+
+	if (!gwork->data[0] || !thr_job_allowed(sctx))
+		return false;
+	if (strcmp(tj->job_id, gwork->job_id) && !thr_job_fetch(tj, sctx, gwork))
+		return false;
+	// counter bytes are below the thread byte, keep them from carrying into it
+	if (tj->xn2_size - lo < 5 && (tj->counter + 1) >> (8 * (tj->xn2_size - lo - 1)))
+		return false;
+	tj->counter++;
+
+	xnonce2 = tj->coinbase + tj->xn2_offset;
+	memset(xnonce2, 0, tj->xn2_size);
+	for (i = 0; i < 4 && lo + i < tj->xn2_size - 1; i++)
+		xnonce2[lo + i] = (uchar) (tj->counter >> (8 * i));
+	xnonce2[tj->xn2_size - 1] = (uchar) (thr_id + 1);
+
+	merkle_root_words(root, tj->midstate, tj->coinbase, tj->done, tj->cb_size,
+		!coinbase_single_sha256(), tj->branch, tj->merkle_count);
+
+	work_copy(work, gwork);
+	work->xnonce2_len = tj->xn2_size;
+	memcpy(work->xnonce2, xnonce2, tj->xn2_size);
+	for (i = 0; i < 8; i++)
+		work->data[9 + i] = root[i];
+	return true;
+}
+
+/* version-rolling (BIP 310): a new nonce space for the work with the next
+ * header version bits of the thread in the pool mask, no merkle to compute */
+static bool thr_roll_version(struct work *work, const struct work *gwork, uint32_t *rolls, int thr_id)
+{
+	const uint32_t mask = stratum.vr_mask;
+	uint32_t bits = 0, m = mask;
+	// never 0, the original version
+	uint64_t n = (uint64_t) (*rolls + 1) * opt_n_threads + thr_id;
+
+	if (!mask || (opt_algo != ALGO_SHA256D && opt_algo != ALGO_SHA256T))
+		return false;
+	if (strcmp(work->job_id, gwork->job_id))
+		return false;
+	// spread n on the mask bits
+	for (; m && n; m &= m - 1, n >>= 1)
+		if (n & 1) bits |= m & (~m + 1);
+	if (n)
+		return false; // all the versions were used
+	(*rolls)++;
+	work->data[0] = swab32((swab32(gwork->data[0]) & ~mask) | bits);
+	work->vr_mask = mask;
+	return true;
+}
+
 static bool stratum_gen_work(struct stratum_ctx *sctx, struct work *work)
 {
+	struct timeval tv_start, tv_end, diff;
 	uchar merkle_root[64] = { 0 };
 	int i;
 
@@ -1551,6 +2070,7 @@ static bool stratum_gen_work(struct stratum_ctx *sctx, struct work *work)
 	work->pooln = sctx->pooln;
 
 	/* Generate merkle root */
+	gettimeofday(&tv_start, NULL);
 	switch (opt_algo) {
 		case ALGO_DECRED:
 		case ALGO_EQUIHASH:
@@ -1560,33 +2080,20 @@ static bool stratum_gen_work(struct stratum_ctx *sctx, struct work *work)
 #ifdef WITH_HEAVY_ALGO
 		case ALGO_HEAVY:
 		case ALGO_MJOLLNIR:
-			heavycoin_hash(merkle_root, sctx->job.coinbase, (int)sctx->job.coinbase_size);
+			heavy_merkle_root(sctx, merkle_root);
 			break;
 #endif
-		case ALGO_FUGUE256:
-		case ALGO_GROESTL:
-		case ALGO_KECCAK:
-		case ALGO_BLAKECOIN:
-		case ALGO_WHIRLCOIN:
-			SHA256((uchar*)sctx->job.coinbase, sctx->job.coinbase_size, (uchar*)merkle_root);
-			break;
-		case ALGO_WHIRLPOOL:
 		default:
-			sha256d(merkle_root, sctx->job.coinbase, (int)sctx->job.coinbase_size);
+			stratum_merkle_root(sctx, merkle_root, !coinbase_single_sha256());
 	}
+	gettimeofday(&tv_end, NULL);
+	timeval_subtract(&diff, &tv_end, &tv_start);
+	pools[sctx->pooln].work_gen_usec += (uint64_t) diff.tv_sec * 1000000 + diff.tv_usec;
+	pools[sctx->pooln].work_gen_count++;
 
-	for (i = 0; i < sctx->job.merkle_count; i++) {
-		memcpy(merkle_root + 32, sctx->job.merkle[i], 32);
-#ifdef WITH_HEAVY_ALGO
-		if (opt_algo == ALGO_HEAVY || opt_algo == ALGO_MJOLLNIR)
-			heavycoin_hash(merkle_root, merkle_root, 64);
-		else
-#endif
-			sha256d(merkle_root, merkle_root, 64);
-	}
-	
-	/* Increment extranonce2 */
-	for (i = 0; i < (int)sctx->xnonce2_size && !++sctx->job.xnonce2[i]; i++);
+	/* Increment extranonce2, the proxy clients own the values of its first bytes */
+	for (i = opt_stratum_proxy ? STRATUM_PROXY_XN2 : 0;
+	     i < (int)sctx->xnonce2_size && !++sctx->job.xnonce2[i]; i++);
 
 	/* Assemble block header */
 	memset(work->data, 0, sizeof(work->data));
@@ -1735,6 +2242,56 @@ static bool stratum_gen_work(struct stratum_ctx *sctx, struct work *work)
 	return true;
 }
 
+/* work of the next extranonce2 of the current job, merkle root done,
+ * taken by a shared regen instead of building it under g_work_lock */
+static struct work _ALIGN(64) next_work;
+static uint32_t next_work_seq; // stratum job_seq of the fill
+static bool next_work_ready = false;
+static pthread_mutex_t next_work_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// to call out of g_work_lock, the header is built under next_work_lock only
+static void next_work_fill(struct stratum_ctx *sctx)
+{
+	if (sctx->rpc2)
+		return;
+	pthread_mutex_lock(&next_work_lock);
+	if (!next_work_ready) {
+		// read before the build, a job published meanwhile fails the take
+		pthread_mutex_lock(&stratum_work_lock);
+		next_work_seq = sctx->job_seq;
+		pthread_mutex_unlock(&stratum_work_lock);
+		next_work_ready = stratum_gen_work(sctx, &next_work);
+	}
+	pthread_mutex_unlock(&next_work_lock);
+}
+
+static void next_work_drop()
+{
+	pthread_mutex_lock(&next_work_lock);
+	next_work_ready = false;
+	pthread_mutex_unlock(&next_work_lock);
+}
+
+// called with g_work_lock held, false if the job changed since the fill
+static bool next_work_take(struct stratum_ctx *sctx, struct work *work)
+{
+	bool ret = false;
+	pthread_mutex_lock(&next_work_lock);
+	if (next_work_ready) {
+		pthread_mutex_lock(&stratum_work_lock);
+		// the same job id can be sent again (clean_jobs, new extranonce)
+		ret = sctx->job.job_id && next_work.pooln == sctx->pooln &&
+			next_work_seq == sctx->job_seq &&
+			!strcmp(next_work.job_id + 8, sctx->job.job_id);
+		pthread_mutex_unlock(&stratum_work_lock);
+		if (ret)
+			work_copy(work, &next_work);
+		next_work_ready = false;
+	}
+	pthread_mutex_unlock(&next_work_lock);
+	return ret;
+}
+
 void restart_threads(void)
 {
 	if (opt_debug && !opt_quiet)
@@ -1742,6 +2299,75 @@ void restart_threads(void)
 
 	for (int i = 0; i < opt_n_threads && work_restart; i++)
 		work_restart[i].restart = 1;
+	work_restart_notify();
+}
+
+/* work generation, bumped on restarts and g_work updates. Idle threads
+ * wait on it (a futex on linux) instead of sleeping a fixed delay */
+volatile uint32_t work_restart_gen;
+
+#ifndef __linux__
+static pthread_mutex_t restart_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t restart_wait_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+void work_restart_notify(void)
+{
+#ifdef __linux__
+	__sync_add_and_fetch(&work_restart_gen, 1);
+	syscall(SYS_futex, &work_restart_gen, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&restart_wait_lock);
+	work_restart_gen++;
+	pthread_cond_broadcast(&restart_wait_cond);
+	pthread_mutex_unlock(&restart_wait_lock);
+#endif
+}
+
+/* sleep up to msecs, or less if the work generation is no more gen.
+ * return true when woken by a new work */
+bool restart_wait(uint32_t gen, int msecs)
+{
+#ifdef __linux__
+	struct timespec end, now, ts;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += msecs / 1000;
+	end.tv_nsec += (msecs % 1000) * 1000000L;
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+	while (work_restart_gen == gen && !abort_flag) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ts.tv_sec = end.tv_sec - now.tv_sec;
+		ts.tv_nsec = end.tv_nsec - now.tv_nsec;
+		if (ts.tv_nsec < 0) {
+			ts.tv_sec--;
+			ts.tv_nsec += 1000000000L;
+		}
+		if (ts.tv_sec < 0)
+			break;
+		// returns at once (EAGAIN) if the generation changed meanwhile
+		syscall(SYS_futex, &work_restart_gen, FUTEX_WAIT_PRIVATE, gen, &ts, NULL, 0);
+	}
+#else
+	struct timeval tv;
+	struct timespec abstime;
+	gettimeofday(&tv, NULL);
+	abstime.tv_sec = tv.tv_sec + msecs / 1000;
+	abstime.tv_nsec = (tv.tv_usec + (msecs % 1000) * 1000L) * 1000L;
+	if (abstime.tv_nsec >= 1000000000L) {
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&restart_wait_lock);
+	while (work_restart_gen == gen && !abort_flag) {
+		if (pthread_cond_timedwait(&restart_wait_cond, &restart_wait_lock, &abstime) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&restart_wait_lock);
+#endif
+	return work_restart_gen != gen;
 }
 
 static bool wanna_mine(int thr_id)
@@ -1797,6 +2423,77 @@ static bool wanna_mine(int thr_id)
 	return state;
 }
 
+/* smallest scan range of an algo, the first one also sizes the
+ * device buffers (scanhash init) so it can not be smaller */
+static uint64_t scan_min_range()
+{
+	uint64_t minmax = 0x100000;
+	switch (opt_algo) {
+	case ALGO_BLAKECOIN:
+	case ALGO_BLAKE2S:
+	case ALGO_VANILLA:
+		minmax = 0x80000000U;
+		break;
+	case ALGO_BLAKE:
+	case ALGO_BMW:
+	case ALGO_DECRED:
+	case ALGO_SHA256D:
+	case ALGO_SHA256T:
+	//case ALGO_WHIRLPOOLX:
+		minmax = 0x40000000U;
+		break;
+	case ALGO_KECCAK:
+	case ALGO_KECCAKC:
+	case ALGO_LBRY:
+	case ALGO_LUFFA:
+	case ALGO_SIA:
+	case ALGO_SKEIN:
+	case ALGO_SKEIN2:
+	case ALGO_TRIBUS:
+		minmax = 0x1000000;
+		break;
+	case ALGO_C11:
+	case ALGO_DEEP:
+	case ALGO_HEAVY:
+	case ALGO_JACKPOT:
+	case ALGO_JHA:
+	case ALGO_HSR:
+	case ALGO_LYRA2v2:
+	case ALGO_PHI:
+	case ALGO_POLYTIMOS:
+	case ALGO_S3:
+	case ALGO_SKUNK:
+	case ALGO_TIMETRAVEL:
+	case ALGO_BITCORE:
+	case ALGO_X11EVO:
+	case ALGO_X11:
+	case ALGO_X12:
+	case ALGO_X13:
+	case ALGO_WHIRLCOIN:
+	case ALGO_WHIRLPOOL:
+		minmax = 0x400000;
+		break;
+	case ALGO_X14:
+	case ALGO_X15:
+		minmax = 0x300000;
+		break;
+	case ALGO_LYRA2:
+	case ALGO_LYRA2Z:
+	case ALGO_NEOSCRYPT:
+	case ALGO_SIB:
+	case ALGO_SCRYPT:
+	case ALGO_VELTOR:
+		minmax = 0x80000;
+		break;
+	case ALGO_CRYPTOLIGHT:
+	case ALGO_CRYPTONIGHT:
+	case ALGO_SCRYPT_JANE:
+		minmax = 0x1000;
+		break;
+	}
+	return minmax;
+}
+
 static void *miner_thread(void *userdata)
 {
 	struct thr_info *mythr = (struct thr_info *)userdata;
@@ -1805,16 +2502,24 @@ static void *miner_thread(void *userdata)
 	int dev_id = device_map[thr_id % MAX_GPUS];
 	struct cgpu_info * cgpu = &thr_info[thr_id].gpu;
 	struct work work;
+	struct work gwork; // g_work snapshot
+	uint32_t gwork_seq = 1;
 	uint64_t loopcnt = 0;
 	uint32_t max_nonce;
 	uint32_t end_nonce = UINT32_MAX / opt_n_threads * (thr_id + 1) - (thr_id + 1);
 	time_t tm_rate_log = 0;
 	bool work_done = false;
-	bool extrajob = false;
+	struct thr_job tjob = { 0 };
+	bool own_work = false; // work from thr_gen_work()
+	uint32_t own_seq = 1;
+	time_t thr_work_time = 0;
+	bool sched_done = false;
+	uint32_t vr_rolls = 0; // version-rolling count of the work
 	char s[16];
 	int rc = 0;
 
 	memset(&work, 0, sizeof(work)); // prevent work from being used uninitialized
+	memset(&gwork, 0, sizeof(gwork));
 
 	if (opt_priority > 0) {
 		int prio = 2; // default to normal
@@ -1869,15 +2574,28 @@ static void *miner_thread(void *userdata)
 		struct timeval tv_start, tv_end, diff;
 		unsigned long hashes_done;
 		uint32_t start_nonce;
+		// before the g_work snapshot, a later update wakes restart_wait()
+		uint32_t restart_gen = work_restart_gen;
 		uint32_t scan_time = have_longpoll ? LP_SCANTIME : opt_scantime;
 		uint64_t max64, minmax = 0x100000;
 		int nodata_check_oft = 0;
-		bool regen = false;
+		bool regen = false, nonce_done;
 
 		// &work.data[19]
 		int wcmplen = (opt_algo == ALGO_DECRED) ? 140 : 76;
 		int wcmpoft = 0;
 
+		bool nonce_sched = !opt_benchmark && !stratum.rpc2;
+		switch (opt_algo) {
+			case ALGO_DECRED:
+			case ALGO_EQUIHASH:
+			case ALGO_SIA:
+			case ALGO_WILDKECCAK:
+			case ALGO_CRYPTOLIGHT:
+			case ALGO_CRYPTONIGHT:
+				nonce_sched = false; // extra nonce space or specific ranges
+		}
+
 		if (opt_algo == ALGO_LBRY) wcmplen = 108;
 		else if (opt_algo == ALGO_SIA) {
 			wcmpoft = (32+16)/4;
@@ -1899,48 +2617,64 @@ static void *miner_thread(void *userdata)
 		}
 
 		if (have_stratum) {
-			uint32_t sleeptime = 0;
+			time_t now = time(NULL);
 
 			if (opt_algo == ALGO_DECRED || opt_algo == ALGO_WILDKECCAK /* getjob */)
 				work_done = true; // force "regen" hash
-			while (!work_done && time(NULL) >= (g_work_time + opt_scantime)) {
-				usleep(100*1000);
-				if (sleeptime > 4) {
-					extrajob = true;
-					break;
-				}
-				sleeptime++;
-			}
-			if (sleeptime && opt_debug && !opt_quiet)
-				applog(LOG_DEBUG, "sleeptime: %u ms", sleeptime*100);
-			//nonceptr = (uint32_t*) (((char*)work.data) + wcmplen);
-			pthread_mutex_lock(&g_work_lock);
-			extrajob |= work_done;
 
-			regen = (nonceptr[0] >= end_nonce);
+			nonce_done = regen = nonce_sched ? sched_done : (nonceptr[0] >= end_nonce);
 			if (opt_algo == ALGO_SIA) {
 				regen = ((nonceptr[1] & 0xFF00) >= 0xF000);
 			}
-			regen = regen || extrajob;
+			regen = regen || work_done || now >= max(g_work_time, thr_work_time) + opt_scantime;
+
+			gwork_seq = g_work_snapshot(&gwork, gwork_seq);
+			if (own_seq != gwork_seq)
+				own_work = false;
 
 			if (regen) {
 				work_done = false;
-				extrajob = false;
-				if (stratum_gen_work(&stratum, &g_work))
-					g_work_time = time(NULL);
-				if (opt_algo == ALGO_CRYPTONIGHT || opt_algo == ALGO_CRYPTOLIGHT)
-					nonceptr[0] += 0x100000;
+				sched_done = false;
+				thr_work_time = now;
+				// the same work with other version bits, when g_work did not change
+				if (nonce_done && g_work_time &&
+				    (own_work || !memcmp(&work.data[1], &gwork.data[1], 72)) &&
+				    thr_roll_version(&work, &gwork, &vr_rolls, thr_id)) {
+					own_work = true;
+					own_seq = gwork_seq;
+					nonceptr[0] = (UINT32_MAX / opt_n_threads) * thr_id;
+				}
+				// a new work in the thread extranonce2 space, g_work_time 0 asks a shared one
+				else if (g_work_time && thr_gen_work(&tjob, &stratum, &work, &gwork, thr_id)) {
+					own_work = true;
+					own_seq = gwork_seq;
+					vr_rolls = 0;
+					nonceptr[0] = (UINT32_MAX / opt_n_threads) * thr_id;
+				} else {
+					vr_rolls = 0;
+					g_work_write_lock();
+					if (next_work_take(&stratum, &g_work) || stratum_gen_work(&stratum, &g_work))
+						g_work_time = time(NULL);
+					g_work_write_unlock();
+					next_work_fill(&stratum);
+					if (opt_algo == ALGO_CRYPTONIGHT || opt_algo == ALGO_CRYPTOLIGHT)
+						nonceptr[0] += 0x100000;
+				}
 			}
 		} else {
-			uint32_t secs = 0;
-			pthread_mutex_lock(&g_work_lock);
-			secs = (uint32_t) (time(NULL) - g_work_time);
-			if (secs >= scan_time || nonceptr[0] >= (end_nonce - 0x100)) {
+			uint32_t secs = (uint32_t) (time(NULL) - g_work_time);
+			if (secs >= scan_time || (nonce_sched ? sched_done : nonceptr[0] >= (end_nonce - 0x100))) {
+				bool got_work;
+				sched_done = false;
 				if (opt_debug && g_work_time && !opt_quiet)
 					applog(LOG_DEBUG, "work time %u/%us nonce %x/%x", secs, scan_time, nonceptr[0], end_nonce);
 				/* obtain new work from internal workio thread */
-				if (unlikely(!get_work(mythr, &g_work))) {
-					pthread_mutex_unlock(&g_work_lock);
+				g_work_write_lock();
+				got_work = get_work(mythr, &g_work);
+				if (got_work)
+					g_work_time = time(NULL);
+				g_work_write_unlock();
+				if (unlikely(!got_work)) {
 					if (switchn != pool_switch_count) {
 						switchn = pool_switch_count;
 						continue;
@@ -1949,23 +2683,27 @@ static void *miner_thread(void *userdata)
 						goto out;
 					}
 				}
-				g_work_time = time(NULL);
 			}
 		}
 
+		// lock-free read of the current work, copied only when it changed
+		gwork_seq = g_work_snapshot(&gwork, gwork_seq);
+		if (own_seq != gwork_seq)
+			own_work = false;
+
 		// reset shares id counter on new job
-		if (strcmp(work.job_id, g_work.job_id))
+		if (strcmp(work.job_id, gwork.job_id))
 			stratum.job.shares_count = 0;
 
-		if (!opt_benchmark && (g_work.height != work.height || memcmp(work.target, g_work.target, sizeof(work.target))))
+		if (!opt_benchmark && (gwork.height != work.height || memcmp(work.target, gwork.target, sizeof(work.target))))
 		{
 			if (opt_debug) {
-				uint64_t target64 = g_work.target[7] * 0x100000000ULL + g_work.target[6];
-				applog(LOG_DEBUG, "job %s target change: %llx (%.1f)", g_work.job_id, target64, g_work.targetdiff);
+				uint64_t target64 = gwork.target[7] * 0x100000000ULL + gwork.target[6];
+				applog(LOG_DEBUG, "job %s target change: %llx (%.1f)", gwork.job_id, target64, gwork.targetdiff);
 			}
-			memcpy(work.target, g_work.target, sizeof(work.target));
-			work.targetdiff = g_work.targetdiff;
-			work.height = g_work.height;
+			memcpy(work.target, gwork.target, sizeof(work.target));
+			work.targetdiff = gwork.targetdiff;
+			work.height = gwork.height;
 			//nonceptr[0] = (UINT32_MAX / opt_n_threads) * thr_id; // 0 if single thr
 		}
 
@@ -1975,18 +2713,24 @@ static void *miner_thread(void *userdata)
 			wcmplen -= 4;
 		}
 
-		if (opt_algo == ALGO_CRYPTONIGHT || opt_algo == ALGO_CRYPTOLIGHT) {
+		if (own_work) {
+			// built by thr_gen_work(), g_work did not change since
+			if (!regen)
+				nonceptr[0]++;
+		}
+
+		else if (opt_algo == ALGO_CRYPTONIGHT || opt_algo == ALGO_CRYPTOLIGHT) {
 			uint32_t oldpos = nonceptr[0];
 			bool nicehash = strstr(pools[cur_pooln].url, "nicehash") != NULL;
-			if (memcmp(&work.data[wcmpoft], &g_work.data[wcmpoft], wcmplen)) {
-				memcpy(&work, &g_work, sizeof(struct work));
+			if (memcmp(&work.data[wcmpoft], &gwork.data[wcmpoft], wcmplen)) {
+				work_copy(&work, &gwork);
 				if (!nicehash) nonceptr[0] = (rand()*4) << 24;
 				nonceptr[0] &=  0xFF000000u; // nicehash prefix hack
 				nonceptr[0] |= (0x00FFFFFFu / opt_n_threads) * thr_id;
 			}
 			// also check the end, nonce in the middle
-			else if (memcmp(&work.data[44/4], &g_work.data[0], 76-44)) {
-				memcpy(&work, &g_work, sizeof(struct work));
+			else if (memcmp(&work.data[44/4], &gwork.data[0], 76-44)) {
+				work_copy(&work, &gwork);
 			}
 			if (oldpos & 0xFFFF) {
 				if (!nicehash) nonceptr[0] = oldpos + 0x1000000u;
@@ -1997,27 +2741,26 @@ static void *miner_thread(void *userdata)
 			}
 		}
 
-		else if (memcmp(&work.data[wcmpoft], &g_work.data[wcmpoft], wcmplen)) {
+		else if (memcmp(&work.data[wcmpoft], &gwork.data[wcmpoft], wcmplen)) {
 			#if 0
 			if (opt_debug) {
 				for (int n=0; n <= (wcmplen-8); n+=8) {
-					if (memcmp(work.data + n, g_work.data + n, 8)) {
-						applog(LOG_DEBUG, "job %s work updated at offset %d:", g_work.job_id, n);
+					if (memcmp(work.data + n, gwork.data + n, 8)) {
+						applog(LOG_DEBUG, "job %s work updated at offset %d:", gwork.job_id, n);
 						applog_hash((uchar*) &work.data[n]);
-						applog_compare_hash((uchar*) &g_work.data[n], (uchar*) &work.data[n]);
+						applog_compare_hash((uchar*) &gwork.data[n], (uchar*) &work.data[n]);
 					}
 				}
 			}
 			#endif
-			memcpy(&work, &g_work, sizeof(struct work));
+			work_copy(&work, &gwork);
 			nonceptr[0] = (UINT32_MAX / opt_n_threads) * thr_id; // 0 if single thr
 		} else
 			nonceptr[0]++; //??
 
 		if (opt_algo == ALGO_DECRED) {
 			// suprnova job_id check without data/target/height change...
-			if (check_stratum_jobs && strcmp(work.job_id, g_work.job_id)) {
-				pthread_mutex_unlock(&g_work_lock);
+			if (check_stratum_jobs && strcmp(work.job_id, gwork.job_id)) {
 				continue;
 			}
 
@@ -2036,8 +2779,7 @@ static void *miner_thread(void *userdata)
 			//nonceptr[1] += 1;
 		} else if (opt_algo == ALGO_SIA) {
 			// suprnova job_id check without data/target/height change...
-			if (have_stratum && strcmp(work.job_id, g_work.job_id)) {
-				pthread_mutex_unlock(&g_work_lock);
+			if (have_stratum && strcmp(work.job_id, gwork.job_id)) {
 				work_done = true;
 				continue;
 			}
@@ -2051,8 +2793,6 @@ static void *miner_thread(void *userdata)
 			nonceptr[-1] += 1;
 		}
 
-		pthread_mutex_unlock(&g_work_lock);
-
 		// --benchmark [-a all]
 		if (opt_benchmark && bench_algo >= 0) {
 			//gpulog(LOG_DEBUG, thr_id, "loop %d", loopcnt);
@@ -2073,14 +2813,12 @@ static void *miner_thread(void *userdata)
 		else if (opt_algo == ALGO_DECRED) nodata_check_oft = 4; // testnet ver is 0
 		else nodata_check_oft = 0;
 		if (have_stratum && work.data[nodata_check_oft] == 0 && !opt_benchmark) {
-			sleep(1);
-			if (!thr_id) pools[cur_pooln].wait_time += 1;
+			if (!restart_wait(restart_gen, 1000) && !thr_id) pools[cur_pooln].wait_time += 1;
 			gpulog(LOG_DEBUG, thr_id, "no data");
 			continue;
 		}
 		if (opt_algo == ALGO_WILDKECCAK && !scratchpad_size) {
-			sleep(1);
-			if (!thr_id) pools[cur_pooln].wait_time += 1;
+			if (!restart_wait(restart_gen, 1000) && !thr_id) pools[cur_pooln].wait_time += 1;
 			continue;
 		}
 
@@ -2108,7 +2846,7 @@ static void *miner_thread(void *userdata)
 					if (!thr_id) pools[cur_pooln].wait_time += 1;
 					pool_is_switching = false;
 				}
-				sleep(1);
+				restart_wait(restart_gen, 1000);
 				continue;
 			}
 
@@ -2205,90 +2943,39 @@ static void *miner_thread(void *userdata)
 			}
 		}
 
-		max64 *= (uint32_t)thr_hashrates[thr_id];
-
-		/* on start, max64 should not be 0,
-		 *    before hashrate is computed */
-		if (max64 < minmax) {
-			switch (opt_algo) {
-			case ALGO_BLAKECOIN:
-			case ALGO_BLAKE2S:
-			case ALGO_VANILLA:
-				minmax = 0x80000000U;
-				break;
-			case ALGO_BLAKE:
-			case ALGO_BMW:
-			case ALGO_DECRED:
-			case ALGO_SHA256D:
-			case ALGO_SHA256T:
-			//case ALGO_WHIRLPOOLX:
-				minmax = 0x40000000U;
-				break;
-			case ALGO_KECCAK:
-			case ALGO_KECCAKC:
-			case ALGO_LBRY:
-			case ALGO_LUFFA:
-			case ALGO_SIA:
-			case ALGO_SKEIN:
-			case ALGO_SKEIN2:
-			case ALGO_TRIBUS:
-				minmax = 0x1000000;
-				break;
-			case ALGO_C11:
-			case ALGO_DEEP:
-			case ALGO_HEAVY:
-			case ALGO_JACKPOT:
-			case ALGO_JHA:
-			case ALGO_HSR:
-			case ALGO_LYRA2v2:
-			case ALGO_PHI:
-			case ALGO_POLYTIMOS:
-			case ALGO_S3:
-			case ALGO_SKUNK:
-			case ALGO_TIMETRAVEL:
-			case ALGO_BITCORE:
-			case ALGO_X11EVO:
-			case ALGO_X11:
-			case ALGO_X12:
-			case ALGO_X13:
-			case ALGO_WHIRLCOIN:
-			case ALGO_WHIRLPOOL:
-				minmax = 0x400000;
-				break;
-			case ALGO_X14:
-			case ALGO_X15:
-				minmax = 0x300000;
-				break;
-			case ALGO_LYRA2:
-			case ALGO_LYRA2Z:
-			case ALGO_NEOSCRYPT:
-			case ALGO_SIB:
-			case ALGO_SCRYPT:
-			case ALGO_VELTOR:
-				minmax = 0x80000;
-				break;
-			case ALGO_CRYPTOLIGHT:
-			case ALGO_CRYPTONIGHT:
-			case ALGO_SCRYPT_JANE:
-				minmax = 0x1000;
-				break;
+		if (nonce_sched) {
+			/* chunk sized from the thread speed, shared header ranges are split and stolen */
+			uint32_t first, last;
+			uint64_t key = nonce_sched_key(work.data, wcmplen);
+			if (!nonce_sched_next(thr_id, key, !own_work, nonceptr[0], (double) max64,
+			    scan_min_range(), &first, &last)) {
+				sched_done = true; // nonce space covered, regen
+				continue;
 			}
-			max64 = max(minmax-1, max64);
-		}
+			start_nonce = nonceptr[0] = first;
+			max_nonce = last;
+		} else {
+			max64 *= (uint32_t)thr_hashrates[thr_id];
 
-		// we can't scan more than uint32 capacity
-		max64 = min(UINT32_MAX, max64);
+			/* on start, max64 should not be 0,
+			 *    before hashrate is computed */
+			if (max64 < minmax)
+				max64 = max(scan_min_range()-1, max64);
 
-		start_nonce = nonceptr[0];
+			// we can't scan more than uint32 capacity
+			max64 = min(UINT32_MAX, max64);
 
-		/* never let small ranges at end */
-		if (end_nonce >= UINT32_MAX - 256)
-			end_nonce = UINT32_MAX;
+			start_nonce = nonceptr[0];
 
-		if ((max64 + start_nonce) >= end_nonce)
-			max_nonce = end_nonce;
-		else
-			max_nonce = (uint32_t) (max64 + start_nonce);
+			/* never let small ranges at end */
+			if (end_nonce >= UINT32_MAX - 256)
+				end_nonce = UINT32_MAX;
+
+			if ((max64 + start_nonce) >= end_nonce)
+				max_nonce = end_nonce;
+			else
+				max_nonce = (uint32_t) (max64 + start_nonce);
+		}
 
 		// todo: keep it rounded to a multiple of 256 ?
 
@@ -2336,7 +3023,10 @@ static void *miner_thread(void *userdata)
 			rc = scanhash_blake2s(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_BMW:
-			rc = scanhash_bmw(thr_id, &work, max_nonce, &hashes_done);
+			if (opt_cpu_scan)
+				rc = scanhash_bmw_cpu(thr_id, &work, max_nonce, &hashes_done);
+			else
+				rc = scanhash_bmw(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_C11:
 			rc = scanhash_c11(thr_id, &work, max_nonce, &hashes_done);
@@ -2351,7 +3041,10 @@ static void *miner_thread(void *userdata)
 			rc = scanhash_decred(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_DEEP:
-			rc = scanhash_deep(thr_id, &work, max_nonce, &hashes_done);
+			if (opt_cpu_scan)
+				rc = scanhash_deep_cpu(thr_id, &work, max_nonce, &hashes_done);
+			else
+				rc = scanhash_deep(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_EQUIHASH:
 			rc = scanhash_equihash(thr_id, &work, max_nonce, &hashes_done);
@@ -2375,7 +3068,10 @@ static void *miner_thread(void *userdata)
 			rc = scanhash_hmq17(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_HSR:
-			rc = scanhash_hsr(thr_id, &work, max_nonce, &hashes_done);
+			if (opt_cpu_scan)
+				rc = scanhash_hsr_cpu(thr_id, &work, max_nonce, &hashes_done);
+			else
+				rc = scanhash_hsr(thr_id, &work, max_nonce, &hashes_done);
 			break;
 #ifdef WITH_HEAVY_ALGO
 		case ALGO_HEAVY:
@@ -2401,13 +3097,19 @@ static void *miner_thread(void *userdata)
 			rc = scanhash_lbry(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_LUFFA:
-			rc = scanhash_luffa(thr_id, &work, max_nonce, &hashes_done);
+			if (opt_cpu_scan)
+				rc = scanhash_luffa_cpu(thr_id, &work, max_nonce, &hashes_done);
+			else
+				rc = scanhash_luffa(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_QUARK:
 			rc = scanhash_quark(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_QUBIT:
-			rc = scanhash_qubit(thr_id, &work, max_nonce, &hashes_done);
+			if (opt_cpu_scan)
+				rc = scanhash_qubit_cpu(thr_id, &work, max_nonce, &hashes_done);
+			else
+				rc = scanhash_qubit(thr_id, &work, max_nonce, &hashes_done);
 			break;
 		case ALGO_LYRA2:
 			rc = scanhash_lyra2(thr_id, &work, max_nonce, &hashes_done);
@@ -2550,8 +3252,7 @@ static void *miner_thread(void *userdata)
 
 		if (stratum.rpc2 && (rc == -EBUSY || work_restart[thr_id].restart)) {
 			// bbr scratchpad download or stale result
-			sleep(1);
-			if (!thr_id) pools[cur_pooln].wait_time += 1;
+			if (!restart_wait(restart_gen, 1000) && !thr_id) pools[cur_pooln].wait_time += 1;
 			continue;
 		}
 
@@ -2579,6 +3280,9 @@ static void *miner_thread(void *userdata)
 					break;
 			}
 
+			if (dtime > 0.0 && nonce_sched && loopcnt > 1)
+				nonce_sched_rate(thr_id, hashes_done / dtime);
+
 			/* store thread hashrate */
 			if (dtime > 0.0) {
 				pthread_mutex_lock(&stats_lock);
@@ -2684,6 +3388,8 @@ out:
 		gpu_led_off(dev_id);
 	if (opt_debug_threads)
 		applog(LOG_DEBUG, "%s() died", __func__);
+	free(tjob.coinbase);
+	free(tjob.branch);
 	tq_freeze(mythr->q);
 	return NULL;
 }
@@ -2698,7 +3404,7 @@ static void *longpoll_thread(void *userdata)
 	bool need_slash = false;
 	int pooln, switchn;
 
-	curl = curl_easy_init();
+	curl = curl_conn_get();
 	if (unlikely(!curl)) {
 		applog(LOG_ERR, "%s() CURL init failed", __func__);
 		goto out;
@@ -2766,12 +3472,12 @@ longpoll_retry:
 		if (opt_algo == ALGO_SIA) {
 			char *sia_header = sia_getheader(curl, pool);
 			if (sia_header) {
-				pthread_mutex_lock(&g_work_lock);
+				g_work_write_lock();
 				if (sia_work_decode(sia_header, &g_work)) {
 					g_work_time = time(NULL);
 				}
 				free(sia_header);
-				pthread_mutex_unlock(&g_work_lock);
+				g_work_write_unlock();
 			}
 			continue;
 		}
@@ -2785,7 +3491,7 @@ longpoll_retry:
 		if (likely(val)) {
 			soval = json_object_get(json_object_get(val, "result"), "submitold");
 			submit_old = soval ? json_is_true(soval) : false;
-			pthread_mutex_lock(&g_work_lock);
+			g_work_write_lock();
 			if (work_decode(json_object_get(val, "result"), &g_work)) {
 				restart_threads();
 				if (!opt_quiet) {
@@ -2803,7 +3509,7 @@ longpoll_retry:
 				}
 				g_work_time = time(NULL);
 			}
-			pthread_mutex_unlock(&g_work_lock);
+			g_work_write_unlock();
 			json_decref(val);
 		} else {
 			// to check...
@@ -2826,7 +3532,7 @@ out:
 	free(lp_url);
 	tq_freeze(mythr->q);
 	if (curl)
-		curl_easy_cleanup(curl);
+		curl_conn_put(curl);
 
 	return NULL;
 
@@ -2844,9 +3550,8 @@ static bool stratum_handle_response(char *buf)
 {
 	json_t *val, *err_val, *res_val, *id_val;
 	json_error_t err;
-	struct timeval tv_answer, diff;
-	int num = 0, job_nonce_id = 0;
-	double sharediff = stratum.sharediff;
+	struct share_inflight share;
+	int num = 0;
 	bool ret = false;
 
 	val = JSON_LOADS(buf, &err);
@@ -2862,25 +3567,39 @@ static bool stratum_handle_response(char *buf)
 	if (!id_val || json_is_null(id_val))
 		goto out;
 
-	// ignore late login answers
+	// ignore late login and requests answers
 	num = (int) json_integer_value(id_val);
-	if (num < 4)
+	if (num < SHARE_FIRST_ID)
 		goto out;
 
-	// We dont have the work anymore, so use the hashlog to get the right sharediff for multiple nonces
-	job_nonce_id = num - 10;
-	if (opt_showdiff && check_dups)
-		sharediff = hashlog_get_sharediff(g_work.job_id, job_nonce_id, sharediff);
+	// pool, diff and send time of the share answered
+	if (share_inflight_done((uint32_t) num, &share)) {
+		// store time required to the pool to answer to a submit
+		stratum.answer_msec = share.answer_msec;
+		pool_latency_answer(share.pooln, share.answer_msec);
+		if (opt_debug)
+			applog(LOG_DEBUG, "share %d of job %s answered in %u ms", num,
+				share.job_id, share.answer_msec);
+	} else if (opt_stratum_replay) {
+		// recorded answers of shares this miner did not send
+		goto out;
+	} else {
+		if (opt_debug)
+			applog(LOG_DEBUG, "answer to an unknown share %d", num);
+		memset(&share, 0, sizeof(share));
+		share.pooln = stratum.pooln;
+	}
 
-	gettimeofday(&tv_answer, NULL);
-	timeval_subtract(&diff, &tv_answer, &stratum.tv_submit);
-	// store time required to the pool to answer to a submit
-	stratum.answer_msec = (1000 * diff.tv_sec) + (uint32_t) (0.001 * diff.tv_usec);
+	if (share.proxy_client) {
+		proxy_share_answer(&share, json_is_true(res_val), err_val);
+		ret = true;
+		goto out;
+	}
 
 	if (stratum.rpc2) {
 		const char* reject_reason = err_val ? json_string_value(json_object_get(err_val, "message")) : NULL;
 		// {"id":10,"jsonrpc":"2.0","error":null,"result":{"status":"OK"}}
-		share_result(json_is_null(err_val), stratum.pooln, sharediff, reject_reason);
+		share_result(json_is_null(err_val), share.pooln, share.sharediff, reject_reason);
 		if (reject_reason) {
 			g_work_time = 0;
 			restart_threads();
@@ -2888,7 +3607,7 @@ static bool stratum_handle_response(char *buf)
 	} else {
 		if (!res_val)
 			goto out;
-		share_result(json_is_true(res_val), stratum.pooln, sharediff,
+		share_result(json_is_true(res_val), share.pooln, share.sharediff,
 			err_val ? json_string_value(json_array_get(err_val, 1)) : NULL);
 	}
 
@@ -2900,11 +3619,91 @@ out:
 	return ret;
 }
 
+#define SUGGEST_DIFF_TIME 300 /* seconds between two suggestions */
+#define SUGGEST_LIMIT_TIME 3600 /* seconds the inferred pool limits are kept */
+
+/* --share-interval: ask the pool (mining.suggest_difficulty) the difficulty of
+ * one share every opt_share_interval seconds at the measured hashrate */
+static void stratum_suggest_diff(struct stratum_ctx *sctx, struct pool_infos *pool)
+{
+	static time_t suggest_time = 0;
+	double hashrate = 0., ratio = 0., cur_diff, diff;
+	time_t now = time(NULL);
+	char s[128];
+
+	if (opt_share_interval <= 0 || sctx->rpc2 || sctx->is_equihash || !sctx->job.job_id)
+		return;
+	// wait for a stable hashrate
+	if (!firstwork_time || now < firstwork_time + 60 || now < suggest_time + SUGGEST_DIFF_TIME)
+		return;
+	suggest_time = now;
+
+	pthread_mutex_lock(&stratum_work_lock);
+	cur_diff = sctx->job.diff;
+	pthread_mutex_unlock(&stratum_work_lock);
+
+	// pool diff of a 2^32 hashes share (algo factor, without the local -d)
+	pthread_mutex_lock(&g_work_lock);
+	if (g_work.targetdiff > 0.)
+		ratio = cur_diff / (g_work.targetdiff * opt_difficulty);
+	pthread_mutex_unlock(&g_work_lock);
+
+	pthread_mutex_lock(&stats_lock);
+	for (int i = 0; i < opt_n_threads; i++)
+		hashrate += stats_get_speed(i, thr_hashrates[i]);
+	pthread_mutex_unlock(&stats_lock);
+
+	if (ratio <= 0. || hashrate <= 0. || cur_diff <= 0.)
+		return;
+
+	// limits seen in a previous answer, the pool vardiff can move them
+	if (pool->suggest_limit_time && now > pool->suggest_limit_time + SUGGEST_LIMIT_TIME) {
+		pool->suggest_min = pool->suggest_max = 0.;
+		pool->suggest_limit_time = 0;
+	}
+	// the pool clamped the last suggestion sent to its limits
+	if (pool->suggest_pending) {
+		if (cur_diff < pool->suggest_diff * 0.9)
+			pool->suggest_max = cur_diff;
+		else if (cur_diff > pool->suggest_diff * 1.1)
+			pool->suggest_min = cur_diff;
+		if (pool->suggest_min > 0. || pool->suggest_max > 0.)
+			pool->suggest_limit_time = now;
+		pool->suggest_pending = false;
+	}
+
+	diff = hashrate * opt_share_interval / 4294967296. * ratio;
+	if (pool->suggest_max > 0.) diff = min(diff, pool->suggest_max);
+	if (pool->suggest_min > 0.) diff = max(diff, pool->suggest_min);
+	if (fabs(diff - cur_diff) < 0.2 * cur_diff)
+		return;
+
+	if (opt_debug)
+		applog(LOG_DEBUG, "Suggest difficulty %.4g to the pool (%.4g)", diff, cur_diff);
+	snprintf(s, sizeof(s), "{\"id\": 5, \"method\": \"mining.suggest_difficulty\", \"params\": [%.6g]}", diff);
+	if (stratum_send_line(sctx, s)) {
+		pool->suggest_diff = diff;
+		pool->suggest_pending = true;
+	}
+}
+
+/* pool password with the difficulty hint (d=) of the last suggestion */
+static const char *stratum_pool_pass(struct pool_infos *pool, char *buf, size_t len)
+{
+	if (opt_share_interval <= 0 || pool->suggest_diff <= 0. || strstr(pool->pass, "d="))
+		return pool->pass;
+	snprintf(buf, len, "%s%sd=%.6g", pool->pass, strlen(pool->pass) ? "," : "", pool->suggest_diff);
+	return buf;
+}
+
 static void *stratum_thread(void *userdata)
 {
 	struct thr_info *mythr = (struct thr_info *)userdata;
 	struct pool_infos *pool;
 	stratum_ctx *ctx = &stratum;
+	static struct work _ALIGN(64) job_work;
+	struct timeval line_tv = { 0 };
+	char pass[sizeof(pools[0].pass) + 32];
 	int pooln, switchn;
 	char *s;
 
@@ -2935,20 +3734,25 @@ wait_stratum_url:
 		}
 
 		while (!stratum.curl && !abort_flag) {
-			pthread_mutex_lock(&g_work_lock);
+			struct timeval tv_connect;
+			g_work_write_lock();
 			g_work_time = 0;
 			g_work.data[0] = 0;
-			pthread_mutex_unlock(&g_work_lock);
+			g_work_write_unlock();
+			next_work_drop();
 			restart_threads();
 
+			gettimeofday(&tv_connect, NULL);
 			if (!stratum_connect(&stratum, pool->url) ||
 			    !stratum_subscribe(&stratum) ||
-			    !stratum_authorize(&stratum, pool->user, pool->pass))
+			    !stratum_authorize(&stratum, pool->user, stratum_pool_pass(pool, pass, sizeof(pass))))
 			{
 				stratum_disconnect(&stratum);
-				if (opt_retries >= 0 && ++failures > opt_retries) {
+				// no retry when a backup pool is ready
+				bool standby = num_pools > 1 && opt_pool_failover && pool_standby_next(cur_pooln + 1) >= 0;
+				if (standby || (opt_retries >= 0 && ++failures > opt_retries)) {
 					if (num_pools > 1 && opt_pool_failover) {
-						applog(LOG_WARNING, "Stratum connect timeout, failover...");
+						applog(LOG_WARNING, "Stratum connect %s, failover...", standby ? "failed" : "timeout");
 						pool_switch_next(-1);
 					} else {
 						applog(LOG_ERR, "...terminating workio thread");
@@ -2963,22 +3767,51 @@ wait_stratum_url:
 				if (!opt_benchmark)
 					applog(LOG_ERR, "...retry after %d seconds", opt_fail_pause);
 				sleep(opt_fail_pause);
-			}
+			} else
+				pool_latency_connect(pooln, &tv_connect);
 		}
 
 		if (stratum.rpc2) {
 			rpc2_stratum_thread_stuff(pool);
 		}
 
+		if (opt_stratum_proxy)
+			proxy_upstream_check(&stratum);
+
 		if (switchn != pool_switch_count) goto pool_switched;
 
 		if (stratum.job.job_id &&
 		    (!g_work_time || strncmp(stratum.job.job_id, g_work.job_id + 8, sizeof(g_work.job_id)-8))) {
-			pthread_mutex_lock(&g_work_lock);
-			if (stratum_gen_work(&stratum, &g_work))
+			// header, target and logs out of g_work_lock. On a clean job the
+			// miners are stopped first and wait for it on the "no data" check
+			bool ready, clean = stratum.job.clean;
+			next_work_drop();
+			if (clean) {
+				g_work_write_lock();
+				g_work_time = 0;
+				g_work.data[0] = 0;
+				g_work_write_unlock();
+				restart_threads();
+			}
+			ready = stratum_gen_work(&stratum, &job_work);
+			g_work_write_lock();
+			if (ready) {
+				work_copy(&g_work, &job_work);
 				g_work_time = time(NULL);
-			if (stratum.job.clean) {
+			}
+			g_work_write_unlock();
+			if (clean) {
 				static uint32_t last_block_height;
+				if (ready && line_tv.tv_sec) {
+					struct timeval tv_now, diff;
+					gettimeofday(&tv_now, NULL);
+					timeval_subtract(&diff, &tv_now, &line_tv);
+					pool->job_switch_usec += (uint64_t) diff.tv_sec * 1000000 + diff.tv_usec;
+					pool->job_switch_count++;
+					if (opt_debug)
+						applog(LOG_DEBUG, "job %s switched in %.2f ms", stratum.job.job_id,
+							diff.tv_sec * 1000.0 + diff.tv_usec / 1000.0);
+				}
 				if ((!opt_quiet || !firstwork_time) && stratum.job.height != last_block_height) {
 					last_block_height = stratum.job.height;
 					if (net_diff > 0.)
@@ -2988,7 +3821,6 @@ wait_stratum_url:
 						applog(LOG_BLUE, "%s %s block %d", pool->short_url, algo_names[opt_algo],
 							stratum.job.height);
 				}
-				restart_threads();
 				if (check_dups || opt_showdiff)
 					hashlog_purge_old();
 				stats_purge_old();
@@ -2996,18 +3828,23 @@ wait_stratum_url:
 					applog(LOG_BLUE, "%s asks job %d for block %d", pool->short_url,
 						strtoul(stratum.job.job_id, NULL, 16), stratum.job.height);
 			}
-			pthread_mutex_unlock(&g_work_lock);
+			// next extranonce2 ready for the next shared regen
+			next_work_fill(&stratum);
 		}
-		
+		line_tv.tv_sec = 0;
+
 		// check we are on the right pool
 		if (switchn != pool_switch_count) goto pool_switched;
 
+		stratum_suggest_diff(&stratum, pool);
+
 		if (!stratum_socket_full(&stratum, opt_timeout)) {
 			if (opt_debug)
 				applog(LOG_WARNING, "Stratum connection timed out");
 			s = NULL;
 		} else
 			s = stratum_recv_line(&stratum);
+		gettimeofday(&line_tv, NULL);
 
 		// double check we are on the right pool
 		if (switchn != pool_switch_count) goto pool_switched;
@@ -3018,9 +3855,10 @@ wait_stratum_url:
 				applog(LOG_WARNING, "Stratum connection interrupted");
 			continue;
 		}
+		if (opt_stratum_proxy)
+			proxy_upstream_line(s);
 		if (!stratum_handle_method(&stratum, s))
 			stratum_handle_response(s);
-		free(s);
 	}
 
 out:
@@ -3262,6 +4100,38 @@ void parse_arg(int key, char *arg)
 			show_usage_and_exit(1);
 		opt_fail_pause = v;
 		break;
+	case 1026: // pool-standby
+		v = atoi(arg);
+		if (v < 0 || v >= MAX_POOLS)
+			show_usage_and_exit(1);
+		opt_pool_standby = v;
+		break;
+	case 1027: // pool-select
+		if (!strcasecmp(arg, "latency"))
+			opt_pool_select_latency = true;
+		else if (!strcasecmp(arg, "order"))
+			opt_pool_select_latency = false;
+		else
+			show_usage_and_exit(1);
+		break;
+	case 1028: // stratum-proxy
+		free(opt_stratum_proxy);
+		opt_stratum_proxy = strdup(arg);
+		break;
+	case 1029: // stratum-record
+		free(opt_stratum_record);
+		opt_stratum_record = strdup(arg);
+		break;
+	case 1038: // stratum-replay
+		free(opt_stratum_replay);
+		opt_stratum_replay = strdup(arg);
+		break;
+	case 1039: // replay-speed
+		d = atof(arg);
+		if (d < 0.)
+			show_usage_and_exit(1);
+		opt_replay_speed = d;
+		break;
 	case 's':
 		v = atoi(arg);
 		if (v < 1 || v > 9999)	/* sanity check */
@@ -3307,7 +4177,8 @@ void parse_arg(int key, char *arg)
 		p = strstr(arg, "://");
 		if (p) {
 			if (strncasecmp(arg, "http://", 7) && strncasecmp(arg, "https://", 8) &&
-					strncasecmp(arg, "stratum+tcp://", 14))
+					strncasecmp(arg, "stratum+tcp://", 14) && strncasecmp(arg, "stratum+ssl://", 14) &&
+					strncasecmp(arg, "stratum+tls://", 14))
 				show_usage_and_exit(1);
 			free(rpc_url);
 			rpc_url = strdup(arg);
@@ -3556,6 +4427,29 @@ void parse_arg(int key, char *arg)
 	case 1012:
 		opt_extranonce = false;
 		break;
+	case 1040:
+		opt_version_rolling = false;
+		break;
+	case 1044:
+		opt_cpu_scan = true;
+		break;
+	case 1045:
+		opt_no_cert_check = true;
+		break;
+	case 1041: // share-interval
+		v = atoi(arg);
+		if (v < 0 || v > 3600)
+			show_usage_and_exit(1);
+		opt_share_interval = v;
+		break;
+	case 1042: // coinbase-addr
+		free(opt_coinbase_addr);
+		opt_coinbase_addr = strdup(arg);
+		break;
+	case 1043: // coinbase-script
+		free(opt_coinbase_script);
+		opt_coinbase_script = strdup(arg);
+		break;
 	case 1013:
 		opt_showdiff = true;
 		break;
@@ -3954,6 +4848,17 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (opt_stratum_replay) {
+		char url[64];
+		if (!stratum_replay_init(url, sizeof(url)))
+			return EXIT_CODE_SW_INIT_ERROR;
+		// the local replay replaces the recorded pool
+		free(rpc_url);
+		rpc_url = strdup(url);
+		short_url = &rpc_url[14];
+		pool_set_creds(cur_pooln);
+	}
+
 	if (!strlen(rpc_url)) {
 		if (!opt_benchmark) {
 			fprintf(stderr, "%s: no URL supplied\n", argv[0]);
@@ -4092,7 +4997,7 @@ int main(int argc, char *argv[])
 	if (!work_restart)
 		return EXIT_CODE_SW_INIT_ERROR;
 
-	thr_info = (struct thr_info *)calloc(opt_n_threads + 5, sizeof(*thr));
+	thr_info = (struct thr_info *)calloc(opt_n_threads + 9, sizeof(*thr));
 	if (!thr_info)
 		return EXIT_CODE_SW_INIT_ERROR;
 
@@ -4142,6 +5047,43 @@ int main(int argc, char *argv[])
 		tq_push(thr_info[stratum_thr_id].q, strdup(rpc_url));
 	}
 
+	/* backup pools connections */
+	if (opt_pool_standby > 0 && num_pools > 1) {
+		thr = &thr_info[opt_n_threads + 5];
+		thr->id = opt_n_threads + 5;
+		if (!pool_standby_start(thr))
+			return EXIT_CODE_SW_INIT_ERROR;
+	}
+
+	/* local stratum endpoint */
+	if (opt_stratum_proxy) {
+		thr = &thr_info[opt_n_threads + 6];
+		thr->id = opt_n_threads + 6;
+		if (!proxy_start(thr))
+			return EXIT_CODE_SW_INIT_ERROR;
+	}
+
+	if (opt_stratum_record && !stratum_record_open())
+		return EXIT_CODE_SW_INIT_ERROR;
+
+	/* recorded pool session server */
+	if (opt_stratum_replay) {
+		thr = &thr_info[opt_n_threads + 7];
+		thr->id = opt_n_threads + 7;
+		if (!stratum_replay_start(thr))
+			return EXIT_CODE_SW_INIT_ERROR;
+	}
+
+	/* solo block templates */
+	if (opt_coinbase_addr || opt_coinbase_script) {
+		if (!gbt_solo_init())
+			return EXIT_CODE_SW_INIT_ERROR;
+		thr = &thr_info[opt_n_threads + 8];
+		thr->id = opt_n_threads + 8;
+		if (!gbt_solo_start(thr))
+			return EXIT_CODE_SW_INIT_ERROR;
+	}
+
 #ifdef __linux__
 	if (need_nvsettings) {
 		if (nvs_init() < 0)
@@ -488,12 +488,14 @@ extern bool submit_old;
 bool rpc2_stratum_job(struct stratum_ctx *sctx, json_t *id, json_t *params)
 {
 	bool ret = false;
+	g_work_write_lock();
 	pthread_mutex_lock(&rpc2_work_lock);
 	ret = rpc2_job_decode(params, &rpc2_work);
 	// update miner threads work
 	ret = ret && rpc2_stratum_gen_work(sctx, &g_work);
 	restart_threads();
 	pthread_mutex_unlock(&rpc2_work_lock);
+	g_work_write_unlock();
 	return ret;
 }
 
@@ -530,6 +532,7 @@ bool rpc2_stratum_submit(struct pool_infos *pool, struct work *work)
 	uint8_t _ALIGN(64) data[88];
 	char *noncestr, *hashhex;
 	int idnonce = work->submit_nonce_id;
+	uint32_t share_id;
 
 	memcpy(&data[0], work->data, 88);
 
@@ -568,24 +571,21 @@ bool rpc2_stratum_submit(struct pool_infos *pool, struct work *work)
 	if (hash[31] != 0)
 		return false; // prevent bad hashes
 	hashhex = bin2hex((unsigned char*)hash, 32);
+	share_id = share_inflight_add(work->pooln, work->job_id, work->nonces[idnonce], work->sharediff[idnonce]);
 
 	snprintf(s, sizeof(s), "{\"method\":\"submit\",\"params\":"
 		"{\"id\":\"%s\",\"job_id\":\"%s\",\"nonce\":\"%s\",\"result\":\"%s\"}, \"id\":%u}",
-		rpc2_id, work->job_id, noncestr, hashhex, stratum.job.shares_count + 10);
+		rpc2_id, work->job_id, noncestr, hashhex, share_id);
 
 	free(hashhex);
 	free(noncestr);
 
-	gettimeofday(&stratum.tv_submit, NULL);
-
 	if(!stratum_send_line(&stratum, s)) {
 		applog(LOG_ERR, "%s stratum_send_line failed", __func__);
+		share_inflight_done(share_id, NULL);
 		return false;
 	}
 
-	//stratum.sharediff = target_to_diff_rpc2((uint32_t*)hash);
-	stratum.sharediff = work->sharediff[idnonce];
-
 	return true;
 }
 
@@ -1104,7 +1104,6 @@ static bool rpc2_stratum_getscratchpad(struct stratum_ctx *sctx)
 	applog(LOG_DEBUG, "Getting full scratchpad received line");
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode rpc2_getscratchpad response failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1152,11 +1151,9 @@ bool rpc2_stratum_authorize(struct stratum_ctx *sctx, const char *user, const ch
 			goto out;
 		if (!stratum_handle_method(sctx, sret))
 			break;
-		free(sret);
 	}
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1236,7 +1233,6 @@ bool rpc2_stratum_request_job(struct stratum_ctx *sctx)
 	}
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON getwork decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1304,10 +1300,12 @@ int rpc2_stratum_thread_stuff(struct pool_infos* pool)
 	}
 
 	if (rpc2_work.job_id && (!g_work_time || strcmp(rpc2_work.job_id, g_work.job_id))) {
+		g_work_write_lock();
 		pthread_mutex_lock(&rpc2_work_lock);
 		rpc2_stratum_gen_work(&stratum, &g_work);
 		g_work_time = time(NULL);
 		pthread_mutex_unlock(&rpc2_work_lock);
+		g_work_write_unlock();
 
 		if (opt_debug) applog(LOG_DEBUG, "Stratum detected new block");
 		restart_threads();
@@ -116,9 +116,10 @@ bool equi_stratum_set_target(struct stratum_ctx *sctx, json_t *params)
 bool equi_stratum_notify(struct stratum_ctx *sctx, json_t *params)
 {
 	const char *job_id, *version, *prevhash, *coinb1, *coinb2, *nbits, *stime;
-	size_t coinb1_size, coinb2_size;
+	struct stratum_job_buf *jb;
+	size_t coinb1_size, coinb2_size, coinbase_size;
 	bool clean, ret = false;
-	int ntime, i, p=0;
+	int ntime, p=0;
 	job_id = json_string_value(json_array_get(params, p++));
 	version = json_string_value(json_array_get(params, p++));
 	prevhash = json_string_value(json_array_get(params, p++));
@@ -145,32 +146,25 @@ bool equi_stratum_notify(struct stratum_ctx *sctx, json_t *params)
 			applog(LOG_DEBUG, "stratum time is at least %ds in the future", ntime);
 	}
 
-	pthread_mutex_lock(&stratum_work_lock);
-	hex2bin(sctx->job.version, version, 4);
-	hex2bin(sctx->job.prevhash, prevhash, 32);
-
 	coinb1_size = strlen(coinb1) / 2;
 	coinb2_size = strlen(coinb2) / 2;
-	sctx->job.coinbase_size = coinb1_size + coinb2_size + // merkle + reserved
+	coinbase_size = coinb1_size + coinb2_size + // merkle + reserved
 		sctx->xnonce1_size + sctx->xnonce2_size; // extranonce and...
 
-	sctx->job.coinbase = (uchar*) realloc(sctx->job.coinbase, sctx->job.coinbase_size);
-	hex2bin(sctx->job.coinbase, coinb1, coinb1_size);
-	hex2bin(sctx->job.coinbase + coinb1_size, coinb2, coinb2_size);
-
-	sctx->job.xnonce2 = sctx->job.coinbase + coinb1_size + coinb2_size + sctx->xnonce1_size;
-	if (!sctx->job.job_id || strcmp(sctx->job.job_id, job_id))
-		memset(sctx->job.xnonce2, 0, sctx->xnonce2_size);
-	memcpy(sctx->job.coinbase + coinb1_size + coinb2_size, sctx->xnonce1, sctx->xnonce1_size);
+	jb = stratum_job_reserve(sctx, strlen(job_id), coinbase_size, 0);
+	if (!jb)
+		goto out;
+	strcpy(jb->job_id, job_id);
+	hex2bin(jb->coinbase, coinb1, coinb1_size);
+	hex2bin(jb->coinbase + coinb1_size, coinb2, coinb2_size);
 
-	for (i = 0; i < sctx->job.merkle_count; i++)
-		free(sctx->job.merkle[i]);
-	free(sctx->job.merkle);
-	sctx->job.merkle = NULL;
-	sctx->job.merkle_count = 0;
+	pthread_mutex_lock(&stratum_work_lock);
+	memcpy(jb->coinbase + coinb1_size + coinb2_size, sctx->xnonce1, sctx->xnonce1_size);
+	stratum_job_publish(sctx, jb, coinbase_size,
+		coinb1_size + coinb2_size + sctx->xnonce1_size, 0);
 
-	free(sctx->job.job_id);
-	sctx->job.job_id = strdup(job_id);
+	hex2bin(sctx->job.version, version, 4);
+	hex2bin(sctx->job.prevhash, prevhash, 32);
 
 	hex2bin(sctx->job.nbits, nbits, 4);
 	hex2bin(sctx->job.ntime, stime, 4);
@@ -179,6 +173,9 @@ bool equi_stratum_notify(struct stratum_ctx *sctx, json_t *params)
 	sctx->job.diff = sctx->next_diff;
 	pthread_mutex_unlock(&stratum_work_lock);
 
+	pool_latency_notify(sctx->pooln, sctx->job.prevhash, !sctx->notified);
+	sctx->notified = true;
+
 	ret = true;
 
 out:
@@ -235,6 +232,7 @@ bool equi_stratum_submit(struct pool_infos *pool, struct work *work)
 	char _ALIGN(64) timehex[16] = { 0 };
 	char *jobid, *noncestr, *solhex;
 	int idnonce = work->submit_nonce_id;
+	uint32_t share_id;
 
 	// scanned nonce
 	work->data[EQNONCE_OFFSET] = work->nonces[idnonce];
@@ -252,23 +250,21 @@ bool equi_stratum_submit(struct pool_infos *pool, struct work *work)
 
 	jobid = work->job_id + 8;
 	sprintf(timehex, "%08x", swab32(work->data[25]));
+	share_id = share_inflight_add(work->pooln, work->job_id, work->nonces[idnonce], work->sharediff[idnonce]);
 
 	snprintf(s, sizeof(s), "{\"method\":\"mining.submit\",\"params\":"
 		"[\"%s\",\"%s\",\"%s\",\"%s\",\"%s\"], \"id\":%u}",
-		pool->user, jobid, timehex, noncestr, solhex,
-		stratum.job.shares_count + 10);
+		pool->user, jobid, timehex, noncestr, solhex, share_id);
 
 	free(solhex);
 	free(noncestr);
 
-	gettimeofday(&stratum.tv_submit, NULL);
-
 	if(!stratum_send_line(&stratum, s)) {
 		applog(LOG_ERR, "%s stratum_send_line failed", __func__);
+		share_inflight_done(share_id, NULL);
 		return false;
 	}
 
-	stratum.sharediff = work->sharediff[idnonce];
 	stratum.job.shares_count++;
 
 	return true;
@@ -0,0 +1,516 @@
+/**
+ * Solo mining with getblocktemplate (--coinbase-addr or --coinbase-script)
+ *
+ * A thread keeps the block template of the daemon (longpoll when the
+ * daemon supports it) with the merkle branch of its coinbase. The works
+ * are then built locally, without rpc: coinbase paying the configured
+ * script with the next extranonce, merkle root from the branch, header.
+ * A solved work is sent as a full block with submitblock.
+ */
+#include <stdlib.h>
+#include <memory.h>
+
+#include "miner.h"
+#include "algos.h"
+
+#ifndef WIN32
+# include <unistd.h>
+#endif
+
+#define GBT_POLL_TIME 5 /* seconds, when the daemon has no longpoll */
+#define GBT_RETRY_PAUSE 30
+#define GBT_MAX_BRANCH 32
+#define GBT_COINBASE_TAG "/ccminer/"
+
+extern volatile time_t g_work_time;
+
+char *opt_coinbase_addr = NULL;
+char *opt_coinbase_script = NULL;
+
+struct gbt_template {
+	uint32_t id; // in the work job_id
+	int pooln;
+	json_t *txs;
+	uint32_t height;
+	uint32_t version;
+	uint32_t curtime;
+	uint32_t bits;
+	uchar prevhash[32]; // header byte order
+	uint32_t target[8];
+	uint64_t value;
+	uchar commitment[64]; // witness commitment output script
+	int commitment_len;
+	uchar branch[GBT_MAX_BRANCH][32];
+	int branch_count;
+};
+
+// the current template, and the previous one for the blocks found meanwhile
+static struct gbt_template tpl[2];
+static int tpl_cur = 0;
+static uint32_t tpl_count = 0;
+static uint64_t gbt_extranonce = 0;
+static char gbt_longpollid[256] = { 0 };
+
+static uchar payout_script[128];
+static int payout_len = 0;
+
+static pthread_mutex_t gbt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gbt_cond = PTHREAD_COND_INITIALIZER;
+
+static bool gbt_algo_allowed()
+{
+	switch (opt_algo) {
+		case ALGO_DECRED:
+		case ALGO_EQUIHASH:
+		case ALGO_SIA:
+		case ALGO_LBRY:
+		case ALGO_HEAVY:
+		case ALGO_MJOLLNIR:
+		case ALGO_ZR5:
+		case ALGO_WILDKECCAK:
+		case ALGO_CRYPTOLIGHT:
+		case ALGO_CRYPTONIGHT:
+			return false; // specific headers
+		case ALGO_FUGUE256:
+		case ALGO_GROESTL:
+		case ALGO_KECCAK:
+		case ALGO_BLAKECOIN:
+		case ALGO_WHIRLCOIN:
+			return false; // txid is not a sha256d
+	}
+	return true;
+}
+
+bool gbt_solo_init()
+{
+	if (!gbt_algo_allowed()) {
+		applog(LOG_ERR, "Solo mining with getblocktemplate is not supported for %s",
+			algo_names[opt_algo]);
+		return false;
+	}
+	if (opt_coinbase_script) {
+		size_t len = strlen(opt_coinbase_script) / 2;
+		if (!len || len > sizeof(payout_script) || !hex2bin(payout_script, opt_coinbase_script, len)) {
+			applog(LOG_ERR, "Invalid coinbase script %s", opt_coinbase_script);
+			return false;
+		}
+		payout_len = (int) len;
+	}
+	return true;
+}
+
+static int put_varint(uchar *p, uint64_t n)
+{
+	if (n < 0xfd) {
+		p[0] = (uchar) n;
+		return 1;
+	}
+	if (n <= 0xffff) {
+		p[0] = 0xfd;
+		le16enc(p + 1, (uint16_t) n);
+		return 3;
+	}
+	p[0] = 0xfe;
+	le32enc(p + 1, (uint32_t) n);
+	return 5;
+}
+
+// bip 34 height, a minimal script number push
+static int put_height(uchar *p, uint32_t height)
+{
+	int n = 0;
+	if (height <= 16) {
+		p[0] = height ? (uchar) (0x50 + height) : 0; // OP_n
+		return 1;
+	}
+	while (height) {
+		p[1 + n++] = (uchar) height;
+		height >>= 8;
+	}
+	if (p[n] & 0x80)
+		p[1 + n++] = 0;
+	p[0] = (uchar) n;
+	return n + 1;
+}
+
+/* serialized coinbase, with the bip 141 witness (reserved value) or not */
+static int gbt_coinbase(const struct gbt_template *t, const uchar *xnonce, uchar *cb, bool witness)
+{
+	uchar sig[100];
+	int n = 0, sl = 0;
+
+	sl += put_height(sig, t->height);
+	sig[sl++] = 8;
+	memcpy(sig + sl, xnonce, 8);
+	sl += 8;
+	sig[sl++] = (uchar) strlen(GBT_COINBASE_TAG);
+	memcpy(sig + sl, GBT_COINBASE_TAG, strlen(GBT_COINBASE_TAG));
+	sl += (int) strlen(GBT_COINBASE_TAG);
+
+	le32enc(cb, 1); n += 4; // version
+	if (witness) {
+		cb[n++] = 0; // marker
+		cb[n++] = 1; // flag
+	}
+	cb[n++] = 1; // input, no prevout
+	memset(cb + n, 0, 32); n += 32;
+	le32enc(cb + n, 0xffffffff); n += 4;
+	n += put_varint(cb + n, sl);
+	memcpy(cb + n, sig, sl); n += sl;
+	le32enc(cb + n, 0xffffffff); n += 4; // sequence
+
+	cb[n++] = t->commitment_len ? 2 : 1;
+	le32enc(cb + n, (uint32_t) t->value);
+	le32enc(cb + n + 4, (uint32_t) (t->value >> 32));
+	n += 8;
+	n += put_varint(cb + n, payout_len);
+	memcpy(cb + n, payout_script, payout_len); n += payout_len;
+	if (t->commitment_len) {
+		memset(cb + n, 0, 8); n += 8;
+		n += put_varint(cb + n, t->commitment_len);
+		memcpy(cb + n, t->commitment, t->commitment_len); n += t->commitment_len;
+	}
+
+	if (witness) {
+		cb[n++] = 1; // stack items
+		cb[n++] = 32;
+		memset(cb + n, 0, 32); n += 32;
+	}
+	le32enc(cb + n, 0); n += 4; // locktime
+	return n;
+}
+
+/* merkle branch of the coinbase (index 0), from the template txids */
+static bool gbt_merkle_branch(struct gbt_template *t)
+{
+	size_t count = json_array_size(t->txs) + 1;
+	uchar (*level)[32] = (uchar (*)[32]) malloc((count + 1) * 32);
+	size_t i;
+
+	if (!level)
+		return false;
+	for (i = 1; i < count; i++) {
+		json_t *tx = json_array_get(t->txs, i - 1);
+		json_t *txid = json_object_get(tx, "txid");
+		const char *hex = json_string_value(txid ? txid : json_object_get(tx, "hash"));
+		if (!hex || strlen(hex) != 64 || !hex2bin(level[i], hex, 32)) {
+			free(level);
+			return false;
+		}
+		for (int k = 0; k < 16; k++) { // displayed reversed
+			uchar c = level[i][k];
+			level[i][k] = level[i][31 - k];
+			level[i][31 - k] = c;
+		}
+	}
+
+	// the coinbase (level[0]) is unknown, only its siblings are kept
+	t->branch_count = 0;
+	while (count > 1 && t->branch_count < GBT_MAX_BRANCH) {
+		memcpy(t->branch[t->branch_count++], level[1], 32);
+		if (count & 1) {
+			memcpy(level[count], level[count - 1], 32);
+			count++;
+		}
+		for (i = 2; i < count; i += 2)
+			sha256d(level[i / 2], level[i], 64);
+		count /= 2;
+	}
+	free(level);
+	return count == 1;
+}
+
+static bool gbt_template_decode(const json_t *res, struct gbt_template *t)
+{
+	const char *prevhash = json_string_value(json_object_get(res, "previousblockhash"));
+	const char *bits = json_string_value(json_object_get(res, "bits"));
+	const char *target = json_string_value(json_object_get(res, "target"));
+	const char *commitment = json_string_value(json_object_get(res, "default_witness_commitment"));
+	json_t *txs = json_object_get(res, "transactions");
+	uchar bin[32];
+	int i;
+
+	if (!prevhash || !bits || !target || !json_is_array(txs) || strlen(prevhash) != 64 ||
+	    strlen(target) != 64 || !json_is_integer(json_object_get(res, "coinbasevalue"))) {
+		applog(LOG_ERR, "GBT: invalid block template");
+		return false;
+	}
+
+	t->height = (uint32_t) json_integer_value(json_object_get(res, "height"));
+	t->version = (uint32_t) json_integer_value(json_object_get(res, "version"));
+	t->curtime = (uint32_t) json_integer_value(json_object_get(res, "curtime"));
+	t->bits = (uint32_t) strtoul(bits, NULL, 16);
+	t->value = (uint64_t) json_integer_value(json_object_get(res, "coinbasevalue"));
+	hex2bin(bin, prevhash, 32);
+	for (i = 0; i < 32; i++)
+		t->prevhash[i] = bin[31 - i];
+	hex2bin(bin, target, 32);
+	for (i = 0; i < 8; i++)
+		t->target[7 - i] = be32dec(bin + 4 * i);
+	t->commitment_len = 0;
+	if (commitment) {
+		size_t len = strlen(commitment) / 2;
+		if (len > sizeof(t->commitment) || !hex2bin(t->commitment, commitment, len)) {
+			applog(LOG_ERR, "GBT: invalid witness commitment");
+			return false;
+		}
+		t->commitment_len = (int) len;
+	}
+
+	json_decref(t->txs);
+	t->txs = json_incref(txs);
+	if (!gbt_merkle_branch(t)) {
+		applog(LOG_ERR, "GBT: invalid transactions");
+		return false;
+	}
+	return true;
+}
+
+/* payout script of the address, given by the daemon */
+static bool gbt_payout_script(CURL *curl, struct pool_infos *pool)
+{
+	char req[256];
+	const char *script;
+	json_t *val;
+	size_t len;
+
+	snprintf(req, sizeof(req), "{\"method\": \"validateaddress\", \"params\": [\"%s\"], \"id\":12}\r\n",
+		opt_coinbase_addr);
+	val = json_rpc_call_pool(curl, pool, req, false, false, NULL);
+	if (!val)
+		return false;
+	script = json_string_value(json_object_get(json_object_get(val, "result"), "scriptPubKey"));
+	len = script ? strlen(script) / 2 : 0;
+	if (!json_is_true(json_object_get(json_object_get(val, "result"), "isvalid")) ||
+	    !len || len > sizeof(payout_script) || !hex2bin(payout_script, script, len)) {
+		applog(LOG_ERR, "GBT: invalid coinbase address %s, use --coinbase-script", opt_coinbase_addr);
+		json_decref(val);
+		return false;
+	}
+	payout_len = (int) len;
+	json_decref(val);
+	return true;
+}
+
+static bool gbt_update(CURL *curl, struct pool_infos *pool, int pooln)
+{
+	char req[512];
+	struct gbt_template *t;
+	bool new_block;
+	json_t *val, *res;
+	const char *lpid;
+
+	if (gbt_longpollid[0]) {
+		snprintf(req, sizeof(req), "{\"method\": \"getblocktemplate\", \"params\": [{"
+			"\"rules\": [\"segwit\"], \"longpollid\": \"%s\"}], \"id\":9}\r\n", gbt_longpollid);
+		val = json_rpc_longpoll(curl, pool->url, pool, req, NULL);
+	} else {
+		snprintf(req, sizeof(req), "{\"method\": \"getblocktemplate\", \"params\": [{"
+			"\"rules\": [\"segwit\"]}], \"id\":9}\r\n");
+		val = json_rpc_call_pool(curl, pool, req, false, false, NULL);
+	}
+	gbt_longpollid[0] = '\0';
+	if (!val)
+		return false;
+
+	res = json_object_get(val, "result");
+	lpid = json_string_value(json_object_get(res, "longpollid"));
+
+	pthread_mutex_lock(&gbt_lock);
+	t = &tpl[tpl_cur ^ 1];
+	if (!gbt_template_decode(res, t)) {
+		pthread_mutex_unlock(&gbt_lock);
+		json_decref(val);
+		return false;
+	}
+	t->id = ++tpl_count;
+	t->pooln = pooln;
+	new_block = tpl_count == 1 || memcmp(t->prevhash, tpl[tpl_cur].prevhash, 32) ||
+		tpl[tpl_cur].pooln != pooln;
+	tpl_cur ^= 1;
+	if (lpid && strlen(lpid) < sizeof(gbt_longpollid))
+		strcpy(gbt_longpollid, lpid);
+	pthread_cond_broadcast(&gbt_cond);
+	pthread_mutex_unlock(&gbt_lock);
+
+	if (new_block) {
+		// the current works are on the previous block
+		g_work_time = 0;
+		restart_threads();
+		if (!opt_quiet)
+			applog(LOG_BLUE, "%s block %u, %u txs", algo_names[opt_algo], t->height,
+				(uint32_t) json_array_size(t->txs));
+	}
+	json_decref(val);
+	return true;
+}
+
+static void *gbt_thread(void *userdata)
+{
+	CURL *curl = curl_conn_get();
+	if (unlikely(!curl)) {
+		applog(LOG_ERR, "%s() CURL init failed", __func__);
+		return NULL;
+	}
+
+	while (!abort_flag) {
+		int pooln = cur_pooln;
+		struct pool_infos *pool = &pools[pooln];
+
+		if (pool->type & POOL_STRATUM) {
+			sleep(1);
+			continue;
+		}
+		if (!payout_len && !gbt_payout_script(curl, pool)) {
+			sleep(GBT_RETRY_PAUSE);
+			continue;
+		}
+		if (!gbt_update(curl, pool, pooln)) {
+			applog(LOG_ERR, "GBT: getblocktemplate failed, retry after %d seconds", GBT_RETRY_PAUSE);
+			sleep(GBT_RETRY_PAUSE);
+			continue;
+		}
+		if (!gbt_longpollid[0])
+			sleep(GBT_POLL_TIME);
+	}
+
+	curl_conn_put(curl);
+	return NULL;
+}
+
+bool gbt_solo_start(struct thr_info *thr)
+{
+	if (unlikely(pthread_create(&thr->pth, NULL, gbt_thread, thr))) {
+		applog(LOG_ERR, "gbt thread create failed");
+		return false;
+	}
+	return true;
+}
+
+/* a new work from the current template, waits for the first one */
+bool gbt_solo_work(struct work *work)
+{
+	struct gbt_template *t;
+	uchar cb[512], hash[64], header[80], xnonce[8];
+	int cb_size, i;
+
+	pthread_mutex_lock(&gbt_lock);
+	t = &tpl[tpl_cur];
+	if (!tpl_count || t->pooln != work->pooln) {
+		struct timespec ts;
+		ts.tv_sec = time(NULL) + opt_timeout;
+		ts.tv_nsec = 0;
+		pthread_cond_timedwait(&gbt_cond, &gbt_lock, &ts);
+		t = &tpl[tpl_cur];
+		if (!tpl_count || t->pooln != work->pooln) {
+			pthread_mutex_unlock(&gbt_lock);
+			return false;
+		}
+	}
+
+	gbt_extranonce++;
+	for (i = 0; i < 8; i++)
+		xnonce[i] = (uchar) (gbt_extranonce >> (8 * i));
+	cb_size = gbt_coinbase(t, xnonce, cb, false);
+	sha256d(hash, cb, cb_size);
+	for (i = 0; i < t->branch_count; i++) {
+		memcpy(hash + 32, t->branch[i], 32);
+		sha256d(hash, hash, 64);
+	}
+
+	le32enc(header, t->version);
+	memcpy(header + 4, t->prevhash, 32);
+	memcpy(header + 36, hash, 32);
+	le32enc(header + 68, t->curtime);
+	le32enc(header + 72, t->bits);
+	le32enc(header + 76, 0);
+
+	memset(work->data, 0, sizeof(work->data));
+	for (i = 0; i < 20; i++)
+		work->data[i] = be32dec(header + 4 * i);
+	work->data[20] = 0x80000000;
+	work->data[31] = 0x00000280;
+	memcpy(work->target, t->target, sizeof(work->target));
+	work->targetdiff = target_to_diff(work->target);
+	work->height = t->height;
+	work->xnonce2_len = 8;
+	memcpy(work->xnonce2, xnonce, 8);
+	snprintf(work->job_id, sizeof(work->job_id), "%08x", t->id);
+	pthread_mutex_unlock(&gbt_lock);
+	return true;
+}
+
+/**
+ * Build the block of a solved work and send it with submitblock
+ * returns 1 if accepted, 0 if rejected (reason), -1 if the template is
+ * outdated and -2 on rpc errors
+ */
+int gbt_solo_submit(CURL *curl, struct pool_infos *pool, const struct work *work, char *reason, size_t len)
+{
+	struct gbt_template *t = NULL;
+	uchar cb[512], header[80], buf[16];
+	size_t size, pos, n, i;
+	char *req;
+	json_t *val, *res;
+	int cb_size, ret;
+
+	pthread_mutex_lock(&gbt_lock);
+	for (i = 0; i < 2; i++) {
+		char id[16];
+		snprintf(id, sizeof(id), "%08x", tpl[i].id);
+		if (tpl[i].txs && !strcmp(work->job_id, id) &&
+		    !memcmp(tpl[i].prevhash, tpl[tpl_cur].prevhash, 32))
+			t = &tpl[i];
+	}
+	if (!t) {
+		pthread_mutex_unlock(&gbt_lock);
+		return -1;
+	}
+
+	for (i = 0; i < 20; i++)
+		be32enc(header + 4 * i, work->data[i]);
+	cb_size = gbt_coinbase(t, work->xnonce2, cb, t->commitment_len > 0);
+
+	n = json_array_size(t->txs);
+	size = 2 * (80 + 9 + cb_size) + 128;
+	for (i = 0; i < n; i++) {
+		const char *data = json_string_value(json_object_get(json_array_get(t->txs, i), "data"));
+		size += data ? strlen(data) : 0;
+	}
+	req = (char*) malloc(size);
+	if (!req) {
+		pthread_mutex_unlock(&gbt_lock);
+		return -2;
+	}
+
+	pos = sprintf(req, "{\"method\": \"submitblock\", \"params\": [\"");
+	cbin2hex(req + pos, (const char*) header, 80);
+	pos += 160;
+	n = put_varint(buf, n + 1);
+	cbin2hex(req + pos, (const char*) buf, n);
+	pos += 2 * n;
+	cbin2hex(req + pos, (const char*) cb, cb_size);
+	pos += 2 * cb_size;
+	for (i = 0; i < json_array_size(t->txs); i++) {
+		const char *data = json_string_value(json_object_get(json_array_get(t->txs, i), "data"));
+		if (data) {
+			strcpy(req + pos, data);
+			pos += strlen(data);
+		}
+	}
+	sprintf(req + pos, "\"], \"id\":11}\r\n");
+	pthread_mutex_unlock(&gbt_lock);
+
+	val = json_rpc_call_pool_null(curl, pool, req, NULL);
+	free(req);
+	if (!val)
+		return -2;
+
+	// null if accepted, else the reason ("duplicate": already accepted, on a retry)
+	res = json_object_get(val, "result");
+	ret = (json_is_null(res) || (json_is_string(res) && !strcmp(json_string_value(res), "duplicate"))) ? 1 : 0;
+	if (!ret)
+		snprintf(reason, len, "%s", json_is_string(res) ? json_string_value(res) : "rejected");
+	json_decref(val);
+	return ret;
+}
@@ -33,6 +33,7 @@ void free_heavy(int thr_id) {}
 
 #include "miner.h"
 #include "cuda_helper.h"
+#include "hefty1.h"
 
 // nonce array also used in other algos
 uint32_t *heavy_nonceVector[MAX_GPUS];
@@ -270,20 +271,34 @@ int scanhash_heavy(int thr_id, struct work *work, uint32_t max_nonce, unsigned l
 			size_t size = sizeof(uint32_t) * actualNumberOfValuesInNonceVectorGPU;
 			cudaMemcpy(cpu_nonceVector, heavy_nonceVector[thr_id], size, cudaMemcpyDeviceToHost);
 
-			for (uint32_t i=0; i < actualNumberOfValuesInNonceVectorGPU; i++)
+			// validate the candidates on the cpu, HEFTY1_LANES at once
+			uint32_t _ALIGN(64) headers[HEFTY1_LANES][32];
+			uint32_t _ALIGN(64) vhash[HEFTY1_LANES][8];
+			uint32_t found[HEFTY1_LANES];
+			uint32_t i = 0;
+			while (i < actualNumberOfValuesInNonceVectorGPU)
 			{
-				uint32_t nonce = cpu_nonceVector[i];
-				uint32_t *foundhash = &hash[8*i];
-				if (foundhash[7] <= ptarget[7] && fulltest(foundhash, ptarget)) {
-					uint32_t vhash[8];
-					pdata[19] += nonce - pdata[19];
-					heavycoin_hash((uchar*)vhash, (uchar*)pdata, blocklen);
-					if (memcmp(vhash, foundhash, 32)) {
+				int n = 0;
+				for (; i < actualNumberOfValuesInNonceVectorGPU && n < HEFTY1_LANES; i++) {
+					uint32_t *foundhash = &hash[8*i];
+					if (foundhash[7] <= ptarget[7] && fulltest(foundhash, ptarget)) {
+						memcpy(headers[n], pdata, blocklen);
+						headers[n][19] = cpu_nonceVector[i];
+						found[n++] = i;
+					}
+				}
+				if (n == 0)
+					break;
+				heavycoin_hash_batch((uchar*)vhash, (uchar*)headers, sizeof(headers[0]), blocklen, n);
+				for (int k = 0; k < n; k++) {
+					uint32_t nonce = cpu_nonceVector[found[k]];
+					if (memcmp(vhash[k], &hash[8*found[k]], 32)) {
 						gpu_increment_reject(thr_id);
 						if (!opt_quiet)
 							gpulog(LOG_WARNING, thr_id, "result for %08x does not validate on CPU!", nonce);
 					} else {
-						work_set_target_ratio(work, vhash);
+						pdata[19] = nonce;
+						work_set_target_ratio(work, vhash[k]);
 						rc = 1;
 						goto exit;
 					}
@@ -367,11 +382,14 @@ static void combine_hashes(uint32_t *out, const uint32_t *hash1, const uint32_t
 	}
 }
 
-// CPU hash function
+/* Hash(x) = SHA256(x + HEFTY1(x)) combined with KECCAK512, GROESTL512
+ * and BLAKE512 of the same x + HEFTY1(x). The engine contexts are only
+ * copied from the initialized ones given by the caller. */
 __host__
-void heavycoin_hash(uchar* output, const uchar* input, int len)
+static void heavycoin_hash_tail(uchar* output, const uchar* input, int len, const unsigned char *hash1,
+	const sph_keccak512_context *keccakInit, const sph_groestl512_context *groestlInit,
+	const sph_blake512_context *blakeInit)
 {
-	unsigned char hash1[32];
 	unsigned char hash2[32];
 	uint32_t hash3[16];
 	uint32_t hash4[16];
@@ -382,8 +400,6 @@ void heavycoin_hash(uchar* output, const uchar* input, int len)
 	sph_groestl512_context groestlCtx;
 	sph_blake512_context blakeCtx;
 
-	HEFTY1(input, len, hash1);
-
 	/* HEFTY1 is new, so take an extra security measure to eliminate
 	 * the possiblity of collisions:
 	 *
@@ -393,7 +409,7 @@ void heavycoin_hash(uchar* output, const uchar* input, int len)
 	 */
 	SHA256_Init(&ctx);
 	SHA256_Update(&ctx, input, len);
-	SHA256_Update(&ctx, hash1, sizeof(hash1));
+	SHA256_Update(&ctx, hash1, 32);
 	SHA256_Final(hash2, &ctx);
 
 	/* Additional security: Do not rely on a single cryptographic hash
@@ -402,21 +418,61 @@ void heavycoin_hash(uchar* output, const uchar* input, int len)
 	 * and BLAKE512.
 	 */
 
-	sph_keccak512_init(&keccakCtx);
+	memcpy(&keccakCtx, keccakInit, sizeof(keccakCtx));
 	sph_keccak512(&keccakCtx, input, len);
-	sph_keccak512(&keccakCtx, hash1, sizeof(hash1));
+	sph_keccak512(&keccakCtx, hash1, 32);
 	sph_keccak512_close(&keccakCtx, (void *)&hash3);
 
-	sph_groestl512_init(&groestlCtx);
+	memcpy(&groestlCtx, groestlInit, sizeof(groestlCtx));
 	sph_groestl512(&groestlCtx, input, len);
-	sph_groestl512(&groestlCtx, hash1, sizeof(hash1));
+	sph_groestl512(&groestlCtx, hash1, 32);
 	sph_groestl512_close(&groestlCtx, (void *)&hash4);
 
-	sph_blake512_init(&blakeCtx);
+	memcpy(&blakeCtx, blakeInit, sizeof(blakeCtx));
 	sph_blake512(&blakeCtx, input, len);
-	sph_blake512(&blakeCtx, (unsigned char *)&hash1, sizeof(hash1));
+	sph_blake512(&blakeCtx, hash1, 32);
 	sph_blake512_close(&blakeCtx, (void *)&hash5);
 
 	final = (uint32_t *)output;
 	combine_hashes(final, (uint32_t *)hash2, hash3, hash4, hash5);
 }
+
+// CPU hash function
+__host__
+void heavycoin_hash(uchar* output, const uchar* input, int len)
+{
+	unsigned char hash1[32];
+	sph_keccak512_context keccakCtx;
+	sph_groestl512_context groestlCtx;
+	sph_blake512_context blakeCtx;
+
+	HEFTY1(input, len, hash1);
+
+	sph_keccak512_init(&keccakCtx);
+	sph_groestl512_init(&groestlCtx);
+	sph_blake512_init(&blakeCtx);
+	heavycoin_hash_tail(output, input, len, hash1, &keccakCtx, &groestlCtx, &blakeCtx);
+}
+
+// CPU hash of count messages of len bytes, stride bytes apart, to consecutive 32-byte outputs
+__host__
+void heavycoin_hash_batch(uchar* output, const uchar* input, size_t stride, int len, int count)
+{
+	unsigned char hash1[HEFTY1_LANES * 32];
+	sph_keccak512_context keccakCtx;
+	sph_groestl512_context groestlCtx;
+	sph_blake512_context blakeCtx;
+
+	sph_keccak512_init(&keccakCtx);
+	sph_groestl512_init(&groestlCtx);
+	sph_blake512_init(&blakeCtx);
+
+	for (int i = 0; i < count; i += HEFTY1_LANES) {
+		const int n = min(count - i, HEFTY1_LANES);
+		HEFTY1_Lanes(input + stride * i, stride, (size_t) len, n, hash1);
+		for (int k = 0; k < n; k++) {
+			heavycoin_hash_tail(output + 32 * (i + k), input + stride * (i + k), len, &hash1[32 * k],
+				&keccakCtx, &groestlCtx, &blakeCtx);
+		}
+	}
+}
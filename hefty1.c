@@ -34,6 +34,10 @@
 
 #include "hefty1.h"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #ifdef WIN32
 #define inline __inline
 #endif
@@ -369,3 +373,239 @@ unsigned char* HEFTY1(const unsigned char *buf, size_t len, unsigned char *diges
 
     return digest;
 }
+
+/* Multi-lane interface
+ *
+ * HEFTY1 can't be parallelised within one message, but independent
+ * messages of the same length run the exact same sequence of sponge
+ * operations, so with AVX2 each 32-bit lane of a ymm register hashes its
+ * own message. The data-dependent switches of Mangle and Br compute every
+ * case and keep the one selected by each lane, which also removes the
+ * unpredictable branches of the scalar code.
+ */
+
+#ifdef __AVX2__
+
+/* Padded block at offset off of a len-byte message (FIPS 180 padding) */
+static void LaneBlock(uint8_t *block, const unsigned char *msg, size_t len, size_t off)
+{
+    size_t total = ((len + 8) / HEFTY1_BLOCK_BYTES + 1) * HEFTY1_BLOCK_BYTES;
+    size_t n = off < len ? Min(len - off, HEFTY1_BLOCK_BYTES) : 0;
+    int i;
+
+    if (n)
+        memcpy(block, msg + off, n);
+    memset(block + n, 0, HEFTY1_BLOCK_BYTES - n);
+    if (len >= off && len - off < HEFTY1_BLOCK_BYTES)
+        block[len - off] = 0x80;
+    if (off + HEFTY1_BLOCK_BYTES == total) {
+        for (i = 0; i < 8; i++)
+            block[HEFTY1_BLOCK_BYTES - 8 + i] = (uint8_t)(((uint64_t)len * 8) >> (56 - 8 * i));
+    }
+}
+
+#define VAND(a, b)  _mm256_and_si256(a, b)
+#define VOR(a, b)   _mm256_or_si256(a, b)
+#define VXOR(a, b)  _mm256_xor_si256(a, b)
+#define VADD(a, b)  _mm256_add_epi32(a, b)
+#define VNOT(a)     _mm256_xor_si256(a, _mm256_set1_epi32(-1))
+#define VSET(x)     _mm256_set1_epi32((int)(x))
+
+static inline __m256i RrV(__m256i X, int n)
+{
+    return VOR(_mm256_srli_epi32(X, n), _mm256_slli_epi32(X, 32 - n));
+}
+
+/* Rotation by a per-lane amount, 0 <= n < 32 */
+static inline __m256i RrVar(__m256i X, __m256i n)
+{
+    return VOR(_mm256_srlv_epi32(X, n), _mm256_sllv_epi32(X, _mm256_sub_epi32(VSET(32), n)));
+}
+
+/* Pick v[c & 3] in each lane */
+static inline __m256i Sel4(__m256i c, __m256i v0, __m256i v1, __m256i v2, __m256i v3)
+{
+    __m256 b0 = _mm256_castsi256_ps(_mm256_slli_epi32(c, 31));
+    __m256 b1 = _mm256_castsi256_ps(_mm256_slli_epi32(c, 30));
+    __m256 lo = _mm256_blendv_ps(_mm256_castsi256_ps(v0), _mm256_castsi256_ps(v1), b0);
+    __m256 hi = _mm256_blendv_ps(_mm256_castsi256_ps(v2), _mm256_castsi256_ps(v3), b0);
+    return _mm256_castps_si256(_mm256_blendv_ps(lo, hi, b1));
+}
+
+/* Smoosh2 without the final mask, Sel4 only looks at the low 2 bits */
+static inline __m256i Smoosh2V(__m256i X)
+{
+    X = VXOR(X, _mm256_srli_epi32(X, 16));
+    X = VXOR(X, _mm256_srli_epi32(X, 8));
+    X = VXOR(X, _mm256_srli_epi32(X, 4));
+    return VXOR(X, _mm256_srli_epi32(X, 2));
+}
+
+static inline void MangleV(__m256i *S)
+{
+    /* Smoosh4 of each byte of S[0] */
+    __m256i t = VXOR(S[0], _mm256_srli_epi32(S[0], 4));
+    __m256i r0 = VAND(_mm256_srli_epi32(t, 24), VSET(0xf));
+    __m256i r1 = VAND(_mm256_srli_epi32(t, 16), VSET(0xf));
+    __m256i r2 = VAND(_mm256_srli_epi32(t, 8), VSET(0xf));
+    __m256i r3 = VAND(t, VSET(0xf));
+    __m256i n0 = VNOT(S[0]);
+
+    /* Diffuse */
+    S[1] = VXOR(S[1], RrVar(S[0], r0));
+    r0 = VADD(r0, VSET(1));
+    r1 = VADD(r1, VSET(1));
+    r2 = VADD(r2, VSET(1));
+    r3 = VADD(r3, VSET(1));
+    S[2] = Sel4(Smoosh2V(S[1]),
+        VXOR(S[2], RrVar(S[0], r0)), VADD(S[2], RrVar(n0, r1)),
+        VAND(S[2], RrVar(n0, r2)), VXOR(S[2], RrVar(S[0], r3)));
+    r0 = VADD(r0, VSET(1));
+    r1 = VADD(r1, VSET(1));
+    r2 = VADD(r2, VSET(1));
+    r3 = VADD(r3, VSET(1));
+    S[3] = Sel4(Smoosh2V(VXOR(S[1], S[2])),
+        VXOR(S[3], RrVar(S[0], r0)), VADD(S[3], RrVar(n0, r1)),
+        VAND(S[3], RrVar(n0, r2)), VXOR(S[3], RrVar(S[0], r3)));
+
+    /* Compress */
+    S[0] = VXOR(S[0], VADD(VXOR(S[1], S[2]), S[3]));
+}
+
+static inline void AbsorbV(__m256i *S, __m256i X)
+{
+    S[0] = VXOR(S[0], X);
+    MangleV(S);
+}
+
+static inline __m256i BrV(__m256i *S, __m256i X)
+{
+    __m256i R = S[0];
+    __m256i Y;
+
+    MangleV(S);
+    Y = _mm256_sllv_epi32(VSET(1), VAND(_mm256_srli_epi32(R, 8), VSET(31)));
+    return Sel4(R, X, _mm256_andnot_si256(Y, X), VOR(X, Y), VXOR(X, Y));
+}
+
+#define Sigma0V(A) VXOR(VXOR(RrV(A, 2), RrV(A, 13)), RrV(A, 22))
+#define Sigma1V(E) VXOR(VXOR(RrV(E, 6), RrV(E, 11)), RrV(E, 25))
+#define sigma0V(X) VXOR(VXOR(RrV(X, 7), RrV(X, 18)), _mm256_srli_epi32(X, 3))
+#define sigma1V(X) VXOR(VXOR(RrV(X, 17), RrV(X, 19)), _mm256_srli_epi32(X, 10))
+#define ChV(E, F, G) VXOR(VAND(E, F), _mm256_andnot_si256(E, G))
+#define MaV(A, B, C) VXOR(VXOR(VAND(A, B), VAND(A, C)), VAND(B, C))
+
+/* Same Br call order as RoundFunc, the macros below evaluate their
+ * arguments more than once so every Br result goes through a variable */
+#define RoundFuncV(S, A, B, C, D, E, F, G, H, W, K)                     \
+    {                                                                   \
+        __m256i brG = BrV(S, G);                                        \
+        __m256i brF = BrV(S, F);                                        \
+        __m256i tmp1 = VADD(VADD(ChV(E, brF, brG), H), VADD(W, VSET(K))); \
+        __m256i brE = BrV(S, E);                                        \
+        __m256i tmp2 = VADD(tmp1, Sigma1V(brE));                        \
+        __m256i brC = BrV(S, C);                                        \
+        __m256i brB = BrV(S, B);                                        \
+        __m256i brA = BrV(S, A);                                        \
+        __m256i tmp3 = MaV(brA, brB, brC);                              \
+        __m256i tmp4;                                                   \
+        brA = BrV(S, A);                                                \
+        tmp4 = VADD(tmp3, Sigma0V(brA));                                \
+        H = G;                                                          \
+        G = F;                                                          \
+        F = E;                                                          \
+        E = VADD(D, BrV(S, tmp2));                                      \
+        D = C;                                                          \
+        C = B;                                                          \
+        B = A;                                                          \
+        A = VADD(tmp2, tmp4);                                           \
+    }
+
+static void HashBlockV(__m256i *h, __m256i *S, const uint32_t M[16][8])
+{
+    __m256i A, B, C, D, E, F, G, H;
+    __m256i W[64];
+    int t;
+
+    A = h[0];
+    B = h[1];
+    C = h[2];
+    D = h[3];
+    E = h[4];
+    F = h[5];
+    G = h[6];
+    H = h[7];
+
+    for (t = 0; t < 16; t++) {
+        W[t] = _mm256_loadu_si256((const __m256i *)M[t]);
+        AbsorbV(S, VXOR(W[t], VSET(K[t])));
+    }
+
+    for (t = 0; t < 16; t++) {
+        AbsorbV(S, VXOR(D, H));
+        RoundFuncV(S, A, B, C, D, E, F, G, H, W[t], K[t]);
+    }
+    for (t = 16; t < 64; t++) {
+        AbsorbV(S, VADD(H, D));
+        W[t] = VADD(VADD(sigma1V(W[t - 2]), W[t - 7]), VADD(sigma0V(W[t - 15]), W[t - 16]));
+        RoundFuncV(S, A, B, C, D, E, F, G, H, W[t], K[t]);
+    }
+
+    h[0] = VADD(h[0], A);
+    h[1] = VADD(h[1], B);
+    h[2] = VADD(h[2], C);
+    h[3] = VADD(h[3], D);
+    h[4] = VADD(h[4], E);
+    h[5] = VADD(h[5], F);
+    h[6] = VADD(h[6], G);
+    h[7] = VADD(h[7], H);
+}
+
+void HEFTY1_Lanes(const unsigned char *data, size_t stride, size_t len, int count, unsigned char *digest)
+{
+    uint32_t M[16][HEFTY1_LANES];
+    uint32_t out[HEFTY1_STATE_WORDS][HEFTY1_LANES];
+    uint8_t block[HEFTY1_BLOCK_BYTES];
+    __m256i h[HEFTY1_STATE_WORDS];
+    __m256i S[HEFTY1_SPONGE_WORDS];
+    size_t off;
+    int i, l;
+
+    assert(count > 0 && count <= HEFTY1_LANES);
+
+    for (i = 0; i < HEFTY1_STATE_WORDS; i++)
+        h[i] = VSET(H[i]);
+    for (i = 0; i < HEFTY1_SPONGE_WORDS; i++)
+        S[i] = _mm256_setzero_si256();
+
+    for (off = 0; off < len + 9; off += HEFTY1_BLOCK_BYTES) {
+        for (l = 0; l < HEFTY1_LANES; l++) {
+            /* spare lanes repeat the last message */
+            LaneBlock(block, data + stride * Min(l, count - 1), len, off);
+            for (i = 0; i < 16; i++)
+                M[i][l] = Reverse32(((uint32_t *)block)[i]);
+        }
+        HashBlockV(h, S, (const uint32_t (*)[HEFTY1_LANES]) M);
+    }
+
+    for (i = 0; i < HEFTY1_STATE_WORDS; i++)
+        _mm256_storeu_si256((__m256i *)out[i], h[i]);
+    for (l = 0; l < count; l++) {
+        for (i = 0; i < HEFTY1_STATE_WORDS; i++)
+            ((uint32_t *)(digest + HEFTY1_DIGEST_BYTES * l))[i] = Reverse32(out[i][l]);
+    }
+}
+
+#else
+
+void HEFTY1_Lanes(const unsigned char *data, size_t stride, size_t len, int count, unsigned char *digest)
+{
+    int l;
+
+    assert(count > 0 && count <= HEFTY1_LANES);
+
+    for (l = 0; l < count; l++)
+        HEFTY1(data + stride * l, len, digest + HEFTY1_DIGEST_BYTES * l);
+}
+
+#endif
@@ -46,6 +46,7 @@ extern "C" {
 #define HEFTY1_BLOCK_BYTES 64
 #define HEFTY1_STATE_WORDS 8
 #define HEFTY1_SPONGE_WORDS 4
+#define HEFTY1_LANES 8
 
 typedef struct HEFTY1_CTX {
     uint32_t h[HEFTY1_STATE_WORDS];
@@ -59,6 +60,10 @@ void HEFTY1_Update(HEFTY1_CTX *cxt, const void *data, size_t len);
 void HEFTY1_Final(unsigned char *digest, HEFTY1_CTX *cxt);
 unsigned char* HEFTY1(const unsigned char *data, size_t len, unsigned char *digest);
 
+/* Hash count (1..HEFTY1_LANES) messages of the same length, placed stride
+ * bytes apart, and write their digests contiguously. */
+void HEFTY1_Lanes(const unsigned char *data, size_t stride, size_t len, int count, unsigned char *digest);
+
 #ifdef __cplusplus
 }
 #endif
@@ -94,6 +94,13 @@ typedef unsigned char uchar;
 #define likely(expr) (expr)
 #endif
 
+/* full memory barrier, for the few lock-free paths */
+#ifdef _MSC_VER
+#define memory_barrier() MemoryBarrier()
+#else
+#define memory_barrier() __sync_synchronize()
+#endif
+
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 #endif
@@ -267,6 +274,10 @@ json_t * json_load_url(char* cfg_url, json_error_t *err);
 void sha256_init(uint32_t *state);
 void sha256_transform(uint32_t *state, const uint32_t *block, int swap);
 void sha256d(unsigned char *hash, const unsigned char *data, int len);
+int sha256_midstate(uint32_t *midstate, const unsigned char *data, int len);
+void sha256_resume(unsigned char *hash, const uint32_t *midstate,
+	const unsigned char *data, int done, int len, int dbl);
+void sha256d_merkle_step(uint32_t *hash, const uint32_t *branch);
 
 #define HAVE_SHA256_4WAY 0
 #define HAVE_SHA256_8WAY 0
@@ -277,11 +288,13 @@ extern int scanhash_bastion(int thr_id, struct work* work, uint32_t max_nonce, u
 extern int scanhash_blake256(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done, int8_t blakerounds);
 extern int scanhash_blake2s(int thr_id, struct work *work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_bmw(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
+extern int scanhash_bmw_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_c11(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_cryptolight(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_cryptonight(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_decred(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_deep(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
+extern int scanhash_deep_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_equihash(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_keccak256(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_fresh(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
@@ -290,10 +303,12 @@ extern int scanhash_groestlcoin(int thr_id, struct work* work, uint32_t max_nonc
 extern int scanhash_hmq17(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_heavy(int thr_id,struct work *work, uint32_t max_nonce, unsigned long *hashes_done, uint32_t maxvote, int blocklen);
 extern int scanhash_hsr(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
+extern int scanhash_hsr_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_jha(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_jackpot(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done); // quark method
 extern int scanhash_lbry(int thr_id, struct work *work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_luffa(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
+extern int scanhash_luffa_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_lyra2(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_lyra2v2(int thr_id,struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_lyra2Z(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
@@ -305,6 +320,7 @@ extern int scanhash_phi(int thr_id, struct work* work, uint32_t max_nonce, unsig
 extern int scanhash_polytimos(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_quark(int thr_id, struct work *work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_qubit(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
+extern int scanhash_qubit_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_sha256d(int thr_id, struct work *work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_sha256t(int thr_id, struct work *work, uint32_t max_nonce, unsigned long *hashes_done);
 extern int scanhash_sia(int thr_id, struct work *work, uint32_t max_nonce, unsigned long *hashes_done);
@@ -500,6 +516,19 @@ struct hashlog_data {
 
 /* end of api */
 
+struct share_inflight {
+	uint32_t id; // json-rpc id of the submit, 0 if the slot is free
+	int pooln;
+	char job_id[128];
+	uint32_t nonce;
+	double sharediff;
+	struct timeval tv_submit;
+	uint32_t answer_msec;
+	int proxy_client; // downstream client slot + 1 (--stratum-proxy), 0 if local
+	uint32_t proxy_seq;
+	char proxy_id[32]; // json id of the client request
+};
+
 struct thr_info {
 	int		id;
 	pthread_t	pth;
@@ -541,6 +570,7 @@ extern bool want_stratum;
 extern bool have_stratum;
 extern bool opt_stratum_stats;
 extern char *opt_cert;
+extern bool opt_no_cert_check;
 extern char *opt_proxy;
 extern long opt_proxy_type;
 extern bool use_syslog;
@@ -553,6 +583,11 @@ extern int stratum_thr_id;
 extern int api_thr_id;
 extern volatile bool abort_flag;
 extern struct work_restart *work_restart;
+
+/* g_work writers, see g_work_snapshot() */
+extern volatile uint32_t g_work_seq;
+void g_work_write_lock();
+void g_work_write_unlock();
 extern bool opt_trust_pool;
 extern uint16_t opt_vote;
 
@@ -645,6 +680,8 @@ double bn_hash_target_ratio(uint32_t* hash, uint32_t* target);
 void bn_store_hash_target_ratio(uint32_t* hash, uint32_t* target, struct work* work, int nonce);
 void bn_set_target_ratio(struct work* work, uint32_t* hash, int nonce);
 void work_set_target_ratio(struct work* work, uint32_t* hash);
+int scanhash_cpu_batch(int thr_id, struct work *work, uint32_t max_nonce, unsigned long *hashes_done,
+	void (*hash_batch)(void *output, const void *input, const uint32_t *nonces, int count));
 
 // bench
 extern int bench_algo;
@@ -673,6 +710,17 @@ struct stratum_job {
 	double diff;
 };
 
+// storage of a notified job, stratum_ctx keeps two of them (current and next)
+struct stratum_job_buf {
+	char *job_id;
+	size_t job_id_alloc;
+	unsigned char *coinbase;
+	size_t coinbase_alloc;
+	unsigned char *merkle; // flat, 32 bytes per branch
+	unsigned char **merkle_ptr;
+	int merkle_alloc;
+};
+
 struct stratum_ctx {
 	char *url;
 
@@ -680,22 +728,31 @@ struct stratum_ctx {
 	char *curl_url;
 	char curl_err_str[CURL_ERROR_SIZE];
 	curl_socket_t sock;
+	bool tls; // stratum+ssl, data sent and received through curl
 	size_t sockbuf_size;
 	char *sockbuf;
+	// received data is [sockbuf_rpos, sockbuf_wpos), no newline before sockbuf_scan
+	size_t sockbuf_rpos;
+	size_t sockbuf_wpos;
+	size_t sockbuf_scan;
 
 	double next_diff;
-	double sharediff;
 
 	char *session_id;
 	size_t xnonce1_size;
 	unsigned char *xnonce1;
 	size_t xnonce2_size;
 	struct stratum_job job;
+	struct stratum_job_buf jobbuf[2];
+	int jobbuf_next;
+	uint32_t job_seq; // incremented on each published job
 
-	struct timeval tv_submit;
-	uint32_t answer_msec;
+	uint32_t answer_msec; // of the last answered share
+	uint32_t vr_mask; // version-rolling bits allowed by the pool (BIP 310)
+	bool vr_pending; // mining.configure sent, not answered
 	int pooln;
 	time_t tm_connected;
+	bool notified; // a job was received on this connection
 
 	int rpc2;
 	int is_equihash;
@@ -739,6 +796,8 @@ struct work {
 	uint32_t scanned_from;
 	uint32_t scanned_to;
 
+	uint32_t vr_mask; // version bits rolled in data[0] (BIP 310)
+
 	/* pok getwork txs */
 	uint32_t tx_count;
 	struct tx txs[POK_MAX_TXS];
@@ -793,6 +852,24 @@ struct pool_infos {
 	time_t last_share_time;
 	double best_share;
 	uint32_t disconnects;
+	uint32_t work_gen_count;
+	uint64_t work_gen_usec;
+	// clean jobs, notify received to miners restarted
+	uint32_t job_switch_count;
+	uint64_t job_switch_usec;
+	// latency probes (ms)
+	uint32_t connect_msec;
+	uint32_t notify_count;
+	double notify_delay; // behind the first pool notifying a block
+	double answer_avg;
+#define POOL_RTT_BUCKETS 6
+	uint32_t answer_hist[POOL_RTT_BUCKETS]; // 50, 100, 200, 500, 1000ms, more
+	// --share-interval, difficulty asked and the limits seen in the answers
+	double suggest_diff;
+	double suggest_min;
+	double suggest_max;
+	bool suggest_pending; // sent, the next job diff is the answer
+	time_t suggest_limit_time;
 };
 
 extern struct pool_infos pools[MAX_POOLS];
@@ -806,6 +883,43 @@ bool pool_switch_url(char *params);
 bool pool_switch(int thr_id, int pooln);
 bool pool_switch_next(int thr_id);
 int pool_get_first_valid(int startfrom);
+
+void pool_latency_connect(int pooln, const struct timeval *tv_start);
+void pool_latency_notify(int pooln, const unsigned char *prevhash, bool first);
+void pool_latency_answer(int pooln, uint32_t msec);
+double pool_stale_risk(int pooln);
+int pool_get_lowest_risk(void);
+extern bool opt_pool_select_latency;
+
+extern int opt_pool_standby;
+bool pool_standby_start(struct thr_info *thr);
+int pool_standby_next(int startfrom);
+bool pool_standby_take(int pooln);
+
+/* xnonce2 bytes of the downstream client number, 0 for the local threads */
+#define STRATUM_PROXY_XN2 1
+extern char *opt_stratum_proxy;
+bool proxy_start(struct thr_info *thr);
+void proxy_upstream_check(struct stratum_ctx *sctx);
+void proxy_upstream_line(const char *line);
+void proxy_share_answer(const struct share_inflight *share, bool accepted, json_t *err_val);
+
+extern char *opt_stratum_record;
+extern char *opt_stratum_replay;
+extern double opt_replay_speed;
+bool stratum_record_open();
+void stratum_record(struct stratum_ctx *sctx, char dir, const char *line);
+void stratum_record_event(struct stratum_ctx *sctx, const char *event);
+bool stratum_replay_init(char *url, size_t len);
+bool stratum_replay_start(struct thr_info *thr);
+
+extern char *opt_coinbase_addr;
+extern char *opt_coinbase_script;
+bool gbt_solo_init();
+bool gbt_solo_start(struct thr_info *thr);
+bool gbt_solo_work(struct work *work);
+int gbt_solo_submit(CURL *curl, struct pool_infos *pool, const struct work *work, char *reason, size_t len);
+
 bool parse_pool_array(json_t *obj);
 void pool_dump_infos(void);
 
@@ -813,16 +927,47 @@ json_t * json_rpc_call_pool(CURL *curl, struct pool_infos*,
 	const char *req, bool lp_scan, bool lp, int *err);
 json_t * json_rpc_longpoll(CURL *curl, char *lp_url, struct pool_infos*,
 	const char *req, int *err);
+json_t * json_rpc_call_pool_null(CURL *curl, struct pool_infos*, const char *req, int *err);
+
+/* kinds of http requests: a pooled handle keeps the options of its
+ * current kind, and the constant headers of each */
+enum curl_conf {
+	CURL_CONF_NONE = 0,
+	CURL_CONF_RPC,
+	CURL_CONF_SIA,
+	CURL_CONF_SIA_SUBMIT, // headers only
+	CURL_CONF_MAX
+};
+
+struct curl_stat_data {
+	char endpoint[32];
+	uint32_t count;
+	uint32_t errors;
+	uint32_t connects; // new connections
+	uint32_t last_ms;
+	uint32_t max_ms;
+	uint64_t total_ms;
+};
+
+CURL *curl_conn_get();
+void curl_conn_put(CURL *curl);
+bool curl_conn_setup(CURL *curl, int conf);
+struct curl_slist *curl_conn_headers(CURL *curl, int conf, struct curl_slist *(*build)());
+char *curl_conn_error(CURL *curl);
+void curl_conn_stat(CURL *curl, const char *endpoint, bool success);
+int curl_conn_get_stats(struct curl_stat_data *data, int max_records);
 
 bool stratum_socket_full(struct stratum_ctx *sctx, int timeout);
 bool stratum_send_line(struct stratum_ctx *sctx, char *s);
-char *stratum_recv_line(struct stratum_ctx *sctx);
+char *stratum_recv_line(struct stratum_ctx *sctx); // valid until the next call, do not free
 bool stratum_connect(struct stratum_ctx *sctx, const char *url);
 void stratum_disconnect(struct stratum_ctx *sctx);
 bool stratum_subscribe(struct stratum_ctx *sctx);
 bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *pass);
 bool stratum_handle_method(struct stratum_ctx *sctx, const char *s);
 void stratum_free_job(struct stratum_ctx *sctx);
+struct stratum_job_buf* stratum_job_reserve(struct stratum_ctx *sctx, size_t job_id_len, size_t coinbase_size, int merkle_count);
+void stratum_job_publish(struct stratum_ctx *sctx, struct stratum_job_buf *jb, size_t coinbase_size, size_t xnonce2_offset, int merkle_count);
 
 bool rpc2_stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *pass);
 
@@ -848,6 +993,18 @@ void hashlog_purge_all(void);
 void hashlog_dump_job(char* jobid);
 void hashlog_getmeminfo(uint64_t *mem, uint32_t *records);
 
+uint64_t nonce_sched_key(const void *header, int len);
+void nonce_sched_rate(int thr_id, double hashrate);
+bool nonce_sched_next(int thr_id, uint64_t key, bool shared, uint32_t cursor,
+	double max_secs, uint64_t first_chunk, uint32_t *first, uint32_t *last);
+
+#define SHARE_FIRST_ID 10 /* lower ids are used by the stratum login and requests */
+uint32_t share_inflight_add(int pooln, const char *job_id, uint32_t nonce, double sharediff);
+uint32_t share_inflight_add_proxy(int pooln, const char *job_id, uint32_t nonce,
+	int client, uint32_t seq, const char *req_id);
+bool share_inflight_done(uint32_t id, struct share_inflight *share);
+int share_inflight_count();
+
 void stats_remember_speed(int thr_id, uint32_t hashcount, double hashrate, uint8_t found, uint32_t height);
 double stats_get_speed(int thr_id, double def_speed);
 double stats_get_gpu_speed(int gpu_id);
@@ -877,6 +1034,9 @@ extern void tq_thaw(struct thread_q *tq);
 void parse_arg(int key, char *arg);
 void proper_exit(int reason);
 void restart_threads(void);
+void work_restart_notify(void);
+bool restart_wait(uint32_t gen, int msecs);
+extern volatile uint32_t work_restart_gen;
 
 size_t time2str(char* buf, time_t timer);
 char* atime2str(time_t timer);
@@ -892,17 +1052,22 @@ void blake256hash(void *output, const void *input, int8_t rounds);
 void blake2b_hash(void *output, const void *input);
 void blake2s_hash(void *output, const void *input);
 void bmw_hash(void *state, const void *input);
+void bmw_hash_batch(void *output, const void *input, const uint32_t *nonces, int count);
 void c11hash(void *output, const void *input);
 void cryptolight_hash(void* output, const void* input, int len);
 void cryptonight_hash(void* output, const void* input, size_t len);
 void decred_hash(void *state, const void *input);
 void deephash(void *state, const void *input);
+void deephash_batch(void *output, const void *input, const uint32_t *nonces, int count);
 void luffa_hash(void *state, const void *input);
+void luffa_hash_batch(void *output, const void *input, const uint32_t *nonces, int count);
 void fresh_hash(void *state, const void *input);
 void fugue256_hash(unsigned char* output, const unsigned char* input, int len);
 void heavycoin_hash(unsigned char* output, const unsigned char* input, int len);
+void heavycoin_hash_batch(unsigned char* output, const unsigned char* input, size_t stride, int len, int count);
 void hmq17hash(void *output, const void *input);
 void hsr_hash(void *output, const void *input);
+void hsr_hash_batch(void *output, const void *input, const uint32_t *nonces, int count);
 void keccak256_hash(void *state, const void *input);
 void jackpothash(void *state, const void *input);
 void groestlhash(void *state, const void *input);
@@ -919,6 +1084,7 @@ void phihash(void *output, const void *input);
 void polytimos_hash(void *output, const void *input);
 void quarkhash(void *state, const void *input);
 void qubithash(void *state, const void *input);
+void qubithash_batch(void *output, const void *input, const uint32_t *nonces, int count);
 void scrypthash(void* output, const void* input);
 void scryptjane_hash(void* output, const void* input);
 void sha256d_hash(void *output, const void *input);
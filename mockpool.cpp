@@ -0,0 +1,1082 @@
+/**
+ * Mock stratum pool, to test and benchmark the stratum code of ccminer
+ * without a live pool (make mockpool, posix systems only)
+ *
+ * Speaks the bitcoin stratum (subscribe, authorize, notify, set_difficulty,
+ * submit, version-rolling), its equihash variant (set_target) and the rpc2 of cryptonight
+ * pools (login, job, submit). The jobs rate, new blocks, reconnects,
+ * vardiff and the answers latency are set on the command line, the shares
+ * of the header based algos are verified with the cpu hash functions.
+ *
+ *   ./mockpool -a sha256d -d 0.5 -n 5 -c 3 -l 20 -t 300
+ *   ccminer -a sha256d -o stratum+tcp://127.0.0.1:3333 -u test -p x
+ *
+ * With -s (a pem file with the certificate and its key), the clients
+ * connect with tls (stratum+ssl://, --cert or --no-cert-check for a
+ * self-signed one) and the resumed sessions are counted.
+ *
+ * With -t, the exit code is 0 if shares were accepted and none was invalid.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <jansson.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "sph/sph_sha2.h"
+#include "sph/sph_blake.h"
+#include "sph/sph_keccak.h"
+
+#define MOCK_MAX_CLIENTS 64
+#define MOCK_MAX_JOBS 16
+#define MOCK_LINE_MAX 16384 /* an equihash submit is ~2.7KB */
+#define MOCK_DUPS 4096
+#define MOCK_XNONCE1_SIZE 4
+#define MOCK_VERSION 0x20000000
+#define MOCK_VR_MASK 0x1fffe000 /* version-rolling bits allowed */
+
+typedef unsigned char uchar;
+
+enum mock_dialect {
+	DIALECT_STRATUM,
+	DIALECT_EQUIHASH,
+	DIALECT_RPC2,
+};
+
+static void sha256_single(void *output, const void *input, size_t len)
+{
+	sph_sha256_context ctx;
+	sph_sha256_init(&ctx);
+	sph_sha256(&ctx, input, len);
+	sph_sha256_close(&ctx, output);
+}
+
+static void sha256d(void *output, const void *input, size_t len)
+{
+	uchar hash[32];
+	sha256_single(hash, input, len);
+	sha256_single(output, hash, 32);
+}
+
+static void sha256d_hash(void *output, const void *input)
+{
+	sha256d(output, input, 80);
+}
+
+static void sha256t_hash(void *output, const void *input)
+{
+	uchar hash[32];
+	sha256d(hash, input, 80);
+	sha256_single(output, hash, 32);
+}
+
+static void blake256_hash_rounds(void *output, const void *input, int rounds)
+{
+	sph_blake256_context ctx;
+	sph_blake256_set_rounds(rounds);
+	sph_blake256_init(&ctx);
+	sph_blake256(&ctx, input, 80);
+	sph_blake256_close(&ctx, output);
+}
+
+static void blake_hash(void *output, const void *input)
+{
+	blake256_hash_rounds(output, input, 14);
+}
+
+static void blake8_hash(void *output, const void *input)
+{
+	blake256_hash_rounds(output, input, 8);
+}
+
+static void keccak_hash(void *output, const void *input)
+{
+	sph_keccak_context ctx;
+	sph_keccak256_init(&ctx);
+	sph_keccak256(&ctx, input, 80);
+	sph_keccak256_close(&ctx, output);
+}
+
+/* diff factors and coinbase hash as in ccminer stratum_gen_work() */
+static const struct mock_algo {
+	const char *name;
+	enum mock_dialect dialect;
+	double factor;
+	bool single_sha256;
+	void (*hash)(void *output, const void *input); // NULL if not verified
+} mock_algos[] = {
+	{ "sha256d",     DIALECT_STRATUM,  1.,   false, sha256d_hash },
+	{ "sha256t",     DIALECT_STRATUM,  1.,   false, sha256t_hash },
+	{ "blake",       DIALECT_STRATUM,  1.,   false, blake_hash },
+	{ "blakecoin",   DIALECT_STRATUM,  1.,   true,  blake8_hash },
+	{ "vanilla",     DIALECT_STRATUM,  1.,   false, blake8_hash },
+	{ "keccak",      DIALECT_STRATUM,  128., true,  keccak_hash },
+	{ "equihash",    DIALECT_EQUIHASH, 1.,   false, NULL },
+	{ "cryptonight", DIALECT_RPC2,     1.,   false, NULL },
+	{ "cryptolight", DIALECT_RPC2,     1.,   false, NULL },
+	{ NULL,          DIALECT_STRATUM,  1.,   false, NULL } // others, not verified
+};
+
+struct mock_msg {
+	struct mock_msg *next;
+	uint64_t due; // ms
+	size_t len;
+	char line[1];
+};
+
+static struct mock_client {
+	int sock; // -1 if the slot is free
+	SSL *ssl; // with -s
+	uint32_t xnonce1;
+	bool subscribed;
+	bool authorized;
+	uint32_t vr_mask;
+	double diff;
+	double diff_prev; // accepted until the next job
+	time_t vardiff_time;
+	uint32_t vardiff_shares;
+	char buf[MOCK_LINE_MAX];
+	int len;
+	struct mock_msg *out;
+	struct mock_msg *out_tail;
+} clients[MOCK_MAX_CLIENTS];
+
+static struct mock_job {
+	uint32_t id;
+	uint32_t height;
+	uint32_t ntime;
+	bool clean;
+	uchar prevhash[32]; // as sent, words swapped
+	uchar coinb1[64];
+	uchar coinb2[32];
+	uchar branch[2][32];
+	uchar blob[76]; // rpc2
+} jobs[MOCK_MAX_JOBS];
+
+static const struct mock_algo *algo = NULL;
+static int opt_port = 3333;
+static double opt_diff = 1.;
+static double opt_notify = 30.;
+static int opt_clean = 1;
+static int opt_reconnect = 0;
+static int opt_drop = 0;
+static int opt_latency = 0;
+static int opt_xnonce2 = 4;
+static int opt_vardiff = 0;
+static int opt_time_limit = 0;
+static bool opt_protocol = false;
+static const char *opt_tls = NULL;
+static SSL_CTX *tls_ctx = NULL;
+
+static uint32_t job_count = 0;
+static uint32_t block_height = 100000;
+static uint32_t session_count = 0;
+static uint64_t dups[MOCK_DUPS];
+static uint32_t dups_pos = 0;
+
+static struct {
+	uint32_t connects;
+	uint32_t resumed; // tls sessions
+	uint32_t jobs;
+	uint32_t valid;
+	uint32_t unchecked;
+	uint32_t stale;
+	uint32_t unknown;
+	uint32_t dup;
+	uint32_t lowdiff;
+	uint32_t malformed;
+	double best;
+} stats = { 0 };
+
+static volatile bool abort_flag = false;
+
+static void mlog(const char *fmt, ...)
+{
+	time_t now = time(NULL);
+	struct tm tm;
+	va_list ap;
+
+	localtime_r(&now, &tm);
+	printf("[%02d:%02d:%02d] ", tm.tm_hour, tm.tm_min, tm.tm_sec);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+	fflush(stdout);
+}
+
+static uint64_t now_ms()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void bin2hex(char *out, const uchar *in, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		sprintf(out + 2 * i, "%02x", in[i]);
+	out[2 * len] = '\0';
+}
+
+static bool hex2bin(uchar *out, const char *hex, size_t len)
+{
+	if (!hex || strlen(hex) != 2 * len)
+		return false;
+	for (size_t i = 0; i < len; i++) {
+		unsigned int v;
+		if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+			return false;
+		out[i] = (uchar) v;
+	}
+	return true;
+}
+
+static void random_bytes(uchar *p, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		p[i] = (uchar) rand();
+}
+
+// same as util.cpp
+static void diff_to_target(uint32_t *target, double diff)
+{
+	uint64_t m;
+	int k;
+
+	for (k = 6; k > 0 && diff > 1.0; k--)
+		diff /= 4294967296.0;
+	m = (uint64_t)(4294901760.0 / diff);
+	if (m == 0 && k == 6)
+		memset(target, 0xff, 32);
+	else {
+		memset(target, 0, 32);
+		target[k] = (uint32_t)m;
+		target[k + 1] = (uint32_t)(m >> 32);
+	}
+}
+
+static bool hash_below(const uint32_t *hash, const uint32_t *target)
+{
+	for (int i = 7; i >= 0; i--) {
+		if (hash[i] > target[i])
+			return false;
+		if (hash[i] < target[i])
+			return true;
+	}
+	return true;
+}
+
+static double hash_diff(const uchar *hash)
+{
+	uint64_t m = 0;
+	for (int i = 29; i >= 22; i--)
+		m = (m << 8) | hash[i];
+	return m ? (double) 0x0000ffff00000000ULL / m : 0.;
+}
+
+/* outgoing lines, sent after the injected latency */
+static void client_send(struct mock_client *c, const char *line)
+{
+	size_t len = strlen(line);
+	struct mock_msg *m = (struct mock_msg*) malloc(sizeof(*m) + len + 1);
+	if (!m)
+		return;
+	m->next = NULL;
+	m->due = now_ms() + opt_latency;
+	m->len = len + 1;
+	memcpy(m->line, line, len);
+	m->line[len] = '\n';
+	if (opt_protocol)
+		mlog("%d> %s", (int) (c - clients), line);
+	if (c->out_tail)
+		c->out_tail->next = m;
+	else
+		c->out = m;
+	c->out_tail = m;
+}
+
+static void client_close(struct mock_client *c, const char *reason)
+{
+	while (c->out) {
+		struct mock_msg *m = c->out;
+		c->out = m->next;
+		free(m);
+	}
+	c->out_tail = NULL;
+	if (c->ssl) {
+		SSL_free(c->ssl);
+		c->ssl = NULL;
+	}
+	if (c->sock >= 0) {
+		close(c->sock);
+		mlog("client %d disconnected (%s)", (int) (c - clients), reason);
+	}
+	c->sock = -1;
+}
+
+static void client_flush(struct mock_client *c, uint64_t now)
+{
+	while (c->out && c->out->due <= now) {
+		struct mock_msg *m = c->out;
+		ssize_t n = c->ssl ? SSL_write(c->ssl, m->line, (int) m->len) :
+			send(c->sock, m->line, m->len, MSG_NOSIGNAL);
+		if (n != (ssize_t) m->len) {
+			client_close(c, "send failed");
+			return;
+		}
+		c->out = m->next;
+		if (!c->out)
+			c->out_tail = NULL;
+		free(m);
+	}
+}
+
+static void client_reply(struct mock_client *c, json_t *id, json_t *result, const char *error)
+{
+	json_t *val = json_object();
+	char *s;
+
+	json_object_set(val, "id", id ? id : json_null());
+	json_object_set_new(val, "result", result ? result : json_null());
+	if (error)
+		json_object_set_new(val, "error", json_loads(error, 0, NULL));
+	else
+		json_object_set_new(val, "error", json_null());
+	s = json_dumps(val, JSON_COMPACT | JSON_PRESERVE_ORDER);
+	if (s)
+		client_send(c, s);
+	free(s);
+	json_decref(val);
+}
+
+static void send_difficulty(struct mock_client *c)
+{
+	char s[256];
+
+	if (algo->dialect == DIALECT_EQUIHASH) {
+		// big endian target, diff 1 is 0007ffff...
+		uint64_t m = (uint64_t) ((double) 0x0007ffffffffffffULL / c->diff);
+		uchar target[32];
+		char hex[65];
+		memset(target, 0xff, sizeof(target));
+		for (int i = 0; i < 8; i++)
+			target[i] = (uchar) (m >> (56 - 8 * i));
+		bin2hex(hex, target, 32);
+		snprintf(s, sizeof(s), "{\"id\":null,\"method\":\"mining.set_target\",\"params\":[\"%s\"]}", hex);
+	} else {
+		snprintf(s, sizeof(s), "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[%.8g]}", c->diff);
+	}
+	client_send(c, s);
+}
+
+static json_t *rpc2_job(struct mock_client *c, const struct mock_job *j)
+{
+	uchar blob[sizeof(j->blob)];
+	char hex[2 * sizeof(blob) + 1], id[16], target[9];
+	uint32_t t = (uint32_t) (UINT32_MAX / c->diff);
+	uchar tb[4] = { (uchar) t, (uchar) (t >> 8), (uchar) (t >> 16), (uchar) (t >> 24) };
+
+	// the session in the merkle root, the clients do not share nonces
+	memcpy(blob, j->blob, sizeof(blob));
+	memcpy(&blob[60], &c->xnonce1, 4);
+	bin2hex(hex, blob, sizeof(blob));
+	bin2hex(target, tb, 4);
+	snprintf(id, sizeof(id), "%x", j->id);
+	return json_pack("{s:s,s:s,s:s}", "blob", hex, "job_id", id, "target", target);
+}
+
+static void send_job(struct mock_client *c, const struct mock_job *j, bool clean)
+{
+	char s[2048], prevhash[65], cb1[129], cb2[65], b0[65], b1[65];
+
+	c->diff_prev = c->diff;
+	bin2hex(prevhash, j->prevhash, 32);
+
+	if (algo->dialect == DIALECT_RPC2) {
+		json_t *val = json_pack("{s:s,s:s,s:o}", "jsonrpc", "2.0", "method", "job",
+			"params", rpc2_job(c, j));
+		char *line = json_dumps(val, JSON_COMPACT | JSON_PRESERVE_ORDER);
+		if (line)
+			client_send(c, line);
+		free(line);
+		json_decref(val);
+		return;
+	}
+	if (algo->dialect == DIALECT_EQUIHASH) {
+		// merkle root and reserved field, no coinbase
+		bin2hex(b0, j->branch[0], 32);
+		bin2hex(b1, j->branch[1], 32);
+		snprintf(s, sizeof(s), "{\"id\":null,\"method\":\"mining.notify\",\"params\":"
+			"[\"%x\",\"04000000\",\"%s\",\"%s\",\"%s\",\"%08x\",\"1f07ffff\",%s]}",
+			j->id, prevhash, b0, b1, __builtin_bswap32(j->ntime), clean ? "true" : "false");
+		client_send(c, s);
+		return;
+	}
+	bin2hex(cb1, j->coinb1, sizeof(j->coinb1));
+	bin2hex(cb2, j->coinb2, sizeof(j->coinb2));
+	bin2hex(b0, j->branch[0], 32);
+	bin2hex(b1, j->branch[1], 32);
+	snprintf(s, sizeof(s), "{\"id\":null,\"method\":\"mining.notify\",\"params\":"
+		"[\"%x\",\"%s\",\"%s\",\"%s\",[\"%s\",\"%s\"],\"%08x\",\"1d00ffff\",\"%08x\",%s]}",
+		j->id, prevhash, cb1, cb2, b0, b1, MOCK_VERSION, j->ntime, clean ? "true" : "false");
+	client_send(c, s);
+}
+
+static struct mock_job *job_current()
+{
+	return job_count ? &jobs[(job_count - 1) % MOCK_MAX_JOBS] : NULL;
+}
+
+static struct mock_job *job_find(const char *job_id)
+{
+	uint32_t id;
+	if (!job_id || sscanf(job_id, "%x", &id) != 1)
+		return NULL;
+	for (int i = 0; i < MOCK_MAX_JOBS; i++)
+		if (jobs[i].id == id && id)
+			return &jobs[i];
+	return NULL;
+}
+
+static void job_new()
+{
+	struct mock_job *j = &jobs[job_count % MOCK_MAX_JOBS];
+	// 01000000 01 <32 x 00> ffffffff <script len> 03 <height> <tag>
+	static const uchar cb1_head[] = { 1, 0, 0, 0, 1 };
+	uchar *p;
+
+	job_count++;
+	memset(j, 0, sizeof(*j));
+	j->id = job_count;
+	j->clean = (job_count == 1 || opt_clean <= 1 || (job_count % opt_clean) == 1);
+	if (j->clean && job_count > 1)
+		block_height++;
+	j->height = block_height;
+	j->ntime = (uint32_t) time(NULL);
+
+	if (j->clean || job_count == 1)
+		random_bytes(j->prevhash, 32);
+	else
+		memcpy(j->prevhash, jobs[(job_count - 2) % MOCK_MAX_JOBS].prevhash, 32);
+
+	memcpy(j->coinb1, cb1_head, sizeof(cb1_head));
+	p = j->coinb1 + sizeof(cb1_head) + 32;
+	memset(p, 0xff, 4);
+	p += 4;
+	*p = (uchar) (sizeof(j->coinb1) - (p + 1 - j->coinb1) + MOCK_XNONCE1_SIZE + opt_xnonce2 + 4);
+	p++;
+	*p++ = 3;
+	*p++ = (uchar) j->height;
+	*p++ = (uchar) (j->height >> 8);
+	*p++ = (uchar) (j->height >> 16);
+	random_bytes(p, sizeof(j->coinb1) - (p - j->coinb1));
+	random_bytes(j->coinb2, sizeof(j->coinb2));
+	random_bytes(j->branch[0], sizeof(j->branch));
+	random_bytes(j->blob, sizeof(j->blob));
+	memset(&j->blob[39], 0, 4); // nonce
+
+	stats.jobs++;
+	for (int n = 0; n < MOCK_MAX_CLIENTS; n++) {
+		if (clients[n].sock >= 0 && clients[n].authorized)
+			send_job(&clients[n], j, j->clean);
+	}
+	if (opt_protocol || j->clean)
+		mlog("job %x%s, block %u", j->id, j->clean ? " (new block)" : "", j->height);
+}
+
+static bool dup_check(uint64_t key)
+{
+	for (int i = 0; i < MOCK_DUPS; i++)
+		if (dups[i] == key)
+			return true;
+	dups[dups_pos++ % MOCK_DUPS] = key;
+	return false;
+}
+
+static uint64_t fnv1a(uint64_t h, const char *s)
+{
+	if (!h) h = 0xcbf29ce484222325ULL;
+	while (s && *s) {
+		h ^= (uchar) *s++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* shared checks of the dialects, NULL if the share can be verified */
+static const char *share_precheck(struct mock_client *c, struct mock_job *j, uint64_t key)
+{
+	if (!c->authorized) {
+		stats.malformed++;
+		return "[24,\"Unauthorized worker\",null]";
+	}
+	if (!j) {
+		stats.unknown++;
+		return "[21,\"Job not found\",null]";
+	}
+	if (j->height != block_height) {
+		stats.stale++;
+		return "[21,\"Stale share\",null]";
+	}
+	if (dup_check(key)) {
+		stats.dup++;
+		return "[22,\"Duplicate share\",null]";
+	}
+	return NULL;
+}
+
+static void share_accepted(struct mock_client *c, double diff, bool checked)
+{
+	if (checked)
+		stats.valid++;
+	else
+		stats.unchecked++;
+	if (diff > stats.best)
+		stats.best = diff;
+	c->vardiff_shares++;
+}
+
+/* params: worker, job_id, xnonce2, ntime, nonce[, version bits] */
+static const char *stratum_submit(struct mock_client *c, json_t *params)
+{
+	const char *job_id = json_string_value(json_array_get(params, 1));
+	const char *xn2 = json_string_value(json_array_get(params, 2));
+	const char *ntime = json_string_value(json_array_get(params, 3));
+	const char *nonce = json_string_value(json_array_get(params, 4));
+	const char *vbits = json_string_value(json_array_get(params, 5));
+	struct mock_job *j = job_find(job_id);
+	uchar coinbase[128 + 32], header[80], merkle[64], xn2_bin[32], bin[4];
+	uint32_t hash[8], target[8], version = MOCK_VERSION;
+	size_t cb_size = 0;
+	const char *err;
+	double diff;
+
+	if (!xn2 || !ntime || !nonce || strlen(xn2) != 2 * (size_t) opt_xnonce2 ||
+	    !hex2bin(xn2_bin, xn2, opt_xnonce2) || strlen(ntime) != 8 || strlen(nonce) != 8) {
+		stats.malformed++;
+		return "[20,\"Invalid submit\",null]";
+	}
+	if (vbits) {
+		uint32_t bits = (uint32_t) strtoul(vbits, NULL, 16);
+		if (bits & ~c->vr_mask) {
+			stats.malformed++;
+			return "[20,\"Invalid version bits\",null]";
+		}
+		version = (version & ~c->vr_mask) | bits;
+	}
+	err = share_precheck(c, j, fnv1a(fnv1a(fnv1a(fnv1a(fnv1a(0, job_id), xn2), nonce), ntime),
+		vbits ? vbits : "") ^ c->xnonce1);
+	if (err)
+		return err;
+	if (!algo->hash) {
+		share_accepted(c, 0., false);
+		return NULL;
+	}
+
+	memcpy(coinbase, j->coinb1, sizeof(j->coinb1));
+	cb_size = sizeof(j->coinb1);
+	memcpy(coinbase + cb_size, &c->xnonce1, MOCK_XNONCE1_SIZE);
+	cb_size += MOCK_XNONCE1_SIZE;
+	memcpy(coinbase + cb_size, xn2_bin, opt_xnonce2);
+	cb_size += opt_xnonce2;
+	memcpy(coinbase + cb_size, j->coinb2, sizeof(j->coinb2));
+	cb_size += sizeof(j->coinb2);
+
+	if (algo->single_sha256)
+		sha256_single(merkle, coinbase, cb_size);
+	else
+		sha256d(merkle, coinbase, cb_size);
+	for (int i = 0; i < 2; i++) {
+		memcpy(merkle + 32, j->branch[i], 32);
+		sha256d(merkle, merkle, 64);
+	}
+
+	// header words are the byte swapped hex values, as assembled by ccminer
+	static const uchar nbits[4] = { 0xff, 0xff, 0x00, 0x1d };
+	for (int k = 0; k < 4; k++) header[k] = (uchar) (version >> (8 * k));
+	for (int i = 0; i < 32; i += 4)
+		for (int k = 0; k < 4; k++)
+			header[4 + i + k] = j->prevhash[i + 3 - k];
+	memcpy(header + 36, merkle, 32);
+	hex2bin(bin, ntime, 4);
+	for (int k = 0; k < 4; k++) header[68 + k] = bin[3 - k];
+	memcpy(header + 72, nbits, 4);
+	hex2bin(bin, nonce, 4);
+	for (int k = 0; k < 4; k++) header[76 + k] = bin[3 - k];
+
+	algo->hash(hash, header);
+	diff = hash_diff((uchar*) hash) * algo->factor;
+	diff_to_target(target, (c->diff_prev < c->diff ? c->diff_prev : c->diff) / algo->factor);
+	if (!hash_below(hash, target)) {
+		stats.lowdiff++;
+		mlog("client %d low difficulty share %.4g, job %s nonce %s", (int) (c - clients), diff, job_id, nonce);
+		return "[23,\"Low difficulty share\",null]";
+	}
+	share_accepted(c, diff, true);
+	return NULL;
+}
+
+/* params: worker, job_id, ntime, nonce (xnonce2), solution */
+static const char *equihash_submit(struct mock_client *c, json_t *params)
+{
+	const char *job_id = json_string_value(json_array_get(params, 1));
+	const char *ntime = json_string_value(json_array_get(params, 2));
+	const char *nonce = json_string_value(json_array_get(params, 3));
+	const char *sol = json_string_value(json_array_get(params, 4));
+	const char *err;
+
+	if (!ntime || !nonce || !sol || strlen(ntime) != 8 ||
+	    strlen(nonce) != 2 * (32 - MOCK_XNONCE1_SIZE) || strlen(sol) != 2 * (3 + 1344)) {
+		stats.malformed++;
+		return "[20,\"Invalid submit\",null]";
+	}
+	err = share_precheck(c, job_find(job_id), fnv1a(fnv1a(fnv1a(0, job_id), nonce), sol) ^ c->xnonce1);
+	if (!err)
+		share_accepted(c, 0., false); // no equihash verifier here
+	return err;
+}
+
+/* params: id, job_id, nonce, result (hash claimed by the miner) */
+static const char *rpc2_submit(struct mock_client *c, json_t *params)
+{
+	const char *job_id = json_string_value(json_object_get(params, "job_id"));
+	const char *nonce = json_string_value(json_object_get(params, "nonce"));
+	const char *result = json_string_value(json_object_get(params, "result"));
+	uchar hash[32];
+	uint32_t claimed;
+	const char *err;
+
+	if (!nonce || strlen(nonce) != 8 || !hex2bin(hash, result, 32)) {
+		stats.malformed++;
+		return "{\"code\":-1,\"message\":\"Invalid submit\"}";
+	}
+	err = share_precheck(c, job_find(job_id), fnv1a(fnv1a(0, job_id), nonce) ^ c->xnonce1);
+	if (err) {
+		// rpc2 errors are objects
+		return strstr(err, "Duplicate") ? "{\"code\":-1,\"message\":\"Duplicate share\"}" :
+			"{\"code\":-1,\"message\":\"Block expired\"}";
+	}
+	claimed = hash[28] | (hash[29] << 8) | (hash[30] << 16) | ((uint32_t) hash[31] << 24);
+	if (claimed > (uint32_t) (UINT32_MAX / c->diff)) {
+		stats.lowdiff++;
+		return "{\"code\":-1,\"message\":\"Low difficulty share\"}";
+	}
+	share_accepted(c, 0., false);
+	return NULL;
+}
+
+static void client_login(struct mock_client *c)
+{
+	struct mock_job *j = job_current();
+	c->authorized = true;
+	c->vardiff_time = time(NULL);
+	c->vardiff_shares = 0;
+	if (algo->dialect != DIALECT_RPC2)
+		send_difficulty(c);
+	if (j && algo->dialect != DIALECT_RPC2)
+		send_job(c, j, true);
+}
+
+static void client_handle_line(struct mock_client *c, char *line)
+{
+	json_t *val, *id, *params;
+	json_error_t err;
+	const char *method, *error = NULL;
+	char xn1[2 * MOCK_XNONCE1_SIZE + 1], sid[16];
+
+	if (opt_protocol)
+		mlog("%d< %s", (int) (c - clients), line);
+
+	val = json_loads(line, 0, &err);
+	if (!val) {
+		stats.malformed++;
+		client_close(c, "invalid json");
+		return;
+	}
+	method = json_string_value(json_object_get(val, "method"));
+	id = json_object_get(val, "id");
+	params = json_object_get(val, "params");
+	bin2hex(xn1, (uchar*) &c->xnonce1, MOCK_XNONCE1_SIZE);
+	snprintf(sid, sizeof(sid), "%08x", c->xnonce1);
+
+	if (!method) {
+		; // answers to client.get_version...
+	} else if (algo->dialect == DIALECT_RPC2) {
+		if (!strcmp(method, "login") || !strcmp(method, "getjob")) {
+			struct mock_job *j = job_current();
+			if (!strcmp(method, "login")) {
+				json_t *res = json_pack("{s:s,s:s}", "id", sid, "status", "OK");
+				client_login(c);
+				if (j)
+					json_object_set_new(res, "job", rpc2_job(c, j));
+				client_reply(c, id, res, NULL);
+			} else {
+				client_reply(c, id, j ? rpc2_job(c, j) : NULL, NULL);
+			}
+		} else if (!strcmp(method, "submit") && json_is_object(params)) {
+			error = rpc2_submit(c, params);
+			client_reply(c, id, error ? NULL : json_pack("{s:s}", "status", "OK"), error);
+		} else if (!strcmp(method, "keepalived")) {
+			client_reply(c, id, json_pack("{s:s}", "status", "KEEPALIVED"), NULL);
+		} else {
+			client_reply(c, id, NULL, "{\"code\":-1,\"message\":\"Unknown method\"}");
+		}
+	} else if (!strcmp(method, "mining.subscribe")) {
+		c->subscribed = true;
+		if (algo->dialect == DIALECT_EQUIHASH)
+			client_reply(c, id, json_pack("[n,s]", xn1), NULL);
+		else
+			client_reply(c, id, json_pack("[[[s,s],[s,s]],s,i]", "mining.set_difficulty", sid,
+				"mining.notify", sid, xn1, opt_xnonce2), NULL);
+	} else if (!strcmp(method, "mining.authorize")) {
+		client_reply(c, id, json_true(), c->subscribed ? NULL : "[25,\"Not subscribed\",null]");
+		if (c->subscribed)
+			client_login(c);
+	} else if (!strcmp(method, "mining.extranonce.subscribe")) {
+		client_reply(c, id, json_true(), NULL);
+	} else if (!strcmp(method, "mining.configure") && algo->dialect == DIALECT_STRATUM) {
+		json_t *opts = json_array_get(params, 1);
+		const char *mask = json_string_value(json_object_get(opts, "version-rolling.mask"));
+		char vmask[16];
+		c->vr_mask = mask ? (uint32_t) strtoul(mask, NULL, 16) & MOCK_VR_MASK : 0;
+		snprintf(vmask, sizeof(vmask), "%08x", c->vr_mask);
+		client_reply(c, id, json_pack("{s:b,s:s}", "version-rolling", c->vr_mask != 0,
+			"version-rolling.mask", vmask), NULL);
+	} else if (!strcmp(method, "mining.suggest_difficulty")) {
+		double diff = json_number_value(json_array_get(params, 0));
+		client_reply(c, id, json_true(), NULL);
+		if (diff > 0. && c->authorized) {
+			c->diff = diff;
+			send_difficulty(c);
+			mlog("client %d suggested difficulty %.4g", (int) (c - clients), diff);
+		}
+	} else if (!strcmp(method, "mining.submit") && json_is_array(params)) {
+		if (algo->dialect == DIALECT_EQUIHASH)
+			error = equihash_submit(c, params);
+		else
+			error = stratum_submit(c, params);
+		client_reply(c, id, error ? json_false() : json_true(), error);
+	} else if (id && !json_is_null(id)) {
+		client_reply(c, id, NULL, "[20,\"Method not supported\",null]");
+	}
+	json_decref(val);
+}
+
+static void client_read_once(struct mock_client *c)
+{
+	char *line, *nl;
+	const size_t len = sizeof(c->buf) - 1 - c->len;
+	ssize_t n = c->ssl ? SSL_read(c->ssl, c->buf + c->len, (int) len) :
+		recv(c->sock, c->buf + c->len, len, 0);
+	if (n <= 0) {
+		client_close(c, "closed");
+		return;
+	}
+	c->len += (int) n;
+	c->buf[c->len] = '\0';
+	line = c->buf;
+	while (c->sock >= 0 && (nl = strchr(line, '\n')) != NULL) {
+		*nl = '\0';
+		if (nl > line && nl[-1] == '\r')
+			nl[-1] = '\0';
+		if (*line)
+			client_handle_line(c, line);
+		line = nl + 1;
+	}
+	if (c->sock < 0)
+		return;
+	c->len -= (int) (line - c->buf);
+	memmove(c->buf, line, c->len + 1);
+	if (c->len >= (int) sizeof(c->buf) - 1)
+		client_close(c, "line too long");
+}
+
+static void client_read(struct mock_client *c)
+{
+	// the decrypted bytes pending are not seen by select
+	do {
+		client_read_once(c);
+	} while (c->sock >= 0 && c->ssl && SSL_pending(c->ssl) > 0);
+}
+
+static void client_accept(int lsock)
+{
+	struct sockaddr_in cli;
+	socklen_t clisiz = sizeof(cli);
+	int sock = accept(lsock, (struct sockaddr*) &cli, &clisiz);
+	int n;
+
+	if (sock < 0)
+		return;
+	for (n = 0; n < MOCK_MAX_CLIENTS; n++)
+		if (clients[n].sock < 0)
+			break;
+	if (n == MOCK_MAX_CLIENTS) {
+		close(sock);
+		return;
+	}
+	memset(&clients[n], 0, sizeof(clients[n]));
+	clients[n].sock = sock;
+	clients[n].xnonce1 = ++session_count;
+	clients[n].diff = clients[n].diff_prev = opt_diff;
+	if (tls_ctx) {
+		// blocking handshake, limited
+		struct timeval tv = { 5, 0 };
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		clients[n].ssl = SSL_new(tls_ctx);
+		if (!clients[n].ssl || !SSL_set_fd(clients[n].ssl, sock) || SSL_accept(clients[n].ssl) <= 0) {
+			ERR_clear_error();
+			client_close(&clients[n], "tls handshake failed");
+			return;
+		}
+		if (SSL_session_reused(clients[n].ssl))
+			stats.resumed++;
+	}
+	stats.connects++;
+	mlog("client %d connected from %s%s", n, inet_ntoa(cli.sin_addr),
+		!clients[n].ssl ? "" : SSL_session_reused(clients[n].ssl) ? " (tls, resumed)" : " (tls)");
+}
+
+/* scale the difficulty to a share every opt_vardiff seconds */
+static void vardiff_check(struct mock_client *c, time_t now)
+{
+	const int period = opt_vardiff * 8 > 60 ? opt_vardiff * 8 : 60;
+	double expected, ratio;
+
+	if (!c->authorized || now < c->vardiff_time + period)
+		return;
+	expected = (double) (now - c->vardiff_time) / opt_vardiff;
+	ratio = c->vardiff_shares / expected;
+	c->vardiff_time = now;
+	c->vardiff_shares = 0;
+	if (ratio > 0.8 && ratio < 1.25)
+		return;
+	ratio = ratio < 0.25 ? 0.25 : (ratio > 4. ? 4. : ratio);
+	c->diff *= ratio;
+	if (algo->dialect == DIALECT_RPC2) {
+		struct mock_job *j = job_current();
+		if (j) send_job(c, j, false);
+	} else {
+		send_difficulty(c);
+	}
+	mlog("client %d vardiff %.4g", (int) (c - clients), c->diff);
+}
+
+static void reconnect_all(bool notice)
+{
+	for (int n = 0; n < MOCK_MAX_CLIENTS; n++) {
+		struct mock_client *c = &clients[n];
+		struct sockaddr_in addr;
+		socklen_t len = sizeof(addr);
+		char s[128];
+		if (c->sock < 0)
+			continue;
+		if (!notice || algo->dialect == DIALECT_RPC2) {
+			client_close(c, "dropped");
+			continue;
+		}
+		// to the address the client connected to
+		getsockname(c->sock, (struct sockaddr*) &addr, &len);
+		snprintf(s, sizeof(s), "{\"id\":null,\"method\":\"client.reconnect\",\"params\":[\"%s\",%d,0]}",
+			inet_ntoa(addr.sin_addr), opt_port);
+		client_send(c, s);
+	}
+}
+
+static void print_stats()
+{
+	int n = 0;
+	for (int i = 0; i < MOCK_MAX_CLIENTS; i++)
+		if (clients[i].sock >= 0) n++;
+	mlog("%d clients (%u connects, %u tls resumed), %u jobs, shares: %u valid, %u unchecked, %u stale, "
+		"%u unknown job, %u dup, %u low diff, %u malformed, best %.4g", n, stats.connects,
+		stats.resumed, stats.jobs, stats.valid, stats.unchecked, stats.stale, stats.unknown, stats.dup,
+		stats.lowdiff, stats.malformed, stats.best);
+}
+
+static void signal_handler(int sig)
+{
+	abort_flag = true;
+}
+
+static void usage(int code)
+{
+	printf("Usage: mockpool [OPTIONS]\n\
+  -a ALGO   sha256d, sha256t, blake, blakecoin, vanilla, keccak (shares verified),\n\
+            equihash, cryptonight, cryptolight (rpc2), other: not verified\n\
+  -p PORT   listen port (default 3333)\n\
+  -d DIFF   pool difficulty (default 1)\n\
+  -n SECS   seconds between jobs (default 30)\n\
+  -c N      one job in N is a new block (default 1)\n\
+  -x N      extranonce2 size (default 4)\n\
+  -l MS     latency added to the server messages\n\
+  -V SECS   vardiff, target seconds between shares of a client\n\
+  -r SECS   ask the clients to reconnect every SECS\n\
+  -k SECS   drop the connections every SECS\n\
+  -t SECS   run time, then exit with the shares summary\n\
+  -s PEM    tls (stratum+ssl), certificate and private key file\n\
+  -P        protocol dump\n");
+	exit(code);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *algo_name = "sha256d";
+	struct sockaddr_in serv;
+	uint64_t next_job, next_reconnect, next_drop, next_stats, end_time;
+	int lsock, opt, optval = 1;
+
+	while ((opt = getopt(argc, argv, "a:p:d:n:c:x:l:V:r:k:t:s:Ph")) != -1) {
+		switch (opt) {
+		case 'a': algo_name = optarg; break;
+		case 'p': opt_port = atoi(optarg); break;
+		case 'd': opt_diff = atof(optarg); break;
+		case 'n': opt_notify = atof(optarg); break;
+		case 'c': opt_clean = atoi(optarg); break;
+		case 'x': opt_xnonce2 = atoi(optarg); break;
+		case 'l': opt_latency = atoi(optarg); break;
+		case 'V': opt_vardiff = atoi(optarg); break;
+		case 'r': opt_reconnect = atoi(optarg); break;
+		case 'k': opt_drop = atoi(optarg); break;
+		case 't': opt_time_limit = atoi(optarg); break;
+		case 's': opt_tls = optarg; break;
+		case 'P': opt_protocol = true; break;
+		case 'h': usage(0);
+		default: usage(1);
+		}
+	}
+	if (opt_port <= 0 || opt_diff <= 0. || opt_notify <= 0. || opt_xnonce2 < 2 || opt_xnonce2 > 16)
+		usage(1);
+
+	for (algo = mock_algos; algo->name; algo++)
+		if (!strcasecmp(algo->name, algo_name))
+			break;
+	if (!algo->name)
+		mlog("algo %s: shares will not be verified", algo_name);
+
+	if (opt_tls) {
+		tls_ctx = SSL_CTX_new(SSLv23_server_method());
+		if (!tls_ctx || SSL_CTX_use_certificate_chain_file(tls_ctx, opt_tls) != 1 ||
+		    SSL_CTX_use_PrivateKey_file(tls_ctx, opt_tls, SSL_FILETYPE_PEM) != 1) {
+			mlog("unable to load the tls certificate and key from %s", opt_tls);
+			return 1;
+		}
+		// sessions resumed from the server cache or the tickets
+		SSL_CTX_set_session_id_context(tls_ctx, (const uchar*) "mockpool", 8);
+		SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_SERVER);
+	}
+
+	srand((unsigned int) time(NULL));
+	for (int n = 0; n < MOCK_MAX_CLIENTS; n++)
+		clients[n].sock = -1;
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	lsock = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+	memset(&serv, 0, sizeof(serv));
+	serv.sin_family = AF_INET;
+	serv.sin_addr.s_addr = htonl(INADDR_ANY);
+	serv.sin_port = htons((unsigned short) opt_port);
+	if (lsock < 0 || bind(lsock, (struct sockaddr*) &serv, sizeof(serv)) < 0 || listen(lsock, 16) < 0) {
+		perror("mockpool");
+		return 1;
+	}
+	mlog("mock %s pool listening on port %d, diff %g, a job every %.1fs", algo_name,
+		opt_port, opt_diff, opt_notify);
+
+	job_new();
+	next_job = now_ms() + (uint64_t) (opt_notify * 1000);
+	next_reconnect = opt_reconnect ? now_ms() + opt_reconnect * 1000ULL : UINT64_MAX;
+	next_drop = opt_drop ? now_ms() + opt_drop * 1000ULL : UINT64_MAX;
+	next_stats = now_ms() + 60000;
+	end_time = opt_time_limit ? now_ms() + opt_time_limit * 1000ULL : UINT64_MAX;
+
+	while (!abort_flag) {
+		uint64_t now = now_ms(), wake = next_job;
+		struct timeval tv;
+		fd_set rd;
+		int maxfd = lsock;
+
+		if (now >= end_time)
+			break;
+		if (now >= next_job) {
+			job_new();
+			next_job += (uint64_t) (opt_notify * 1000);
+		}
+		if (now >= next_reconnect) {
+			mlog("reconnecting the clients");
+			reconnect_all(true);
+			next_reconnect += opt_reconnect * 1000ULL;
+		}
+		if (now >= next_drop) {
+			mlog("dropping the connections");
+			reconnect_all(false);
+			next_drop += opt_drop * 1000ULL;
+		}
+		if (now >= next_stats) {
+			print_stats();
+			next_stats += 60000;
+		}
+
+		FD_ZERO(&rd);
+		FD_SET(lsock, &rd);
+		for (int n = 0; n < MOCK_MAX_CLIENTS; n++) {
+			struct mock_client *c = &clients[n];
+			if (c->sock < 0)
+				continue;
+			if (opt_vardiff)
+				vardiff_check(c, (time_t) (now / 1000));
+			client_flush(c, now);
+			if (c->sock < 0)
+				continue;
+			if (c->out && c->out->due < wake)
+				wake = c->out->due;
+			FD_SET(c->sock, &rd);
+			if (c->sock > maxfd)
+				maxfd = c->sock;
+		}
+		if (next_reconnect < wake) wake = next_reconnect;
+		if (next_drop < wake) wake = next_drop;
+		if (next_stats < wake) wake = next_stats;
+		if (end_time < wake) wake = end_time;
+		wake = wake > now ? wake - now : 0;
+		tv.tv_sec = (time_t) (wake / 1000);
+		tv.tv_usec = (suseconds_t) (wake % 1000) * 1000;
+
+		if (select(maxfd + 1, &rd, NULL, NULL, &tv) <= 0)
+			continue;
+		if (FD_ISSET(lsock, &rd))
+			client_accept(lsock);
+		for (int n = 0; n < MOCK_MAX_CLIENTS; n++) {
+			if (clients[n].sock >= 0 && FD_ISSET(clients[n].sock, &rd))
+				client_read(&clients[n]);
+		}
+	}
+
+	print_stats();
+	for (int n = 0; n < MOCK_MAX_CLIENTS; n++)
+		client_close(&clients[n], "exit");
+	close(lsock);
+	if (tls_ctx)
+		SSL_CTX_free(tls_ctx);
+
+	if (opt_time_limit)
+		return (stats.valid + stats.unchecked > 0 && !stats.lowdiff && !stats.malformed) ? 0 : 1;
+	return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * Nonce range scheduler
+ *
+ * Chunks are sized from the measured thread speed and a target batch
+ * time. The nonce space of a work shared by all threads (same header) is
+ * split by speed, a thread done with its part takes the upper half of
+ * the largest part left to another thread. The last shared works are
+ * kept, so the threads still on a previous header after a notify do not
+ * restart its split. Works with a header private to a thread (see
+ * thr_gen_work) give it the whole nonce space.
+ */
+#include <stdlib.h>
+#include <memory.h>
+
+#include "miner.h"
+
+#define SCHED_BATCH_TIME 5.0  /* seconds, max scan time of a chunk */
+#define SCHED_MIN_TIME   0.25 /* smallest chunk, way above a gpu launch */
+#define NONCE_SPACE 0x100000000ULL
+#define SHARED_JOBS 4 /* current and previous shared works */
+
+struct nonce_part {
+	uint64_t cur;
+	uint64_t end;
+};
+
+struct shared_job {
+	uint64_t key;
+	uint64_t allocated;
+	uint32_t gen; // of the split, the oldest job is replaced
+	struct nonce_part part[MAX_GPUS];
+};
+
+static struct shared_job shared_jobs[SHARED_JOBS] = { 0 };
+static uint32_t shared_gen = 0;
+
+static struct {
+	uint64_t key;
+	struct nonce_part part;
+	// last chunk handed out, resumed after a share or a restart
+	uint64_t chunk_key;
+	uint64_t chunk_first;
+	uint64_t chunk_end;
+	double rate;
+} thr_sched[MAX_GPUS] = { 0 };
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* header identity, data up to the nonce (fnv-1a) */
+uint64_t nonce_sched_key(const void *header, int len)
+{
+	const uchar *p = (const uchar*) header;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (int i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* measured hashes per second of a thread (not the displayed rate) */
+void nonce_sched_rate(int thr_id, double hashrate)
+{
+	pthread_mutex_lock(&sched_lock);
+	if (thr_sched[thr_id].rate > 0.)
+		thr_sched[thr_id].rate = 0.75 * thr_sched[thr_id].rate + 0.25 * hashrate;
+	else
+		thr_sched[thr_id].rate = hashrate;
+	pthread_mutex_unlock(&sched_lock);
+}
+
+// new shared work, split the nonce space by speed
+static void shared_job_reset(struct shared_job *job, uint64_t key)
+{
+	double total = 0., pos = 0.;
+	int n;
+
+	if (job->key && opt_debug)
+		applog(LOG_DEBUG, "nonce scheduler: %.1f%% of previous work allocated",
+			(100.0 * job->allocated) / NONCE_SPACE);
+
+	for (n = 0; n < opt_n_threads; n++) {
+		if (thr_sched[n].rate <= 0.) {
+			total = 0.;
+			break;
+		}
+		total += thr_sched[n].rate;
+	}
+	for (n = 0; n < opt_n_threads; n++) {
+		job->part[n].cur = (uint64_t) pos;
+		pos += total > 0. ? NONCE_SPACE * thr_sched[n].rate / total : (double) NONCE_SPACE / opt_n_threads;
+		job->part[n].end = (n == opt_n_threads - 1) ? NONCE_SPACE : (uint64_t) pos;
+	}
+	job->key = key;
+	job->allocated = 0;
+	job->gen = ++shared_gen;
+}
+
+// the kept job of this header, or the oldest one split again
+static struct shared_job *shared_job_get(uint64_t key)
+{
+	struct shared_job *job = &shared_jobs[0];
+	for (int i = 0; i < SHARED_JOBS; i++) {
+		if (shared_jobs[i].gen && shared_jobs[i].key == key)
+			return &shared_jobs[i];
+		if (shared_jobs[i].gen < job->gen)
+			job = &shared_jobs[i];
+	}
+	shared_job_reset(job, key);
+	return job;
+}
+
+// take the upper half of the largest part left to another thread
+static bool shared_job_steal(struct shared_job *job, int thr_id, uint64_t min_chunk)
+{
+	uint64_t best = 0, mid;
+	int victim = -1;
+
+	for (int n = 0; n < opt_n_threads; n++) {
+		struct nonce_part *p = &job->part[n];
+		if (n != thr_id && p->end - p->cur > best) {
+			best = p->end - p->cur;
+			victim = n;
+		}
+	}
+	if (victim < 0 || best < 2 * min_chunk)
+		return false;
+
+	mid = job->part[victim].cur + best / 2;
+	job->part[thr_id].cur = mid;
+	job->part[thr_id].end = job->part[victim].end;
+	job->part[victim].end = mid;
+	if (opt_debug)
+		gpulog(LOG_DEBUG, thr_id, "took nonces %08x-%08x from thread %d", (uint32_t) mid,
+			(uint32_t) (job->part[thr_id].end - 1), victim);
+	return true;
+}
+
+/**
+ * Next nonce chunk of a work, false when its nonce space is covered.
+ * first and last are both scanned, the next chunk starts at last + 1.
+ * cursor is the scan position in the previous chunk, resumed if the work
+ * did not change (a cursor wrapped past 0xffffffff is not resumed). max_secs limits the chunk duration, first_chunk is
+ * used until the thread speed is known (it sizes the scanhash buffers).
+ */
+bool nonce_sched_next(int thr_id, uint64_t key, bool shared, uint32_t cursor,
+	double max_secs, uint64_t first_chunk, uint32_t *first, uint32_t *last)
+{
+	struct shared_job *job = NULL;
+	struct nonce_part *part;
+	uint64_t chunk, min_chunk;
+	bool ret = true;
+
+	pthread_mutex_lock(&sched_lock);
+
+	if (thr_sched[thr_id].rate > 0.)
+		min_chunk = max((uint64_t) (thr_sched[thr_id].rate * SCHED_MIN_TIME), (uint64_t) 0x10000);
+	else
+		min_chunk = first_chunk;
+
+	// interrupted chunk (share found, restart), finish it
+	if (thr_sched[thr_id].chunk_key == key && cursor >= thr_sched[thr_id].chunk_first &&
+	    cursor < thr_sched[thr_id].chunk_end && thr_sched[thr_id].chunk_end - cursor >= min_chunk) {
+		*first = cursor;
+		*last = (uint32_t) (thr_sched[thr_id].chunk_end - 1);
+		goto out;
+	}
+
+	if (shared) {
+		job = shared_job_get(key);
+		part = &job->part[thr_id];
+		if (part->end - part->cur < min_chunk && !shared_job_steal(job, thr_id, min_chunk)) {
+			ret = false;
+			goto out;
+		}
+	} else {
+		part = &thr_sched[thr_id].part;
+		if (thr_sched[thr_id].key != key) {
+			thr_sched[thr_id].key = key;
+			part->cur = 0;
+			part->end = NONCE_SPACE;
+		}
+		if (part->end - part->cur < min_chunk) {
+			ret = false;
+			goto out;
+		}
+	}
+
+	chunk = (uint64_t) (thr_sched[thr_id].rate * min(max_secs, SCHED_BATCH_TIME));
+	chunk = max(chunk, min_chunk);
+	// no small range left at the end of a part
+	if (part->end - part->cur < chunk + min_chunk)
+		chunk = part->end - part->cur;
+
+	// part->end is at most NONCE_SPACE, last stops at 0xffffffff
+	*first = (uint32_t) part->cur;
+	*last = (uint32_t) (part->cur + chunk - 1);
+	thr_sched[thr_id].chunk_first = part->cur;
+	part->cur += chunk;
+	if (job)
+		job->allocated += chunk;
+
+	thr_sched[thr_id].chunk_key = key;
+	thr_sched[thr_id].chunk_end = part->cur;
+out:
+	pthread_mutex_unlock(&sched_lock);
+	return ret;
+}
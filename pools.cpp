@@ -31,7 +31,7 @@ extern struct work _ALIGN(64) g_work;
 extern struct stratum_ctx stratum;
 extern pthread_mutex_t stratum_work_lock;
 extern pthread_mutex_t stats_lock;
-extern bool get_work(struct thr_info *thr, struct work *work);
+extern bool get_work_async();
 extern bool stratum_need_reset;
 extern time_t firstwork_time;
 
@@ -230,13 +230,17 @@ bool pool_switch(int thr_id, int pooln)
 	}
 
 	if (prevn != cur_pooln) {
+		// connected and with a job, unless a previous switch is not done
+		bool standby = want_stratum && !pool_is_switching && pool_standby_take(cur_pooln);
 
 		pool_switch_count++;
 		net_diff = 0;
+		g_work_write_lock();
 		g_work_time = 0;
 		g_work.data[0] = 0;
+		g_work_write_unlock();
 		pool_is_switching = true;
-		stratum_need_reset = true;
+		stratum_need_reset = !standby;
 		// used to get the pool uptime
 		firstwork_time = time(NULL);
 		restart_threads();
@@ -259,8 +263,8 @@ bool pool_switch(int thr_id, int pooln)
 
 			// unlock the stratum thread
 			tq_push(thr_info[stratum_thr_id].q, strdup(rpc_url));
-			applog(LOG_BLUE, "Switch to stratum pool %d: %s", cur_pooln,
-				strlen(p->name) ? p->name : p->short_url);
+			applog(LOG_BLUE, "Switch to stratum pool %d: %s%s", cur_pooln,
+				strlen(p->name) ? p->name : p->short_url, standby ? " (standby)" : "");
 		} else {
 			applog(LOG_BLUE, "Switch to pool %d: %s", cur_pooln,
 				strlen(p->name) ? p->name : p->short_url);
@@ -272,8 +276,10 @@ bool pool_switch(int thr_id, int pooln)
 			pthread_mutex_lock(&stratum_work_lock);
 			// will issue a lp_url request to unlock the longpoll thread
 			have_longpoll = false;
-			get_work(&thr_info[0], &g_work);
 			pthread_mutex_unlock(&stratum_work_lock);
+			// fetched by the workio thread and published under the g_work write
+			// lock, the miner thread queues keep their single consumer
+			get_work_async();
 		}
 
 	}
@@ -284,6 +290,117 @@ bool pool_switch(int thr_id, int pooln)
 	return true;
 }
 
+/* latency probes and stale risk */
+
+bool opt_pool_select_latency = false;
+
+#define LATENCY_BLOCKS 8
+static struct {
+	uchar prevhash[32];
+	struct timeval tv_first;
+	uint32_t seen; // pools mask
+} latency_blocks[LATENCY_BLOCKS] = { 0 };
+static int latency_block_next = 0;
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double msec_since(const struct timeval *tv_start)
+{
+	struct timeval tv_now, diff, start = *tv_start;
+	gettimeofday(&tv_now, NULL);
+	timeval_subtract(&diff, &tv_now, &start);
+	return 1000.0 * diff.tv_sec + 0.001 * diff.tv_usec;
+}
+
+// connected, subscribed and authorized
+void pool_latency_connect(int pooln, const struct timeval *tv_start)
+{
+	pools[pooln].connect_msec = (uint32_t) msec_since(tv_start);
+}
+
+/* a job received, its delay is measured against the first pool which
+ * notified the same block (standby pools are connected in parallel).
+ * The first job after a connect is the current block, sent whenever
+ * the pool was joined, so it is not a delay sample */
+void pool_latency_notify(int pooln, const uchar *prevhash, bool first)
+{
+	struct pool_infos *p = &pools[pooln];
+	double delay = 0.;
+	int i;
+
+	pthread_mutex_lock(&latency_lock);
+	for (i = 0; i < LATENCY_BLOCKS; i++) {
+		if (!memcmp(latency_blocks[i].prevhash, prevhash, 32))
+			break;
+	}
+	if (i == LATENCY_BLOCKS) {
+		i = latency_block_next;
+		latency_block_next = (latency_block_next + 1) % LATENCY_BLOCKS;
+		memcpy(latency_blocks[i].prevhash, prevhash, 32);
+		gettimeofday(&latency_blocks[i].tv_first, NULL);
+		latency_blocks[i].seen = 0;
+	} else if (latency_blocks[i].seen & (1U << pooln)) {
+		// same block, new job
+		pthread_mutex_unlock(&latency_lock);
+		return;
+	} else if (!first) {
+		delay = msec_since(&latency_blocks[i].tv_first);
+	}
+	latency_blocks[i].seen |= (1U << pooln);
+	if (!first) {
+		p->notify_delay = p->notify_count ? 0.75 * p->notify_delay + 0.25 * delay : delay;
+		p->notify_count++;
+	}
+	pthread_mutex_unlock(&latency_lock);
+}
+
+// submit round trip time
+void pool_latency_answer(int pooln, uint32_t msec)
+{
+	static const uint32_t bounds[POOL_RTT_BUCKETS - 1] = { 50, 100, 200, 500, 1000 };
+	struct pool_infos *p = &pools[pooln];
+	uint32_t answers = 0;
+	int b;
+
+	for (b = 0; b < POOL_RTT_BUCKETS; b++)
+		answers += p->answer_hist[b];
+	for (b = 0; b < POOL_RTT_BUCKETS - 1; b++)
+		if (msec < bounds[b]) break;
+	p->answer_hist[b]++;
+	p->answer_avg = answers ? 0.75 * p->answer_avg + 0.25 * msec : (double) msec;
+}
+
+/**
+ * Expected delay (ms) before a share is seen by the pool on a new block:
+ * the notify delay, then half a submit round trip. -1 if not known yet.
+ */
+double pool_stale_risk(int pooln)
+{
+	struct pool_infos *p = &pools[pooln];
+	if (p->notify_count < 3)
+		return -1.;
+	return p->notify_delay + (p->answer_avg > 0. ? p->answer_avg : p->connect_msec) / 2.;
+}
+
+// usable pool (other than the current one) with the lowest stale risk, or -1
+int pool_get_lowest_risk()
+{
+	double best = 0.;
+	int pooln = -1;
+	for (int i = 0; i < num_pools; i++) {
+		struct pool_infos *p = &pools[i];
+		double risk = pool_stale_risk(i);
+		if (i == cur_pooln || risk < 0.)
+			continue;
+		if (!(p->status & POOL_ST_VALID) || (p->status & (POOL_ST_DISABLED | POOL_ST_REMOVED)))
+			continue;
+		if (pooln < 0 || risk < best) {
+			best = risk;
+			pooln = i;
+		}
+	}
+	return pooln;
+}
+
 // search available pool
 int pool_get_first_valid(int startfrom)
 {
@@ -306,7 +423,14 @@ int pool_get_first_valid(int startfrom)
 bool pool_switch_next(int thr_id)
 {
 	if (num_pools > 1) {
-		int pooln = pool_get_first_valid(cur_pooln+1);
+		int pooln = -1;
+		if (opt_pool_select_latency)
+			pooln = pool_get_lowest_risk();
+		// else a pool already connected, or the next one
+		if (pooln < 0)
+			pooln = pool_standby_next(cur_pooln+1);
+		if (pooln < 0)
+			pooln = pool_get_first_valid(cur_pooln+1);
 		return pool_switch(thr_id, pooln);
 	} else {
 		// no switch possible
@@ -0,0 +1,499 @@
+/**
+ * Local stratum endpoint (--stratum-proxy)
+ *
+ * Downstream miners share the upstream stratum connection: each client
+ * gets the pool extranonce1 extended with one extranonce2 byte (its slot
+ * number), this byte stays 0 for the local miner threads. Pool jobs are
+ * forwarded as received, the client shares are submitted upstream with
+ * the pool credentials and their answers routed back by json-rpc id.
+ */
+#ifdef WIN32
+# define  _WINSOCK_DEPRECATED_NO_WARNINGS
+# include <winsock2.h>
+#endif
+
+#include <stdlib.h>
+#include <memory.h>
+
+#include "miner.h"
+#include "algos.h"
+
+#ifndef WIN32
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# define SOCKETTYPE long
+# define SOCKETFAIL(a) ((a) < 0)
+# define INVSOCK -1 /* INVALID_SOCKET */
+# define CLOSESOCKET close
+#else
+# define SOCKETTYPE SOCKET
+# define SOCKETFAIL(a) ((a) == SOCKET_ERROR)
+# define INVSOCK INVALID_SOCKET
+# define CLOSESOCKET closesocket
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define PROXY_MAX_CLIENTS 64 /* client slots, xnonce2 prefixes 01..40 */
+#define PROXY_LINE_MAX 4096
+
+// current stratum...
+extern struct stratum_ctx stratum;
+
+char *opt_stratum_proxy = NULL;
+
+static struct proxy_client {
+	SOCKETTYPE sock; // INVSOCK if the slot is free
+	uint32_t seq;    // connection number, late answers to a previous client are dropped
+	bool drop;       // to be closed by the proxy thread
+	bool subscribed;
+	char addr[24];
+	char buf[PROXY_LINE_MAX];
+	int len;
+	uint32_t accepted;
+	uint32_t rejected;
+} clients[PROXY_MAX_CLIENTS];
+
+static struct {
+	char xnonce1[2 * 32 + 1]; // hex, empty if not subscribed
+	int xnonce2_size;
+	int pooln;
+	char *notify;     // last job and difficulty, for new clients
+	char *difficulty;
+} upstream = { 0 };
+
+static SOCKETTYPE proxy_sock = INVSOCK;
+static uint32_t client_seq = 0;
+
+static pthread_mutex_t proxy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// called with proxy_lock held, the socket is not blocking: a client too
+// slow to read its jobs is dropped
+static void client_send(struct proxy_client *c, const char *s, size_t len)
+{
+	if (c->sock == INVSOCK || c->drop)
+		return;
+	if (send(c->sock, s, (int) len, MSG_NOSIGNAL) != (int) len)
+		c->drop = true;
+}
+
+static void client_reply(int slot, json_t *id_val, const char *result, const char *error)
+{
+	char *id = id_val ? json_dumps(id_val, JSON_COMPACT | JSON_ENCODE_ANY) : NULL;
+	size_t len = strlen(result) + strlen(error) + (id ? strlen(id) : 4) + 32;
+	char *s = (char*) malloc(len);
+	if (s) {
+		snprintf(s, len, "{\"id\":%s,\"result\":%s,\"error\":%s}\n", id ? id : "null", result, error);
+		if (opt_protocol)
+			applog(LOG_DEBUG, "proxy %d> %s", slot + 1, s);
+		pthread_mutex_lock(&proxy_lock);
+		client_send(&clients[slot], s, strlen(s));
+		pthread_mutex_unlock(&proxy_lock);
+		free(s);
+	}
+	free(id);
+}
+
+static void client_subscribe(int slot, json_t *id_val)
+{
+	char result[256];
+
+	pthread_mutex_lock(&proxy_lock);
+	if (!upstream.xnonce1[0] || upstream.xnonce2_size < 2) {
+		pthread_mutex_unlock(&proxy_lock);
+		client_reply(slot, id_val, "null", "[20,\"upstream pool not ready\",null]");
+		return;
+	}
+	snprintf(result, sizeof(result), "[[[\"mining.set_difficulty\",\"%08x\"],[\"mining.notify\",\"%08x\"]],"
+		"\"%s%02x\",%d]", clients[slot].seq, clients[slot].seq, upstream.xnonce1, slot + 1,
+		upstream.xnonce2_size - 1);
+	clients[slot].subscribed = true;
+	pthread_mutex_unlock(&proxy_lock);
+
+	client_reply(slot, id_val, result, "null");
+}
+
+// the current job follows the login answer
+static void client_authorize(int slot, json_t *id_val)
+{
+	struct proxy_client *c = &clients[slot];
+
+	client_reply(slot, id_val, "true", "null");
+
+	pthread_mutex_lock(&proxy_lock);
+	if (c->subscribed && upstream.difficulty)
+		client_send(c, upstream.difficulty, strlen(upstream.difficulty));
+	if (c->subscribed && upstream.notify)
+		client_send(c, upstream.notify, strlen(upstream.notify));
+	pthread_mutex_unlock(&proxy_lock);
+}
+
+/* params: worker, job_id, extranonce2, ntime, nonce[, ...] */
+static void client_submit(int slot, json_t *val, json_t *id_val, json_t *params)
+{
+	struct proxy_client *c = &clients[slot];
+	const char *job_id = json_string_value(json_array_get(params, 1));
+	const char *xnonce2 = json_string_value(json_array_get(params, 2));
+	const char *nonce = json_string_value(json_array_get(params, 4));
+	char *req_id = id_val ? json_dumps(id_val, JSON_COMPACT | JSON_ENCODE_ANY) : NULL;
+	char *s = NULL, xnonce2_full[2 * 32 + 1];
+	int pooln, xn2_size;
+	uint32_t share_id;
+
+	pthread_mutex_lock(&proxy_lock);
+	pooln = upstream.pooln;
+	xn2_size = upstream.xnonce2_size;
+	pthread_mutex_unlock(&proxy_lock);
+
+	if (!c->subscribed || !job_id || !xnonce2 || !nonce || !req_id ||
+	    strlen(req_id) >= sizeof(((struct share_inflight*)0)->proxy_id) ||
+	    (int) strlen(xnonce2) != 2 * (xn2_size - 1) || xn2_size * 2 >= (int) sizeof(xnonce2_full)) {
+		client_reply(slot, id_val, "false", "[20,\"invalid submit\",null]");
+		goto out;
+	}
+	snprintf(xnonce2_full, sizeof(xnonce2_full), "%02x%s", slot + 1, xnonce2);
+
+	share_id = share_inflight_add_proxy(pooln, job_id, (uint32_t) strtoul(nonce, NULL, 16),
+		slot + 1, c->seq, req_id);
+
+	// same request, with the pool user and the full extranonce2
+	json_array_set_new(params, 0, json_string(pools[pooln].user));
+	json_array_set_new(params, 2, json_string(xnonce2_full));
+	json_object_set_new(val, "id", json_integer(share_id));
+	s = json_dumps(val, JSON_COMPACT);
+
+	if (!s || !stratum.curl || stratum.pooln != pooln || !stratum_send_line(&stratum, s)) {
+		share_inflight_done(share_id, NULL);
+		client_reply(slot, id_val, "false", "[20,\"upstream pool not connected\",null]");
+	}
+out:
+	free(req_id);
+	free(s);
+}
+
+static void client_handle_line(int slot, char *line)
+{
+	json_t *val, *id_val, *params;
+	json_error_t err;
+	const char *method;
+
+	if (opt_protocol)
+		applog(LOG_DEBUG, "proxy %d< %s", slot + 1, line);
+
+	val = JSON_LOADS(line, &err);
+	if (!val) {
+		applog(LOG_WARNING, "proxy: client %d JSON decode failed(%d): %s", slot + 1, err.line, err.text);
+		pthread_mutex_lock(&proxy_lock);
+		clients[slot].drop = true;
+		pthread_mutex_unlock(&proxy_lock);
+		return;
+	}
+	method = json_string_value(json_object_get(val, "method"));
+	id_val = json_object_get(val, "id");
+	params = json_object_get(val, "params");
+
+	if (!method)
+		; // answers to client.* methods, none are sent
+	else if (!strcasecmp(method, "mining.submit") && json_is_array(params))
+		client_submit(slot, val, id_val, params);
+	else if (!strcasecmp(method, "mining.subscribe"))
+		client_subscribe(slot, id_val);
+	else if (!strcasecmp(method, "mining.authorize"))
+		client_authorize(slot, id_val);
+	else if (!strcasecmp(method, "mining.extranonce.subscribe"))
+		client_reply(slot, id_val, "false", "null"); // extranonce1 is fixed per session
+	else if (id_val && !json_is_null(id_val))
+		client_reply(slot, id_val, "null", "[20,\"method not supported\",null]");
+
+	json_decref(val);
+}
+
+static void client_read(int slot)
+{
+	struct proxy_client *c = &clients[slot];
+	char *line, *nl;
+	int n;
+
+	n = recv(c->sock, c->buf + c->len, (int) sizeof(c->buf) - 1 - c->len, 0);
+	if (n <= 0) {
+		pthread_mutex_lock(&proxy_lock);
+		c->drop = true;
+		pthread_mutex_unlock(&proxy_lock);
+		return;
+	}
+	c->len += n;
+	c->buf[c->len] = '\0';
+
+	line = c->buf;
+	while ((nl = strchr(line, '\n')) != NULL) {
+		*nl = '\0';
+		if (nl > line && nl[-1] == '\r')
+			nl[-1] = '\0';
+		if (*line)
+			client_handle_line(slot, line);
+		line = nl + 1;
+	}
+	c->len -= (int) (line - c->buf);
+	memmove(c->buf, line, c->len + 1);
+
+	if (c->len >= (int) sizeof(c->buf) - 1) {
+		applog(LOG_WARNING, "proxy: client %d line too long", slot + 1);
+		pthread_mutex_lock(&proxy_lock);
+		c->drop = true;
+		pthread_mutex_unlock(&proxy_lock);
+	}
+}
+
+static void client_accept()
+{
+	struct sockaddr_in cli;
+	socklen_t clisiz = sizeof(cli);
+	SOCKETTYPE sock;
+	int slot;
+
+	sock = accept(proxy_sock, (struct sockaddr*) (&cli), &clisiz);
+	if (SOCKETFAIL(sock))
+		return;
+
+	for (slot = 0; slot < PROXY_MAX_CLIENTS; slot++)
+		if (clients[slot].sock == INVSOCK)
+			break;
+	if (slot == PROXY_MAX_CLIENTS) {
+		applog(LOG_WARNING, "proxy: too many clients, %s refused", inet_ntoa(cli.sin_addr));
+		CLOSESOCKET(sock);
+		return;
+	}
+#ifdef WIN32
+	u_long nonblock = 1;
+	ioctlsocket(sock, FIONBIO, &nonblock);
+#else
+	fcntl((int) sock, F_SETFL, fcntl((int) sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	pthread_mutex_lock(&proxy_lock);
+	clients[slot].sock = sock;
+	clients[slot].seq = ++client_seq;
+	clients[slot].drop = false;
+	clients[slot].subscribed = false;
+	clients[slot].len = 0;
+	clients[slot].accepted = clients[slot].rejected = 0;
+	snprintf(clients[slot].addr, sizeof(clients[slot].addr), "%s", inet_ntoa(cli.sin_addr));
+	pthread_mutex_unlock(&proxy_lock);
+
+	if (!opt_quiet)
+		applog(LOG_INFO, "proxy: client %d connected from %s", slot + 1, clients[slot].addr);
+}
+
+static void *proxy_thread(void *userdata)
+{
+	while (!abort_flag) {
+		struct timeval tv = { 1, 0 };
+		SOCKETTYPE maxfd = proxy_sock;
+		fd_set rd;
+		int slot;
+
+		FD_ZERO(&rd);
+		FD_SET(proxy_sock, &rd);
+		pthread_mutex_lock(&proxy_lock);
+		for (slot = 0; slot < PROXY_MAX_CLIENTS; slot++) {
+			struct proxy_client *c = &clients[slot];
+			if (c->sock == INVSOCK)
+				continue;
+			if (c->drop) {
+				CLOSESOCKET(c->sock);
+				c->sock = INVSOCK;
+				if (!opt_quiet)
+					applog(LOG_INFO, "proxy: client %d disconnected, %u/%u shares accepted",
+						slot + 1, c->accepted, c->accepted + c->rejected);
+				continue;
+			}
+			FD_SET(c->sock, &rd);
+			maxfd = max(maxfd, c->sock);
+		}
+		pthread_mutex_unlock(&proxy_lock);
+
+		if (select((int) maxfd + 1, &rd, NULL, NULL, &tv) <= 0)
+			continue;
+
+		if (FD_ISSET(proxy_sock, &rd))
+			client_accept();
+		// only this thread closes the sockets
+		for (slot = 0; slot < PROXY_MAX_CLIENTS; slot++) {
+			struct proxy_client *c = &clients[slot];
+			if (c->sock != INVSOCK && !c->drop && FD_ISSET(c->sock, &rd))
+				client_read(slot);
+		}
+	}
+
+	CLOSESOCKET(proxy_sock);
+	return NULL;
+}
+
+/* listen on [addr:]port, the upstream is the stratum pool in use */
+bool proxy_start(struct thr_info *thr)
+{
+	struct sockaddr_in serv;
+	char addr[64] = "0.0.0.0";
+	const char *port = opt_stratum_proxy;
+	const char *sep = strrchr(opt_stratum_proxy, ':');
+	int optval = 1;
+
+	switch (opt_algo) {
+		case ALGO_DECRED:
+		case ALGO_EQUIHASH:
+		case ALGO_SIA:
+		case ALGO_HEAVY:
+		case ALGO_MJOLLNIR:
+		case ALGO_WILDKECCAK:
+		case ALGO_CRYPTOLIGHT:
+		case ALGO_CRYPTONIGHT:
+			applog(LOG_ERR, "stratum proxy is not supported for %s", algo_names[opt_algo]);
+			return false;
+	}
+	if (!want_stratum || !have_stratum) {
+		applog(LOG_ERR, "stratum proxy requires a stratum pool");
+		return false;
+	}
+
+	if (sep) {
+		snprintf(addr, min(sizeof(addr), (size_t) (sep - opt_stratum_proxy + 1)), "%s", opt_stratum_proxy);
+		port = sep + 1;
+	}
+	memset(&serv, 0, sizeof(serv));
+	serv.sin_family = AF_INET;
+	serv.sin_addr.s_addr = inet_addr(addr);
+	serv.sin_port = htons((unsigned short) atoi(port));
+	if (!atoi(port) || serv.sin_addr.s_addr == INADDR_NONE) {
+		applog(LOG_ERR, "invalid stratum proxy address %s", opt_stratum_proxy);
+		return false;
+	}
+
+	for (int slot = 0; slot < PROXY_MAX_CLIENTS; slot++)
+		clients[slot].sock = INVSOCK;
+
+	proxy_sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (proxy_sock == INVSOCK) {
+		applog(LOG_ERR, "stratum proxy socket failed");
+		return false;
+	}
+	setsockopt(proxy_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)(&optval), sizeof(optval));
+	if (SOCKETFAIL(bind(proxy_sock, (struct sockaddr *)(&serv), sizeof(serv))) ||
+	    SOCKETFAIL(listen(proxy_sock, 16))) {
+		applog(LOG_ERR, "stratum proxy failed to listen on %s:%s", addr, port);
+		CLOSESOCKET(proxy_sock);
+		return false;
+	}
+
+	if (unlikely(pthread_create(&thr->pth, NULL, proxy_thread, thr))) {
+		applog(LOG_ERR, "proxy thread create failed");
+		return false;
+	}
+	applog(LOG_INFO, "Stratum proxy listening on %s:%s", addr, port);
+	return true;
+}
+
+/**
+ * Stratum thread, after each line: the clients have to subscribe again
+ * if the pool or its extranonce changed.
+ */
+void proxy_upstream_check(struct stratum_ctx *sctx)
+{
+	char xnonce1[sizeof(upstream.xnonce1)] = { 0 };
+	int n = 0;
+
+	if (sctx->curl && sctx->xnonce1 && 2 * sctx->xnonce1_size < sizeof(xnonce1))
+		cbin2hex(xnonce1, (const char*) sctx->xnonce1, sctx->xnonce1_size);
+
+	pthread_mutex_lock(&proxy_lock);
+	if (strcmp(xnonce1, upstream.xnonce1) || upstream.pooln != sctx->pooln ||
+	    upstream.xnonce2_size != (int) sctx->xnonce2_size) {
+		for (int slot = 0; slot < PROXY_MAX_CLIENTS; slot++) {
+			if (clients[slot].sock != INVSOCK && clients[slot].subscribed) {
+				clients[slot].drop = true;
+				n++;
+			}
+		}
+		strcpy(upstream.xnonce1, xnonce1);
+		upstream.pooln = sctx->pooln;
+		upstream.xnonce2_size = (int) sctx->xnonce2_size;
+		free(upstream.notify);
+		free(upstream.difficulty);
+		upstream.notify = upstream.difficulty = NULL;
+		if (n && !opt_quiet)
+			applog(LOG_INFO, "proxy: upstream extranonce changed, %d clients disconnected", n);
+	}
+	pthread_mutex_unlock(&proxy_lock);
+}
+
+/* stratum thread, forward the jobs and difficulty as received */
+void proxy_upstream_line(const char *line)
+{
+	size_t len = strlen(line);
+	char **last;
+	char *s;
+
+	if (strstr(line, "\"mining.notify\""))
+		last = &upstream.notify;
+	else if (strstr(line, "\"mining.set_difficulty\""))
+		last = &upstream.difficulty;
+	else
+		return;
+
+	s = (char*) malloc(len + 2);
+	if (!s)
+		return;
+	memcpy(s, line, len);
+	s[len] = '\n';
+	s[len + 1] = '\0';
+
+	pthread_mutex_lock(&proxy_lock);
+	for (int slot = 0; slot < PROXY_MAX_CLIENTS; slot++)
+		if (clients[slot].subscribed)
+			client_send(&clients[slot], s, len + 1);
+	free(*last);
+	*last = s;
+	pthread_mutex_unlock(&proxy_lock);
+}
+
+/* stratum thread, pool answer to the share of a client */
+void proxy_share_answer(const struct share_inflight *share, bool accepted, json_t *err_val)
+{
+	const int slot = share->proxy_client - 1;
+	char *err = (err_val && !json_is_null(err_val)) ? json_dumps(err_val, JSON_COMPACT | JSON_ENCODE_ANY) : NULL;
+	size_t len = (err ? strlen(err) : 4) + sizeof(share->proxy_id) + 40;
+	char *s = (char*) malloc(len);
+	uint32_t acc = 0, total = 0;
+	bool sent = false;
+
+	if (slot < 0 || slot >= PROXY_MAX_CLIENTS || !s)
+		goto out;
+	snprintf(s, len, "{\"id\":%s,\"result\":%s,\"error\":%s}\n", share->proxy_id,
+		accepted ? "true" : "false", err ? err : "null");
+
+	pthread_mutex_lock(&proxy_lock);
+	if (clients[slot].sock != INVSOCK && clients[slot].seq == share->proxy_seq) {
+		client_send(&clients[slot], s, strlen(s));
+		if (accepted) clients[slot].accepted++;
+		else clients[slot].rejected++;
+		acc = clients[slot].accepted;
+		total = acc + clients[slot].rejected;
+		sent = true;
+	}
+	pthread_mutex_unlock(&proxy_lock);
+
+	if (!sent)
+		applog(LOG_DEBUG, "proxy: share %u answered after client %d left", share->id, slot + 1);
+	else if (!accepted)
+		applog(LOG_WARNING, "proxy: client %d share rejected (%u/%u) %s", slot + 1, acc, total, err ? err : "");
+	else if (!opt_quiet)
+		applog(LOG_INFO, "proxy: client %d share accepted (%u/%u) %u ms", slot + 1, acc, total, share->answer_msec);
+out:
+	free(err);
+	free(s);
+}
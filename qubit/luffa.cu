@@ -28,6 +28,32 @@ extern "C" void luffa_hash(void *state, const void *input)
 	memcpy(state, hash, 32);
 }
 
+// hash count nonces of the same header, the first 64 bytes are absorbed once
+extern "C" void luffa_hash_batch(void *output, const void *input, const uint32_t *nonces, int count)
+{
+	uint32_t _ALIGN(64) hash[16];
+	uint32_t _ALIGN(16) tail[4];
+	sph_luffa512_context ctx_mid, ctx_luffa;
+
+	sph_luffa512_init(&ctx_mid);
+	sph_luffa512 (&ctx_mid, input, 64);
+	memcpy(tail, (const uint8_t*) input + 64, 16);
+
+	for (int i = 0; i < count; i++) {
+		be32enc(&tail[3], nonces[i]);
+		memcpy(&ctx_luffa, &ctx_mid, sizeof(ctx_mid));
+		sph_luffa512 (&ctx_luffa, tail, 16);
+		sph_luffa512_close(&ctx_luffa, (void*) hash);
+		memcpy((uint8_t*) output + i * 32, hash, 32);
+	}
+}
+
+// CPU scan (--cpu-scan), 8 nonces per call on the luffa midstate
+extern "C" int scanhash_luffa_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done)
+{
+	return scanhash_cpu_batch(thr_id, work, max_nonce, hashes_done, luffa_hash_batch);
+}
+
 static bool init[MAX_GPUS] = { 0 };
 
 extern "C" int scanhash_luffa(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done)
@@ -77,16 +103,14 @@ extern "C" int scanhash_luffa(int thr_id, struct work* work, uint32_t max_nonce,
 		{
 			const uint32_t Htarg = ptarget[7];
 			uint32_t _ALIGN(64) vhash[8];
-			be32enc(&endiandata[19], work->nonces[0]);
-			luffa_hash(vhash, endiandata);
+			luffa_hash_batch(vhash, endiandata, &work->nonces[0], 1);
 
 			if (vhash[7] <= Htarg && fulltest(vhash, ptarget)) {
 				work->valid_nonces = 1;
 				work_set_target_ratio(work, vhash);
 				work->nonces[1] = cuda_check_hash_suppl(thr_id, throughput, pdata[19], d_hash[thr_id], 1);
 				if (work->nonces[1] != 0) {
-					be32enc(&endiandata[19], work->nonces[1]);
-					luffa_hash(vhash, endiandata);
+					luffa_hash_batch(vhash, endiandata, &work->nonces[1], 1);
 					bn_set_target_ratio(work, vhash, 1);
 					work->valid_nonces++;
 					pdata[19] = max(work->nonces[0], work->nonces[1]) + 1;
@@ -21,22 +21,14 @@ extern void qubit_luffa512_cpu_init(int thr_id, uint32_t threads);
 extern void qubit_luffa512_cpu_setBlock_80(void *pdata);
 extern void qubit_luffa512_cpu_hash_80(int thr_id, uint32_t threads, uint32_t startNounce, uint32_t *d_hash, int order);
 
-extern "C" void qubithash(void *state, const void *input)
+// cubehash2-shavite3-simd4-echo5
+static void qubithash_tail(uint8_t *hash)
 {
-	uint8_t _ALIGN(128) hash[64];
-
-	// luffa1-cubehash2-shavite3-simd4-echo5
-
-	sph_luffa512_context ctx_luffa;
 	sph_cubehash512_context ctx_cubehash;
 	sph_shavite512_context ctx_shavite;
 	sph_simd512_context ctx_simd;
 	sph_echo512_context ctx_echo;
 
-	sph_luffa512_init(&ctx_luffa);
-	sph_luffa512 (&ctx_luffa, input, 80);
-	sph_luffa512_close(&ctx_luffa, (void*) hash);
-
 	sph_cubehash512_init(&ctx_cubehash);
 	sph_cubehash512 (&ctx_cubehash, (const void*) hash, 64);
 	sph_cubehash512_close(&ctx_cubehash, (void*) hash);
@@ -52,10 +44,52 @@ extern "C" void qubithash(void *state, const void *input)
 	sph_echo512_init(&ctx_echo);
 	sph_echo512 (&ctx_echo, (const void*) hash, 64);
 	sph_echo512_close(&ctx_echo, (void*) hash);
+}
+
+extern "C" void qubithash(void *state, const void *input)
+{
+	uint8_t _ALIGN(128) hash[64];
+
+	// luffa1-cubehash2-shavite3-simd4-echo5
+
+	sph_luffa512_context ctx_luffa;
+
+	sph_luffa512_init(&ctx_luffa);
+	sph_luffa512 (&ctx_luffa, input, 80);
+	sph_luffa512_close(&ctx_luffa, (void*) hash);
+
+	qubithash_tail(hash);
 
 	memcpy(state, hash, 32);
 }
 
+// hash count nonces of the same header, luffa from the 64 bytes midstate
+extern "C" void qubithash_batch(void *output, const void *input, const uint32_t *nonces, int count)
+{
+	uint8_t _ALIGN(128) hash[64];
+	uint32_t _ALIGN(16) tail[4];
+	sph_luffa512_context ctx_mid, ctx_luffa;
+
+	sph_luffa512_init(&ctx_mid);
+	sph_luffa512 (&ctx_mid, input, 64);
+	memcpy(tail, (const uint8_t*) input + 64, 16);
+
+	for (int i = 0; i < count; i++) {
+		be32enc(&tail[3], nonces[i]);
+		memcpy(&ctx_luffa, &ctx_mid, sizeof(ctx_mid));
+		sph_luffa512 (&ctx_luffa, tail, 16);
+		sph_luffa512_close(&ctx_luffa, (void*) hash);
+		qubithash_tail(hash);
+		memcpy((uint8_t*) output + i * 32, hash, 32);
+	}
+}
+
+// CPU scan (--cpu-scan), 8 nonces per call on the luffa midstate
+extern "C" int scanhash_qubit_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done)
+{
+	return scanhash_cpu_batch(thr_id, work, max_nonce, hashes_done, qubithash_batch);
+}
+
 static bool init[MAX_GPUS] = { 0 };
 
 extern "C" int scanhash_qubit(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done)
@@ -117,16 +151,14 @@ extern "C" int scanhash_qubit(int thr_id, struct work* work, uint32_t max_nonce,
 		{
 			const uint32_t Htarg = ptarget[7];
 			uint32_t _ALIGN(64) vhash[8];
-			be32enc(&endiandata[19], work->nonces[0]);
-			qubithash(vhash, endiandata);
+			qubithash_batch(vhash, endiandata, &work->nonces[0], 1);
 
 			if (vhash[7] <= Htarg && fulltest(vhash, ptarget)) {
 				work->valid_nonces = 1;
 				work_set_target_ratio(work, vhash);
 				work->nonces[1] = cuda_check_hash_suppl(thr_id, throughput, pdata[19], d_hash[thr_id], 1);
 				if (work->nonces[1] != 0) {
-					be32enc(&endiandata[19], work->nonces[1]);
-					qubithash(vhash, endiandata);
+					qubithash_batch(vhash, endiandata, &work->nonces[1], 1);
 					bn_set_target_ratio(work, vhash, 1);
 					work->valid_nonces++;
 					pdata[19] = max(work->nonces[0], work->nonces[1]) + 1;
@@ -0,0 +1,329 @@
+/**
+ * Stratum session recorder (--stratum-record) and replay (--stratum-replay)
+ *
+ * The recorder writes the lines received and sent on the main stratum
+ * connection to a JSONL file, with their time and the connections:
+ *   {"t":0.012,"pool":0,"event":"connect"}
+ *   {"t":1.234,"pool":0,"dir":"<","line":"{...}"}
+ *
+ * The replay serves a recording on a local port used as the pool url:
+ * each connection of the stratum thread gets the next recorded session,
+ * its received lines are sent at their recorded time (divided by
+ * --replay-speed, 0 sends them at once), then the session is closed.
+ */
+#ifdef WIN32
+# define  _WINSOCK_DEPRECATED_NO_WARNINGS
+# include <winsock2.h>
+#endif
+
+#include <stdlib.h>
+#include <memory.h>
+
+#include "miner.h"
+
+#ifndef WIN32
+# include <unistd.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# define SOCKETTYPE long
+# define SOCKETFAIL(a) ((a) < 0)
+# define INVSOCK -1 /* INVALID_SOCKET */
+# define CLOSESOCKET close
+#else
+# define SOCKETTYPE SOCKET
+# define SOCKETFAIL(a) ((a) == SOCKET_ERROR)
+# define INVSOCK INVALID_SOCKET
+# define CLOSESOCKET closesocket
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// current stratum...
+extern struct stratum_ctx stratum;
+
+char *opt_stratum_record = NULL;
+char *opt_stratum_replay = NULL;
+double opt_replay_speed = 1.0;
+
+static FILE *record_fp = NULL;
+static struct timeval record_start;
+static time_t record_flush_time = 0;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct replay_line {
+	double t;    // seconds from the session start
+	int session;
+	char *line;  // NULL: end of the session (disconnect)
+};
+
+static struct replay_line *replay = NULL;
+static int replay_count = 0;
+static int replay_sessions = 0;
+static SOCKETTYPE replay_sock = INVSOCK;
+
+static double record_time()
+{
+	struct timeval now, diff;
+	gettimeofday(&now, NULL);
+	timeval_subtract(&diff, &now, &record_start);
+	return diff.tv_sec + 1e-6 * diff.tv_usec;
+}
+
+bool stratum_record_open()
+{
+	record_fp = fopen(opt_stratum_record, "a");
+	if (!record_fp) {
+		applog(LOG_ERR, "Unable to open the stratum record file %s", opt_stratum_record);
+		return false;
+	}
+	gettimeofday(&record_start, NULL);
+	return true;
+}
+
+static void record_write(json_t *val, bool flush)
+{
+	char *s = json_dumps(val, JSON_COMPACT | JSON_PRESERVE_ORDER);
+	if (!s)
+		return;
+	pthread_mutex_lock(&record_lock);
+	fprintf(record_fp, "%s\n", s);
+	// buffered, but at most one second late
+	if (flush || time(NULL) != record_flush_time) {
+		fflush(record_fp);
+		record_flush_time = time(NULL);
+	}
+	pthread_mutex_unlock(&record_lock);
+	free(s);
+}
+
+/* line received ('<') or sent ('>') */
+void stratum_record(struct stratum_ctx *sctx, char dir, const char *line)
+{
+	const char d[2] = { dir, '\0' };
+	json_t *val;
+
+	if (!record_fp || sctx != &stratum)
+		return;
+	val = json_pack("{s:f,s:i,s:s,s:s}", "t", record_time(), "pool", sctx->pooln,
+		"dir", d, "line", line);
+	if (val) {
+		record_write(val, false);
+		json_decref(val);
+	}
+}
+
+/* connect, disconnect */
+void stratum_record_event(struct stratum_ctx *sctx, const char *event)
+{
+	json_t *val;
+
+	if (!record_fp || sctx != &stratum)
+		return;
+	val = json_pack("{s:f,s:i,s:s}", "t", record_time(), "pool", sctx->pooln, "event", event);
+	if (val) {
+		record_write(val, true);
+		json_decref(val);
+	}
+}
+
+static bool replay_load(const char *filename)
+{
+	FILE *fp = fopen(filename, "r");
+	size_t size = 4096, len = 0;
+	char *buf = (char*) malloc(size);
+	double session_start = 0.;
+	int session = 0, alloc = 0, lines = 0;
+
+	if (!fp || !buf) {
+		applog(LOG_ERR, "Unable to open the stratum recording %s", filename);
+		if (fp) fclose(fp);
+		free(buf);
+		return false;
+	}
+
+	while (fgets(buf + len, (int) (size - len), fp)) {
+		json_t *val;
+		json_error_t err;
+		const char *event, *dir, *line;
+		double t;
+
+		len += strlen(buf + len);
+		if (len == size - 1 && buf[len - 1] != '\n') {
+			char *p = (char*) realloc(buf, size * 2);
+			if (!p) break;
+			buf = p;
+			size *= 2;
+			continue;
+		}
+		len = 0;
+		lines++;
+
+		val = JSON_LOADS(buf, &err);
+		if (!val) {
+			applog(LOG_WARNING, "replay: line %d ignored (%s)", lines, err.text);
+			continue;
+		}
+		t = json_number_value(json_object_get(val, "t"));
+		event = json_string_value(json_object_get(val, "event"));
+		dir = json_string_value(json_object_get(val, "dir"));
+		line = json_string_value(json_object_get(val, "line"));
+
+		if (event && !strcmp(event, "connect")) {
+			// the first session starts at the first connect
+			if (replay_count)
+				session++;
+			session_start = t;
+		}
+		if ((event && !strcmp(event, "disconnect")) || (dir && *dir == '<' && line)) {
+			if (replay_count == alloc) {
+				alloc = alloc ? alloc * 2 : 1024;
+				replay = (struct replay_line*) realloc(replay, alloc * sizeof(*replay));
+				if (!replay) {
+					json_decref(val);
+					break;
+				}
+			}
+			replay[replay_count].t = max(t - session_start, 0.);
+			replay[replay_count].session = session;
+			replay[replay_count].line = line ? strdup(line) : NULL;
+			replay_count++;
+		}
+		json_decref(val);
+	}
+	fclose(fp);
+	free(buf);
+
+	if (!replay_count) {
+		applog(LOG_ERR, "replay: no stratum line received in %s", filename);
+		return false;
+	}
+	replay_sessions = session + 1;
+	return true;
+}
+
+/* load the recording and listen on a local port, url is the pool url to use */
+bool stratum_replay_init(char *url, size_t len)
+{
+	struct sockaddr_in serv;
+	socklen_t servlen = sizeof(serv);
+
+	if (!replay_load(opt_stratum_replay))
+		return false;
+
+	memset(&serv, 0, sizeof(serv));
+	serv.sin_family = AF_INET;
+	serv.sin_addr.s_addr = inet_addr("127.0.0.1");
+	serv.sin_port = 0;
+
+	replay_sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (replay_sock == INVSOCK ||
+	    SOCKETFAIL(bind(replay_sock, (struct sockaddr *)(&serv), sizeof(serv))) ||
+	    SOCKETFAIL(listen(replay_sock, 4)) ||
+	    SOCKETFAIL(getsockname(replay_sock, (struct sockaddr *)(&serv), &servlen))) {
+		applog(LOG_ERR, "replay: unable to listen on a local port");
+		return false;
+	}
+	snprintf(url, len, "stratum+tcp://127.0.0.1:%u", (uint32_t) ntohs(serv.sin_port));
+	applog(LOG_INFO, "Replaying %d stratum lines in %d sessions from %s", replay_count,
+		replay_sessions, opt_stratum_replay);
+	return true;
+}
+
+// wait until the due time, discarding the lines sent by the miner
+static int replay_wait(SOCKETTYPE c, struct timeval *start, double due)
+{
+	int received = 0;
+	while (!abort_flag) {
+		struct timeval now, diff, tv;
+		double left;
+		char buf[4096];
+		fd_set rd;
+
+		gettimeofday(&now, NULL);
+		timeval_subtract(&diff, &now, start);
+		left = due - (diff.tv_sec + 1e-6 * diff.tv_usec);
+		if (left <= 0.)
+			break;
+		left = min(left, 0.1);
+		tv.tv_sec = 0;
+		tv.tv_usec = (long) (left * 1e6);
+		FD_ZERO(&rd);
+		FD_SET(c, &rd);
+		if (select((int) c + 1, &rd, NULL, NULL, &tv) > 0) {
+			int n = recv(c, buf, sizeof(buf), 0);
+			if (n <= 0)
+				break;
+			for (int i = 0; i < n; i++)
+				if (buf[i] == '\n') received++;
+		}
+	}
+	return received;
+}
+
+static void replay_summary(double elapsed, int sent, int received)
+{
+	applog(LOG_INFO, "replay: %d lines sent in %.1fs, %d received", sent, elapsed, received);
+	for (int n = 0; n < num_pools; n++) {
+		struct pool_infos *p = &pools[n];
+		if (!p->work_gen_count)
+			continue;
+		applog(LOG_INFO, "replay: pool %d, %u works generated in %.1f us, %u job switches in %.2f ms",
+			n, p->work_gen_count, (double) p->work_gen_usec / p->work_gen_count,
+			p->job_switch_count, p->job_switch_count ? 1e-3 * p->job_switch_usec / p->job_switch_count : 0.);
+	}
+}
+
+static void *replay_thread(void *userdata)
+{
+	struct timeval start, end, diff;
+	int i = 0, sent = 0, received = 0;
+
+	gettimeofday(&start, NULL);
+	for (int session = 0; session < replay_sessions && !abort_flag; session++) {
+		struct timeval tv_session;
+		SOCKETTYPE c = accept(replay_sock, NULL, NULL);
+		if (SOCKETFAIL(c))
+			break;
+		gettimeofday(&tv_session, NULL);
+		for (; i < replay_count && replay[i].session == session && !abort_flag; i++) {
+			const double due = opt_replay_speed > 0. ? replay[i].t / opt_replay_speed : 0.;
+			received += replay_wait(c, &tv_session, due);
+			if (!replay[i].line)
+				continue; // disconnect
+			if (send(c, replay[i].line, (int) strlen(replay[i].line), MSG_NOSIGNAL) < 0 ||
+			    send(c, "\n", 1, MSG_NOSIGNAL) < 0)
+				break;
+			sent++;
+		}
+		// after a send error, the next session starts at its connect event
+		while (i < replay_count && replay[i].session <= session)
+			i++;
+		// let the miner process the last lines
+		if (session == replay_sessions - 1) {
+			struct timeval tv_last;
+			gettimeofday(&tv_last, NULL);
+			received += replay_wait(c, &tv_last, 1.0);
+		}
+		CLOSESOCKET(c);
+	}
+	CLOSESOCKET(replay_sock);
+
+	gettimeofday(&end, NULL);
+	timeval_subtract(&diff, &end, &start);
+	replay_summary(diff.tv_sec + 1e-6 * diff.tv_usec, sent, received);
+	if (!abort_flag)
+		proper_exit(EXIT_CODE_OK);
+	return NULL;
+}
+
+bool stratum_replay_start(struct thr_info *thr)
+{
+	if (unlikely(pthread_create(&thr->pth, NULL, replay_thread, thr))) {
+		applog(LOG_ERR, "replay thread create failed");
+		return false;
+	}
+	return true;
+}
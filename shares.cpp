@@ -0,0 +1,104 @@
+/**
+ * Stratum shares in flight
+ *
+ * Each submit gets a unique json-rpc id, its slot in a fixed table keeps
+ * the pool, job, diff and send time of the share until the pool answer.
+ * A slot reused before any answer is a share lost by the pool.
+ */
+#include <stdlib.h>
+#include <memory.h>
+
+#include "miner.h"
+
+#define SHARES_MAX_INFLIGHT 64
+
+static struct share_inflight inflight[SHARES_MAX_INFLIGHT] = { 0 };
+static uint32_t next_id = SHARE_FIRST_ID;
+
+static pthread_mutex_t inflight_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// called with inflight_lock held
+static struct share_inflight *inflight_new(int pooln, const char *job_id, uint32_t nonce)
+{
+	struct share_inflight *s;
+	uint32_t id;
+
+	id = next_id++;
+	if (next_id >= INT32_MAX)
+		next_id = SHARE_FIRST_ID;
+	s = &inflight[id % SHARES_MAX_INFLIGHT];
+	if (s->id && opt_debug)
+		applog(LOG_DEBUG, "share %u of job %s not answered", s->id, s->job_id);
+	memset(s, 0, sizeof(*s));
+	s->id = id;
+	s->pooln = pooln;
+	snprintf(s->job_id, sizeof(s->job_id), "%s", job_id);
+	s->nonce = nonce;
+	gettimeofday(&s->tv_submit, NULL);
+	return s;
+}
+
+/* record a share before it is sent, return the id to submit it with */
+uint32_t share_inflight_add(int pooln, const char *job_id, uint32_t nonce, double sharediff)
+{
+	struct share_inflight *s;
+	uint32_t id;
+
+	pthread_mutex_lock(&inflight_lock);
+	s = inflight_new(pooln, job_id, nonce);
+	s->sharediff = sharediff;
+	id = s->id;
+	pthread_mutex_unlock(&inflight_lock);
+	return id;
+}
+
+/* share of a --stratum-proxy client, req_id is the json id of its request */
+uint32_t share_inflight_add_proxy(int pooln, const char *job_id, uint32_t nonce,
+	int client, uint32_t seq, const char *req_id)
+{
+	struct share_inflight *s;
+	uint32_t id;
+
+	pthread_mutex_lock(&inflight_lock);
+	s = inflight_new(pooln, job_id, nonce);
+	s->proxy_client = client;
+	s->proxy_seq = seq;
+	snprintf(s->proxy_id, sizeof(s->proxy_id), "%s", req_id);
+	id = s->id;
+	pthread_mutex_unlock(&inflight_lock);
+	return id;
+}
+
+/* remove the share of an answer (or a failed send), false if unknown.
+ * share can be NULL, else its answer_msec is set */
+bool share_inflight_done(uint32_t id, struct share_inflight *share)
+{
+	struct share_inflight *s = &inflight[id % SHARES_MAX_INFLIGHT];
+	bool ret = false;
+
+	pthread_mutex_lock(&inflight_lock);
+	if (id >= SHARE_FIRST_ID && s->id == id) {
+		if (share) {
+			struct timeval tv_answer, diff;
+			gettimeofday(&tv_answer, NULL);
+			timeval_subtract(&diff, &tv_answer, &s->tv_submit);
+			memcpy(share, s, sizeof(*share));
+			share->answer_msec = (1000 * diff.tv_sec) + (uint32_t) (0.001 * diff.tv_usec);
+		}
+		s->id = 0;
+		ret = true;
+	}
+	pthread_mutex_unlock(&inflight_lock);
+	return ret;
+}
+
+/* shares waiting for an answer */
+int share_inflight_count()
+{
+	int n = 0;
+	pthread_mutex_lock(&inflight_lock);
+	for (int i = 0; i < SHARES_MAX_INFLIGHT; i++)
+		if (inflight[i].id) n++;
+	pthread_mutex_unlock(&inflight_lock);
+	return n;
+}
@@ -68,43 +68,70 @@ static size_t sia_data_cb(const void *ptr, size_t size, size_t nmemb,
 	return len;
 }
 
-char* sia_getheader(CURL *curl, struct pool_infos *pool)
+static struct curl_slist *sia_get_headers()
 {
-	char curl_err_str[CURL_ERROR_SIZE] = { 0 };
-	struct data_buffer all_data = { 0 };
 	struct curl_slist *headers = NULL;
-	char data[256] = { 0 };
-	char url[512];
+	headers = curl_slist_append(headers, "Accept: application/octet-stream");
+	headers = curl_slist_append(headers, "Expect:"); // disable Expect hdr
+	headers = curl_slist_append(headers, "User-Agent: Sia-Agent"); // required for now
+//	headers = curl_slist_append(headers, "User-Agent: " USER_AGENT);
+//	headers = curl_slist_append(headers, "X-Mining-Extensions: longpoll");
+	return headers;
+}
 
-	// nanopool
-	snprintf(url, 512, "%s/miner/header?address=%s&worker=%s", //&longpoll
-		pool->url, pool->user, pool->pass);
+static struct curl_slist *sia_submit_headers()
+{
+	struct curl_slist *headers = NULL;
+//	headers = curl_slist_append(headers, "Content-Type: application/octet-stream");
+//	headers = curl_slist_append(headers, "Content-Length: 80");
+	headers = curl_slist_append(headers, "Accept:"); // disable Accept hdr
+	headers = curl_slist_append(headers, "Expect:"); // disable Expect hdr
+	headers = curl_slist_append(headers, "User-Agent: Sia-Agent");
+//	headers = curl_slist_append(headers, "User-Agent: " USER_AGENT);
+	return headers;
+}
 
+// options common to the header and submit requests, kept by the handle
+static void sia_setup(CURL *curl)
+{
+	if (!curl_conn_setup(curl, CURL_CONF_SIA))
+		return;
 	if (opt_protocol)
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_POST, 0);
 	curl_easy_setopt(curl, CURLOPT_ENCODING, "");
 	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0);
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1);
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, opt_timeout);
 	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_err_str);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, sia_data_cb);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &all_data);
+}
 
-	headers = curl_slist_append(headers, "Accept: application/octet-stream");
-	headers = curl_slist_append(headers, "Expect:"); // disable Expect hdr
-	headers = curl_slist_append(headers, "User-Agent: Sia-Agent"); // required for now
-//	headers = curl_slist_append(headers, "User-Agent: " USER_AGENT);
-//	headers = curl_slist_append(headers, "X-Mining-Extensions: longpoll");
+char* sia_getheader(CURL *curl, struct pool_infos *pool)
+{
+	struct data_buffer all_data = { 0 };
+	struct curl_slist *headers, *own_headers = NULL;
+	char data[256] = { 0 };
+	char url[512];
 
+	// nanopool
+	snprintf(url, 512, "%s/miner/header?address=%s&worker=%s", //&longpoll
+		pool->url, pool->user, pool->pass);
+
+	sia_setup(curl);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, opt_timeout);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &all_data);
+
+	headers = curl_conn_headers(curl, CURL_CONF_SIA, sia_get_headers);
+	if (!headers)
+		headers = own_headers = sia_get_headers();
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
 	int rc = curl_easy_perform(curl);
-	if (rc && strlen(curl_err_str)) {
-		applog(LOG_WARNING, "%s", curl_err_str);
+	curl_conn_stat(curl, "sia header", rc == 0);
+	if (rc && strlen(curl_conn_error(curl))) {
+		applog(LOG_WARNING, "%s", curl_conn_error(curl));
 	}
 
 	if (all_data.len >= 112)
@@ -112,7 +139,9 @@ char* sia_getheader(CURL *curl, struct pool_infos *pool)
 	if (opt_protocol || all_data.len != 112)
 		applog(LOG_DEBUG, "received %d bytes: %s", (int) all_data.len, data);
 
-	curl_slist_free_all(headers);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+	curl_slist_free_all(own_headers);
+	free(all_data.buf);
 
 	return rc == 0 && all_data.len ? strdup(data) : NULL;
 }
@@ -144,9 +173,8 @@ bool sia_work_decode(const char *hexdata, struct work *work)
 
 bool sia_submit(CURL *curl, struct pool_infos *pool, struct work *work)
 {
-	char curl_err_str[CURL_ERROR_SIZE] = { 0 };
 	struct data_buffer all_data = { 0 };
-	struct curl_slist *headers = NULL;
+	struct curl_slist *headers, *own_headers = NULL;
 	char buf[256] = { 0 };
 	char url[512];
 
@@ -159,44 +187,35 @@ bool sia_submit(CURL *curl, struct pool_infos *pool, struct work *work)
 	snprintf(url, 512, "%s/miner/header?address=%s&worker=%s",
 		pool->url, pool->user, pool->pass);
 
-	if (opt_protocol)
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
+	sia_setup(curl);
 	curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_ENCODING, "");
-	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0);
-	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-	curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1);
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_err_str);
-	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10);
-
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &all_data);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, sia_data_cb);
 
 	memcpy(buf, work->data, 80);
 	curl_easy_setopt(curl, CURLOPT_POST, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 80);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, (void*) buf);
 
-//	headers = curl_slist_append(headers, "Content-Type: application/octet-stream");
-//	headers = curl_slist_append(headers, "Content-Length: 80");
-	headers = curl_slist_append(headers, "Accept:"); // disable Accept hdr
-	headers = curl_slist_append(headers, "Expect:"); // disable Expect hdr
-	headers = curl_slist_append(headers, "User-Agent: Sia-Agent");
-//	headers = curl_slist_append(headers, "User-Agent: " USER_AGENT);
+	headers = curl_conn_headers(curl, CURL_CONF_SIA_SUBMIT, sia_submit_headers);
+	if (!headers)
+		headers = own_headers = sia_submit_headers();
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
 	int res = curl_easy_perform(curl) == 0;
+	curl_conn_stat(curl, "sia submit", res);
 	long errcode;
 	CURLcode c = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &errcode);
 	if (errcode != 204) {
-		if (strlen(curl_err_str))
-			applog(LOG_ERR, "submit err %ld %s", errcode, curl_err_str);
+		if (strlen(curl_conn_error(curl)))
+			applog(LOG_ERR, "submit err %ld %s", errcode, curl_conn_error(curl));
 		res = 0;
 	}
 	share_result(res, work->pooln, work->sharediff[0], res ? NULL : (char*) all_data.buf);
 
-	curl_slist_free_all(headers);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+	curl_slist_free_all(own_headers);
+	free(all_data.buf);
 	return true;
 }
 
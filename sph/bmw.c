@@ -40,6 +40,17 @@
 #define SPH_SMALL_FOOTPRINT_BMW   1
 #endif
 
+/*
+ * The multi-lane entry points reuse the generic FOLD macros on GCC
+ * vector types, one message per lane. This needs the unrolled macro set.
+ */
+#if defined(__AVX2__) && defined(__GNUC__) && !SPH_SMALL_FOOTPRINT_BMW \
+	&& !defined SPH_BMW_NO_SIMD
+#define SPH_BMW_AVX2   1
+#else
+#define SPH_BMW_AVX2   0
+#endif
+
 #ifdef _MSC_VER
 #pragma warning (disable: 4146)
 #endif
@@ -836,6 +847,56 @@ bmw64_close(sph_bmw_big_context *sc, unsigned ub, unsigned n,
 
 #endif
 
+#if SPH_BMW_AVX2
+
+typedef sph_u32 bmw_v8u32 __attribute__ ((vector_size (32)));
+
+#define V8(x)   ((bmw_v8u32){ 0 } + (sph_u32)(x))
+
+/*
+ * Eight-lane compression; h is shared by all lanes, which is the case
+ * for both a midstate and the final_s constants.
+ */
+static void
+compress_small_8way(const bmw_v8u32 mv[16], const sph_u32 h[16],
+	bmw_v8u32 dh[16])
+{
+#define M(x)    (mv[x])
+#define H(x)    (h[x])
+#define dH(x)   (dh[x])
+
+	FOLD(bmw_v8u32, MAKE_Qs, SPH_T32, SPH_ROTL32, M, Qs, dH);
+
+#undef M
+#undef H
+#undef dH
+}
+
+#if SPH_64
+
+typedef sph_u64 bmw_v4u64 __attribute__ ((vector_size (32)));
+
+#define V4(x)   ((bmw_v4u64){ 0 } + (sph_u64)(x))
+
+static void
+compress_big_4way(const bmw_v4u64 mv[16], const sph_u64 h[16],
+	bmw_v4u64 dh[16])
+{
+#define M(x)    (mv[x])
+#define H(x)    (h[x])
+#define dH(x)   (dh[x])
+
+	FOLD(bmw_v4u64, MAKE_Qb, SPH_T64, SPH_ROTL64, M, Qb, dH);
+
+#undef M
+#undef H
+#undef dH
+}
+
+#endif
+
+#endif
+
 /* see sph_bmw.h */
 void
 sph_bmw224_init(void *cc)
@@ -955,3 +1016,127 @@ sph_bmw512_addbits_and_close(void *cc, unsigned ub, unsigned n, void *dst)
 }
 
 #endif
+
+/* see sph_bmw.h */
+void
+sph_bmw256_80_8way(const void *cc, const void *data,
+	const sph_u32 nonces[8], void *dst)
+{
+	const sph_bmw_small_context *sc = cc;
+	const unsigned char *tail = (const unsigned char *)data + 64;
+	unsigned char *out = dst;
+#if SPH_BMW_AVX2
+	bmw_v8u32 mv[16], h1[16], h2[16];
+	unsigned u, v;
+
+	mv[0] = V8(sph_dec32le(tail + 0));
+	mv[1] = V8(sph_dec32le(tail + 4));
+	mv[2] = V8(sph_dec32le(tail + 8));
+	memcpy(&mv[3], nonces, sizeof mv[3]);
+	mv[4] = V8(0x80);
+	for (u = 5; u < 16; u ++)
+		mv[u] = V8(0);
+	mv[14] = V8(640);
+	compress_small_8way(mv, sc->H, h2);
+	compress_small_8way(h2, final_s, h1);
+	for (v = 0; v < 8; v ++)
+		for (u = 0; u < 8; u ++)
+			sph_enc32le(out + 32 * v + 4 * u, h1[8 + u][v]);
+#else
+	unsigned char buf[16];
+	unsigned v;
+
+	memcpy(buf, tail, 12);
+	for (v = 0; v < 8; v ++) {
+		sph_bmw_small_context ctx;
+
+		memcpy(&ctx, sc, sizeof ctx);
+		sph_enc32le(buf + 12, nonces[v]);
+		bmw32(&ctx, buf, sizeof buf);
+		bmw32_close(&ctx, 0, 0, out + 32 * v, 8);
+	}
+#endif
+}
+
+#if SPH_64
+
+/* see sph_bmw.h */
+void
+sph_bmw512_64_4way(const void *src, void *dst)
+{
+	const unsigned char *in = src;
+	unsigned char *out = dst;
+#if SPH_BMW_AVX2
+	bmw_v4u64 mv[16], h1[16], h2[16];
+	unsigned u, v;
+
+	for (u = 0; u < 8; u ++) {
+		mv[u] = (bmw_v4u64){
+			sph_dec64le(in + 8 * u), sph_dec64le(in + 64 + 8 * u),
+			sph_dec64le(in + 128 + 8 * u), sph_dec64le(in + 192 + 8 * u)
+		};
+	}
+	mv[8] = V4(0x80);
+	for (u = 9; u < 16; u ++)
+		mv[u] = V4(0);
+	mv[15] = V4(512);
+	compress_big_4way(mv, IV512, h2);
+	compress_big_4way(h2, final_b, h1);
+	for (v = 0; v < 4; v ++)
+		for (u = 0; u < 8; u ++)
+			sph_enc64le(out + 64 * v + 8 * u, h1[8 + u][v]);
+#else
+	unsigned v;
+
+	for (v = 0; v < 4; v ++) {
+		sph_bmw_big_context ctx;
+
+		bmw64_init(&ctx, IV512);
+		bmw64(&ctx, in + 64 * v, 64);
+		bmw64_close(&ctx, 0, 0, out + 64 * v, 8);
+	}
+#endif
+}
+
+/* see sph_bmw.h */
+void
+sph_bmw512_80_4way(const void *data, const sph_u32 nonces[4], void *dst)
+{
+	const unsigned char *in = data;
+	unsigned char *out = dst;
+#if SPH_BMW_AVX2
+	bmw_v4u64 mv[16], h1[16], h2[16];
+	unsigned u, v;
+
+	for (u = 0; u < 9; u ++)
+		mv[u] = V4(sph_dec64le(in + 8 * u));
+	mv[9] = V4(sph_dec32le(in + 72)) | ((bmw_v4u64){
+		nonces[0], nonces[1], nonces[2], nonces[3] } << 32);
+	mv[10] = V4(0x80);
+	for (u = 11; u < 16; u ++)
+		mv[u] = V4(0);
+	mv[15] = V4(640);
+	compress_big_4way(mv, IV512, h2);
+	compress_big_4way(h2, final_b, h1);
+	for (v = 0; v < 4; v ++)
+		for (u = 0; u < 8; u ++)
+			sph_enc64le(out + 64 * v + 8 * u, h1[8 + u][v]);
+#else
+	sph_bmw_big_context mid;
+	unsigned char buf[4];
+	unsigned v;
+
+	bmw64_init(&mid, IV512);
+	bmw64(&mid, in, 76);
+	for (v = 0; v < 4; v ++) {
+		sph_bmw_big_context ctx;
+
+		memcpy(&ctx, &mid, sizeof ctx);
+		sph_enc32le(buf, nonces[v]);
+		bmw64(&ctx, buf, sizeof buf);
+		bmw64_close(&ctx, 0, 0, out + 64 * v, 8);
+	}
+#endif
+}
+
+#endif
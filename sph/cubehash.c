@@ -71,6 +71,18 @@ extern "C"{
 
 #endif
 
+/*
+ * With AVX2 the 32 state words are kept in 4 registers (x0-x7, x8-xf,
+ * xg-xn, xo-xv); a round is then made of vector add/rotate/xor and of
+ * the lane permutations for the swaps.
+ */
+#if defined(__AVX2__) && !defined SPH_CUBEHASH_NO_SIMD
+#define SPH_CUBEHASH_AVX2   1
+#include <immintrin.h>
+#else
+#define SPH_CUBEHASH_AVX2   0
+#endif
+
 #ifdef _MSC_VER
 #pragma warning (disable: 4146)
 #endif
@@ -134,7 +146,65 @@ static const sph_u32 IV512[] = {
 #define T32      SPH_T32
 #define ROTL32   SPH_ROTL32
 
-#if SPH_CUBEHASH_NOCOPY
+#if SPH_CUBEHASH_AVX2
+
+#define DECL_STATE \
+	__m256i xa0, xa1, xb0, xb1;
+
+#define READ_STATE(cc)   do { \
+		xa0 = _mm256_loadu_si256((const __m256i *)((cc)->state +  0)); \
+		xa1 = _mm256_loadu_si256((const __m256i *)((cc)->state +  8)); \
+		xb0 = _mm256_loadu_si256((const __m256i *)((cc)->state + 16)); \
+		xb1 = _mm256_loadu_si256((const __m256i *)((cc)->state + 24)); \
+	} while (0)
+
+#define WRITE_STATE(cc)   do { \
+		_mm256_storeu_si256((__m256i *)((cc)->state +  0), xa0); \
+		_mm256_storeu_si256((__m256i *)((cc)->state +  8), xa1); \
+		_mm256_storeu_si256((__m256i *)((cc)->state + 16), xb0); \
+		_mm256_storeu_si256((__m256i *)((cc)->state + 24), xb1); \
+	} while (0)
+
+#define INPUT_BLOCK   do { \
+		xa0 = _mm256_xor_si256(xa0, \
+			_mm256_loadu_si256((const __m256i *)buf)); \
+	} while (0)
+
+#define VROTL32(x, n)   _mm256_or_si256( \
+		_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+#define ROUND_AVX2   do { \
+		__m256i t; \
+		xb0 = _mm256_add_epi32(xa0, xb0); \
+		xb1 = _mm256_add_epi32(xa1, xb1); \
+		t = VROTL32(xa0, 7); \
+		xa0 = _mm256_xor_si256(VROTL32(xa1, 7), xb0); \
+		xa1 = _mm256_xor_si256(t, xb1); \
+		xb0 = _mm256_shuffle_epi32(xb0, 0x4E); \
+		xb1 = _mm256_shuffle_epi32(xb1, 0x4E); \
+		xb0 = _mm256_add_epi32(xa0, xb0); \
+		xb1 = _mm256_add_epi32(xa1, xb1); \
+		xa0 = _mm256_permute4x64_epi64(VROTL32(xa0, 11), 0x4E); \
+		xa1 = _mm256_permute4x64_epi64(VROTL32(xa1, 11), 0x4E); \
+		xa0 = _mm256_xor_si256(xa0, xb0); \
+		xa1 = _mm256_xor_si256(xa1, xb1); \
+		xb0 = _mm256_shuffle_epi32(xb0, 0xB1); \
+		xb1 = _mm256_shuffle_epi32(xb1, 0xB1); \
+	} while (0)
+
+#define SIXTEEN_ROUNDS   do { \
+		int j; \
+		for (j = 0; j < 16; j ++) \
+			ROUND_AVX2; \
+	} while (0)
+
+/* xv ^= 1 */
+#define FINAL_TWEAK   do { \
+		xb1 = _mm256_xor_si256(xb1, \
+			_mm256_setr_epi32(0, 0, 0, 0, 0, 0, 0, 1)); \
+	} while (0)
+
+#elif SPH_CUBEHASH_NOCOPY
 
 #define DECL_STATE
 #define READ_STATE(cc)
@@ -253,6 +323,8 @@ static const sph_u32 IV512[] = {
 
 #endif
 
+#if !SPH_CUBEHASH_AVX2
+
 #define INPUT_BLOCK   do { \
 		x0 ^= sph_dec32le_aligned(buf +  0); \
 		x1 ^= sph_dec32le_aligned(buf +  4); \
@@ -531,6 +603,12 @@ static const sph_u32 IV512[] = {
 
 #endif
 
+#define FINAL_TWEAK   do { \
+		xv ^= SPH_C32(1); \
+	} while (0)
+
+#endif /* !SPH_CUBEHASH_AVX2 */
+
 static void
 cubehash_init(sph_cubehash_context *sc, const sph_u32 *iv)
 {
@@ -595,7 +673,7 @@ cubehash_close(sph_cubehash_context *sc, unsigned ub, unsigned n,
 	for (i = 0; i < 11; i ++) {
 		SIXTEEN_ROUNDS;
 		if (i == 0)
-			xv ^= SPH_C32(1);
+			FINAL_TWEAK;
 	}
 	WRITE_STATE(sc);
 	out = dst;
@@ -39,6 +39,21 @@ static const sph_u32 IV512[] = {
 	SPH_C32(0xe13e3567)
 };
 
+/*
+ * With AES-NI and SSE4.1, SMIX is computed on a single 128-bit register:
+ * the AES round instruction does SubBytes, the Super-Mix is done with
+ * byte-wise xtime and shuffles. The 4 KB mixtab tables are then unused.
+ */
+#if defined(__AES__) && defined(__SSE4_1__) && !defined SPH_FUGUE_NO_SIMD
+#define SPH_FUGUE_AESNI   1
+#include <wmmintrin.h>
+#include <smmintrin.h>
+#else
+#define SPH_FUGUE_AESNI   0
+#endif
+
+#if !SPH_FUGUE_AESNI
+
 static const sph_u32 mixtab0[] = {
 	SPH_C32(0x63633297), SPH_C32(0x7c7c6feb), SPH_C32(0x77775ec7),
 	SPH_C32(0x7b7b7af7), SPH_C32(0xf2f2e8e5), SPH_C32(0x6b6b0ab7),
@@ -395,6 +410,8 @@ static const sph_u32 mixtab3[] = {
 	SPH_C32(0x16625816)
 };
 
+#endif /* !SPH_FUGUE_AESNI */
+
 #define TIX2(q, x00, x01, x08, x10, x24)   do { \
 		x10 ^= x00; \
 		x00 = (q); \
@@ -437,6 +454,76 @@ static const sph_u32 mixtab3[] = {
 		x20 ^= x06; \
 	} while (0)
 
+#if SPH_FUGUE_AESNI
+
+/* multiply each byte by 2 in GF(2^8), AES polynomial */
+static inline __m128i
+fugue_xtime(__m128i x)
+{
+	__m128i hi = _mm_cmplt_epi8(x, _mm_setzero_si128());
+	return _mm_xor_si128(_mm_add_epi8(x, x),
+		_mm_and_si128(hi, _mm_set1_epi8(0x1B)));
+}
+
+/*
+ * State words x0..x3 are the columns, in 32-bit lanes 0..3; row k is
+ * byte 3-k of each lane. With s = SubBytes(x), the Super-Mix gives
+ *   c = s ^ (4s <<< 8) ^ (7s <<< 16) ^ (s <<< 24)   (per column)
+ *   x = ShiftRows(c) ^ R
+ * where R row k is T(k) = (row k sum of s) ^ s[k][k], multiplied by
+ * 1, 1, 7 and 4 in columns 0 to 3.
+ */
+static inline __m128i
+fugue_smix(__m128i x)
+{
+	/* aesenclast does ShiftRows too, undo it first */
+	const __m128i inv_sr = _mm_setr_epi8(
+		0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+	const __m128i rotl8 = _mm_setr_epi8(
+		3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+	const __m128i rotl16 = _mm_setr_epi8(
+		2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m128i rotl24 = _mm_setr_epi8(
+		1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	const __m128i shift_rows = _mm_setr_epi8(
+		12, 9, 6, 3, 0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15);
+	const __m128i diag = _mm_setr_epi8(
+		12, 9, 6, 3, 12, 9, 6, 3, 12, 9, 6, 3, 12, 9, 6, 3);
+	__m128i s, s2, s4, s7, c, t, t2, t4, t7, r;
+
+	s = _mm_aesenclast_si128(_mm_shuffle_epi8(x, inv_sr), _mm_setzero_si128());
+	s2 = fugue_xtime(s);
+	s4 = fugue_xtime(s2);
+	s7 = _mm_xor_si128(_mm_xor_si128(s4, s2), s);
+
+	c = _mm_xor_si128(s, _mm_shuffle_epi8(s4, rotl8));
+	c = _mm_xor_si128(c, _mm_shuffle_epi8(s7, rotl16));
+	c = _mm_xor_si128(c, _mm_shuffle_epi8(s, rotl24));
+
+	/* rows sums, in all the columns */
+	t = _mm_xor_si128(s, _mm_shuffle_epi32(s, 0x4E));
+	t = _mm_xor_si128(t, _mm_shuffle_epi32(t, 0xB1));
+	t = _mm_xor_si128(t, _mm_shuffle_epi8(s, diag));
+	t2 = fugue_xtime(t);
+	t4 = fugue_xtime(t2);
+	t7 = _mm_xor_si128(_mm_xor_si128(t4, t2), t);
+	r = _mm_blend_epi16(t, t7, 0x30);
+	r = _mm_blend_epi16(r, t4, 0xC0);
+
+	return _mm_xor_si128(_mm_shuffle_epi8(c, shift_rows), r);
+}
+
+#define SMIX(x0, x1, x2, x3)   do { \
+		__m128i v = _mm_setr_epi32((int)(x0), (int)(x1), (int)(x2), (int)(x3)); \
+		v = fugue_smix(v); \
+		x0 = (sph_u32)_mm_cvtsi128_si32(v); \
+		x1 = (sph_u32)_mm_extract_epi32(v, 1); \
+		x2 = (sph_u32)_mm_extract_epi32(v, 2); \
+		x3 = (sph_u32)_mm_extract_epi32(v, 3); \
+	} while (0)
+
+#else
+
 #define SMIX(x0, x1, x2, x3)   do { \
 		sph_u32 c0 = 0; \
 		sph_u32 c1 = 0; \
@@ -510,6 +597,8 @@ static const sph_u32 mixtab3[] = {
 		/* */ \
 	} while (0)
 
+#endif
+
 #if SPH_FUGUE_NOCOPY
 
 #define DECL_STATE_SMALL
@@ -1108,6 +1197,16 @@ fugue4_close(sph_fugue_context *sc, unsigned ub, unsigned n, void *dst)
 	sph_fugue512_init(sc);
 }
 
+size_t
+sph_fugue_tables_size(void)
+{
+#if SPH_FUGUE_AESNI
+	return 0;
+#else
+	return sizeof mixtab0 + sizeof mixtab1 + sizeof mixtab2 + sizeof mixtab3;
+#endif
+}
+
 void
 sph_fugue224_init(void *cc)
 {
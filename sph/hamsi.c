@@ -104,6 +104,19 @@ extern "C"{
 #endif
 #endif
 
+/*
+ * With AVX2, Hamsi-384/512 use a vectorized compression (see below)
+ * which expands the message bit per bit from the 4 KB T512 table,
+ * instead of the 128 KB of tables of the byte-wise expansion.
+ */
+#if defined(__AVX2__) && !defined SPH_HAMSI_NO_SIMD && !defined SPH_HAMSI_EXPAND_BIG
+#define SPH_HAMSI_AVX2          1
+#define SPH_HAMSI_EXPAND_BIG    1
+#include <immintrin.h>
+#else
+#define SPH_HAMSI_AVX2          0
+#endif
+
 #if !defined SPH_HAMSI_EXPAND_BIG
 #define SPH_HAMSI_EXPAND_BIG    8
 #endif
@@ -617,6 +630,158 @@ hamsi_small_close(sph_hamsi_small_context *sc,
         c0 = (sc->h[0x0] ^= s00); \
     } while (0)
 
+#if SPH_HAMSI_AVX2
+
+#define V_XOR(a, b)   _mm256_xor_si256(a, b)
+#define V_AND(a, b)   _mm256_and_si256(a, b)
+#define V_OR(a, b)    _mm256_or_si256(a, b)
+#define V_ROTL(x, n)  V_OR(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+/* same sequence as SBOX, on 8 columns at once */
+#define V_SBOX(a, b, c, d)   do { \
+        __m256i t; \
+        t = (a); \
+        (a) = V_AND(a, c); \
+        (a) = V_XOR(a, d); \
+        (c) = V_XOR(c, b); \
+        (c) = V_XOR(c, a); \
+        (d) = V_OR(d, t); \
+        (d) = V_XOR(d, b); \
+        t = V_XOR(t, c); \
+        (b) = (d); \
+        (d) = V_OR(d, t); \
+        (d) = V_XOR(d, a); \
+        (a) = V_AND(a, b); \
+        t = V_XOR(t, a); \
+        (b) = V_XOR(b, d); \
+        (b) = V_XOR(b, t); \
+        (a) = (c); \
+        (c) = (b); \
+        (b) = (d); \
+        (d) = V_XOR(t, _mm256_set1_epi32(-1)); \
+    } while (0)
+
+#define V_L(a, b, c, d)   do { \
+        (a) = V_ROTL(a, 13); \
+        (c) = V_ROTL(c, 3); \
+        (b) = V_XOR(b, V_XOR(a, c)); \
+        (d) = V_XOR(d, V_XOR(c, _mm256_slli_epi32(a, 3))); \
+        (b) = V_ROTL(b, 1); \
+        (d) = V_ROTL(d, 7); \
+        (a) = V_XOR(a, V_XOR(b, d)); \
+        (c) = V_XOR(c, V_XOR(d, _mm256_slli_epi32(b, 7))); \
+        (a) = V_ROTL(a, 5); \
+        (c) = V_ROTL(c, 22); \
+    } while (0)
+
+/*
+ * The 32 state words are kept in 4 registers (s00-s07, s08-s0F,
+ * s10-s17 and s18-s1F), the bitsliced SBOX then works on the 8 columns
+ * in parallel. The first L layer uses diagonals, aligned with lane
+ * rotations; the second one is irregular and done on the stored words.
+ */
+static void
+hamsi_big_avx2(sph_hamsi_big_context *sc, const unsigned char *buf,
+    size_t num, const sph_u32 *alpha, unsigned rounds)
+{
+    const __m256i rot1 = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    const __m256i rot2 = _mm256_setr_epi32(2, 3, 4, 5, 6, 7, 0, 1);
+    const __m256i rot3 = _mm256_setr_epi32(3, 4, 5, 6, 7, 0, 1, 2);
+    const __m256i rot5 = _mm256_setr_epi32(5, 6, 7, 0, 1, 2, 3, 4);
+    const __m256i rot6 = _mm256_setr_epi32(6, 7, 0, 1, 2, 3, 4, 5);
+    const __m256i rot7 = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+    const __m256i al0 = _mm256_loadu_si256((const __m256i *)(alpha + 0x00));
+    const __m256i al1 = _mm256_loadu_si256((const __m256i *)(alpha + 0x08));
+    const __m256i al2 = _mm256_loadu_si256((const __m256i *)(alpha + 0x10));
+    const __m256i al3 = _mm256_loadu_si256((const __m256i *)(alpha + 0x18));
+    __m256i hlo = _mm256_loadu_si256((const __m256i *)(sc->h + 0));
+    __m256i hhi = _mm256_loadu_si256((const __m256i *)(sc->h + 8));
+
+    while (num -- > 0) {
+        sph_u32 w[32];
+        const sph_u32 *tp = &T512[0][0];
+        __m256i mlo = _mm256_setzero_si256();
+        __m256i mhi = _mm256_setzero_si256();
+        __m256i a, b, c, d, pm, pc;
+        unsigned u, v, r;
+
+        for (u = 0; u < 8; u ++) {
+            unsigned db = buf[u];
+            for (v = 0; v < 8; v ++, db >>= 1, tp += 16) {
+                __m256i dm = _mm256_set1_epi32(-(int)(db & 1));
+                mlo = V_XOR(mlo, V_AND(dm,
+                    _mm256_loadu_si256((const __m256i *)(tp + 0))));
+                mhi = V_XOR(mhi, V_AND(dm,
+                    _mm256_loadu_si256((const __m256i *)(tp + 8))));
+            }
+        }
+
+        /* s00-s07 = m0 m1 c0 c1 m2 m3 c2 c3, s08-s0F = c4 c5 m4 m5 ... */
+        pm = _mm256_permute4x64_epi64(mlo, 0xD8);
+        pc = _mm256_permute4x64_epi64(hlo, 0xD8);
+        a = _mm256_unpacklo_epi64(pm, pc);
+        b = _mm256_unpackhi_epi64(pc, pm);
+        pm = _mm256_permute4x64_epi64(mhi, 0xD8);
+        pc = _mm256_permute4x64_epi64(hhi, 0xD8);
+        c = _mm256_unpacklo_epi64(pm, pc);
+        d = _mm256_unpackhi_epi64(pc, pm);
+
+        for (r = 0; r < rounds; r ++) {
+            a = V_XOR(a, V_XOR(al0, _mm256_setr_epi32(0, (int)r, 0, 0, 0, 0, 0, 0)));
+            b = V_XOR(b, al1);
+            c = V_XOR(c, al2);
+            d = V_XOR(d, al3);
+            V_SBOX(a, b, c, d);
+            b = _mm256_permutevar8x32_epi32(b, rot1);
+            c = _mm256_permutevar8x32_epi32(c, rot2);
+            d = _mm256_permutevar8x32_epi32(d, rot3);
+            V_L(a, b, c, d);
+            _mm256_storeu_si256((__m256i *)(w + 0x00), a);
+            _mm256_storeu_si256((__m256i *)(w + 0x08), _mm256_permutevar8x32_epi32(b, rot7));
+            _mm256_storeu_si256((__m256i *)(w + 0x10), _mm256_permutevar8x32_epi32(c, rot6));
+            _mm256_storeu_si256((__m256i *)(w + 0x18), _mm256_permutevar8x32_epi32(d, rot5));
+            L(w[0x00], w[0x02], w[0x05], w[0x07]);
+            L(w[0x10], w[0x13], w[0x15], w[0x16]);
+            L(w[0x09], w[0x0B], w[0x0C], w[0x0E]);
+            L(w[0x19], w[0x1A], w[0x1C], w[0x1F]);
+            a = _mm256_loadu_si256((const __m256i *)(w + 0x00));
+            b = _mm256_loadu_si256((const __m256i *)(w + 0x08));
+            c = _mm256_loadu_si256((const __m256i *)(w + 0x10));
+            d = _mm256_loadu_si256((const __m256i *)(w + 0x18));
+        }
+
+        /* T_BIG */
+        hlo = V_XOR(hlo, a);
+        hhi = V_XOR(hhi, c);
+        buf += 8;
+    }
+    _mm256_storeu_si256((__m256i *)(sc->h + 0), hlo);
+    _mm256_storeu_si256((__m256i *)(sc->h + 8), hhi);
+}
+
+static void
+hamsi_big(sph_hamsi_big_context *sc, const unsigned char *buf, size_t num)
+{
+#if SPH_64
+    sc->count += (sph_u64)num << 6;
+#else
+    sph_u32 tmp = SPH_T32((sph_u32)num << 6);
+    sc->count_low = SPH_T32(sc->count_low + tmp);
+    sc->count_high += (sph_u32)((num >> 13) >> 13);
+    if (sc->count_low < tmp)
+        sc->count_high ++;
+#endif
+    hamsi_big_avx2(sc, buf, num, alpha_n, 6);
+}
+
+static void
+hamsi_big_final(sph_hamsi_big_context *sc, const unsigned char *buf)
+{
+    hamsi_big_avx2(sc, buf, 1, alpha_f, 12);
+}
+
+#else
+
 static void
 hamsi_big(sph_hamsi_big_context *sc, const unsigned char *buf, size_t num)
 {
@@ -661,6 +826,8 @@ hamsi_big_final(sph_hamsi_big_context *sc, const unsigned char *buf)
     WRITE_STATE_BIG(sc);
 }
 
+#endif
+
 static void
 hamsi_big_init(sph_hamsi_big_context *sc, const sph_u32 *iv)
 {
@@ -742,6 +909,19 @@ hamsi_big_close(sph_hamsi_big_context *sc,
     }
 }
 
+/* see sph_hamsi.h */
+size_t
+sph_hamsi512_tables_size(void)
+{
+    size_t rows = (size_t)(64 / SPH_HAMSI_EXPAND_BIG) << SPH_HAMSI_EXPAND_BIG;
+
+    if (SPH_HAMSI_EXPAND_BIG == 1)
+        rows = 64; /* T512, one row per input bit */
+    else if (64 % SPH_HAMSI_EXPAND_BIG)
+        rows += (size_t)1 << (64 % SPH_HAMSI_EXPAND_BIG);
+    return rows * 16 * sizeof(sph_u32) + sizeof alpha_n + sizeof alpha_f;
+}
+
 /* see sph_hamsi.h */
 void
 sph_hamsi224_init(void *cc)
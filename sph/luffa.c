@@ -44,6 +44,18 @@ extern "C"{
 #define SPH_LUFFA_PARALLEL   1
 #endif
 
+/*
+ * With AVX2, the Luffa-512 permutation processes the 5 sub-states at
+ * once: vector Wk holds the word k of each sub-state (one per lane),
+ * so SubCrumb, MixWord and the tweak become plain lane-wise operations.
+ */
+#if defined(__AVX2__) && !defined SPH_LUFFA_NO_SIMD
+#define SPH_LUFFA_AVX2   1
+#include <immintrin.h>
+#else
+#define SPH_LUFFA_AVX2   0
+#endif
+
 #ifdef _MSC_VER
 #pragma warning (disable: 4146)
 #endif
@@ -910,7 +922,96 @@ static const sph_u32 RC44[8] = {
 		V47 = SPH_ROTL32(V47, 4); \
 	} while (0)
 
-#if SPH_LUFFA_PARALLEL
+#if SPH_LUFFA_AVX2
+
+#define VROTL32(x, n)   _mm256_or_si256( \
+		_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+#define SUB_CRUMBV(a0, a1, a2, a3)   do { \
+		const __m256i ones = _mm256_set1_epi32(-1); \
+		__m256i tmp; \
+		tmp = (a0); \
+		(a0) = _mm256_or_si256(a0, a1); \
+		(a2) = _mm256_xor_si256(a2, a3); \
+		(a1) = _mm256_xor_si256(a1, ones); \
+		(a0) = _mm256_xor_si256(a0, a3); \
+		(a3) = _mm256_and_si256(a3, tmp); \
+		(a1) = _mm256_xor_si256(a1, a3); \
+		(a3) = _mm256_xor_si256(a3, a2); \
+		(a2) = _mm256_and_si256(a2, a0); \
+		(a0) = _mm256_xor_si256(a0, ones); \
+		(a2) = _mm256_xor_si256(a2, a1); \
+		(a1) = _mm256_or_si256(a1, a3); \
+		tmp = _mm256_xor_si256(tmp, a1); \
+		(a3) = _mm256_xor_si256(a3, a2); \
+		(a2) = _mm256_and_si256(a2, a1); \
+		(a1) = _mm256_xor_si256(a1, a0); \
+		(a0) = tmp; \
+	} while (0)
+
+#define MIX_WORDV(u, v)   do { \
+		(v) = _mm256_xor_si256(v, u); \
+		(u) = _mm256_xor_si256(VROTL32(u, 2), v); \
+		(v) = _mm256_xor_si256(VROTL32(v, 14), u); \
+		(u) = _mm256_xor_si256(VROTL32(u, 10), v); \
+		(v) = VROTL32(v, 1); \
+	} while (0)
+
+#define LOAD_W5(k) \
+	_mm256_setr_epi32((int)V0 ## k, (int)V1 ## k, (int)V2 ## k, \
+		(int)V3 ## k, (int)V4 ## k, 0, 0, 0)
+
+#define STORE_W5(k)   do { \
+		sph_u32 w[8]; \
+		_mm256_storeu_si256((__m256i *)w, W ## k); \
+		V0 ## k = w[0]; \
+		V1 ## k = w[1]; \
+		V2 ## k = w[2]; \
+		V3 ## k = w[3]; \
+		V4 ## k = w[4]; \
+	} while (0)
+
+#define P5   do { \
+		int r; \
+		const __m256i tw = _mm256_setr_epi32(0, 1, 2, 3, 4, 0, 0, 0); \
+		const __m256i tr = _mm256_setr_epi32(32, 31, 30, 29, 28, 32, 32, 32); \
+		__m256i W0, W1, W2, W3, W4, W5, W6, W7; \
+		W0 = LOAD_W5(0); \
+		W1 = LOAD_W5(1); \
+		W2 = LOAD_W5(2); \
+		W3 = LOAD_W5(3); \
+		W4 = LOAD_W5(4); \
+		W5 = LOAD_W5(5); \
+		W6 = LOAD_W5(6); \
+		W7 = LOAD_W5(7); \
+		/* TWEAK5, sub-state j words 4..7 rotated by j */ \
+		W4 = _mm256_or_si256(_mm256_sllv_epi32(W4, tw), _mm256_srlv_epi32(W4, tr)); \
+		W5 = _mm256_or_si256(_mm256_sllv_epi32(W5, tw), _mm256_srlv_epi32(W5, tr)); \
+		W6 = _mm256_or_si256(_mm256_sllv_epi32(W6, tw), _mm256_srlv_epi32(W6, tr)); \
+		W7 = _mm256_or_si256(_mm256_sllv_epi32(W7, tw), _mm256_srlv_epi32(W7, tr)); \
+		for (r = 0; r < 8; r ++) { \
+			SUB_CRUMBV(W0, W1, W2, W3); \
+			SUB_CRUMBV(W5, W6, W7, W4); \
+			MIX_WORDV(W0, W4); \
+			MIX_WORDV(W1, W5); \
+			MIX_WORDV(W2, W6); \
+			MIX_WORDV(W3, W7); \
+			W0 = _mm256_xor_si256(W0, _mm256_setr_epi32((int)RC00[r], \
+				(int)RC10[r], (int)RC20[r], (int)RC30[r], (int)RC40[r], 0, 0, 0)); \
+			W4 = _mm256_xor_si256(W4, _mm256_setr_epi32((int)RC04[r], \
+				(int)RC14[r], (int)RC24[r], (int)RC34[r], (int)RC44[r], 0, 0, 0)); \
+		} \
+		STORE_W5(0); \
+		STORE_W5(1); \
+		STORE_W5(2); \
+		STORE_W5(3); \
+		STORE_W5(4); \
+		STORE_W5(5); \
+		STORE_W5(6); \
+		STORE_W5(7); \
+	} while (0)
+
+#elif SPH_LUFFA_PARALLEL
 
 #define P5   do { \
 		int r; \
@@ -196,12 +196,40 @@ static void sha256d_80_swap(uint32_t *hash, const uint32_t *data)
 }
 
 void sha256d(unsigned char *hash, const unsigned char *data, int len)
+{
+	uint32_t S[8];
+
+	sha256_init(S);
+	sha256_resume(hash, S, data, 0, len, 1);
+}
+
+/* hash the complete 64-byte blocks of data, returns the bytes consumed */
+int sha256_midstate(uint32_t *midstate, const unsigned char *data, int len)
+{
+	uint32_t T[16];
+	int i, done;
+
+	sha256_init(midstate);
+	for (done = 0; done + 64 <= len; done += 64) {
+		for (i = 0; i < 16; i++)
+			T[i] = be32dec(data + done + 4 * i);
+		sha256_transform(midstate, T, 0);
+	}
+	return done;
+}
+
+/*
+ * finish the sha256 (dbl = 0) or sha256d of data[0..len), midstate being
+ * the state after the first done bytes (a multiple of 64)
+ */
+void sha256_resume(unsigned char *hash, const uint32_t *midstate,
+	const unsigned char *data, int done, int len, int dbl)
 {
 	uint32_t S[16], T[16];
 	int i, r;
 
-	sha256_init(S);
-	for (r = len; r > -9; r -= 64) {
+	memcpy(S, midstate, 32);
+	for (r = len - done; r > -9; r -= 64) {
 		if (r < 64)
 			memset(T, 0, 64);
 		memcpy(T, data + len - r, r > 64 ? 64 : (r < 0 ? 0 : r));
@@ -213,13 +241,42 @@ void sha256d(unsigned char *hash, const unsigned char *data, int len)
 			T[15] = 8 * len;
 		sha256_transform(S, T, 0);
 	}
-	memcpy(S + 8, sha256d_hash1 + 8, 32);
-	sha256_init(T);
-	sha256_transform(T, S, 0);
+	if (dbl) {
+		memcpy(S + 8, sha256d_hash1 + 8, 32);
+		sha256_init(T);
+		sha256_transform(T, S, 0);
+	} else
+		memcpy(T, S, 32);
 	for (i = 0; i < 8; i++)
 		be32enc((uint32_t *)hash + i, T[i]);
 }
 
+static const uint32_t sha256d_pad64[16] = {
+	0x80000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x00000000, 0x00000200
+};
+
+/*
+ * one merkle branch step, hash = sha256d(hash || branch), both given as
+ * big endian words so the chain never goes back to bytes
+ */
+void sha256d_merkle_step(uint32_t *hash, const uint32_t *branch)
+{
+	uint32_t S[16];
+
+	memcpy(S, hash, 32);
+	memcpy(S + 8, branch, 32);
+	sha256_init(hash);
+	sha256_transform(hash, S, 0);
+	sha256_transform(hash, sha256d_pad64, 0);
+	memcpy(S, hash, 32);
+	memcpy(S + 8, sha256d_hash1 + 8, 32);
+	sha256_init(hash);
+	sha256_transform(hash, S, 0);
+}
+
 static inline void sha256d_preextend(uint32_t *W)
 {
 	W[16] = s1(W[14]) + W[ 9] + s0(W[ 1]) + W[ 0];
@@ -223,6 +223,23 @@ void sph_bmw256_close(void *cc, void *dst);
 void sph_bmw256_addbits_and_close(
 	void *cc, unsigned ub, unsigned n, void *dst);
 
+/**
+ * Hash eight 80-byte messages which differ only by their last 32-bit
+ * word, such as block headers with distinct nonces. The provided context
+ * must hold the midstate obtained with <code>sph_bmw256_init()</code>
+ * followed by <code>sph_bmw256()</code> over the first 64 bytes of
+ * <code>data</code>; it is not modified and may be shared by several
+ * calls. Each nonce is encoded in little-endian at offset 76, and the
+ * eight 32-byte digests are written consecutively in <code>dst</code>.
+ *
+ * @param cc       the BMW-256 midstate context
+ * @param data     the 80-byte message (bytes 76 to 79 are ignored)
+ * @param nonces   the per-lane value of the last word
+ * @param dst      the destination buffer (256 bytes)
+ */
+void sph_bmw256_80_8way(const void *cc, const void *data,
+	const sph_u32 nonces[8], void *dst);
+
 #if SPH_64
 
 /**
@@ -315,6 +332,27 @@ void sph_bmw512_close(void *cc, void *dst);
 void sph_bmw512_addbits_and_close(
 	void *cc, unsigned ub, unsigned n, void *dst);
 
+/**
+ * Hash four consecutive 64-byte messages (a chained hash stage) and write
+ * the four 64-byte digests consecutively in <code>dst</code>, which may
+ * alias <code>src</code>.
+ *
+ * @param src   the input messages (256 bytes)
+ * @param dst   the destination buffer (256 bytes)
+ */
+void sph_bmw512_64_4way(const void *src, void *dst);
+
+/**
+ * Hash four 80-byte messages which differ only by their last 32-bit
+ * word, encoded in little-endian at offset 76. The four 64-byte digests
+ * are written consecutively in <code>dst</code>.
+ *
+ * @param data     the 80-byte message (bytes 76 to 79 are ignored)
+ * @param nonces   the per-lane value of the last word
+ * @param dst      the destination buffer (256 bytes)
+ */
+void sph_bmw512_80_4way(const void *data, const sph_u32 nonces[4], void *dst);
+
 #endif
 
 #endif
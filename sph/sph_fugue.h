@@ -74,6 +74,9 @@ void sph_fugue512_close(void *cc, void *dst);
 void sph_fugue512_addbits_and_close(
 	void *cc, unsigned ub, unsigned n, void *dst);
 
+/* size in bytes of the SMIX tables (0 with AES-NI) */
+size_t sph_fugue_tables_size(void);
+
 #ifdef __cplusplus
 }
 #endif	
@@ -312,6 +312,15 @@ void sph_hamsi512_close(void *cc, void *dst);
 void sph_hamsi512_addbits_and_close(
     void *cc, unsigned ub, unsigned n, void *dst);
 
+/**
+ * Get the size (in bytes) of the constant tables read by the
+ * Hamsi-384/512 compression, which depends on the expansion level
+ * and on the AVX2 implementation.
+ *
+ * @return  the tables size in bytes
+ */
+size_t sph_hamsi512_tables_size(void);
+
 
 
 #ifdef __cplusplus
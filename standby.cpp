@@ -0,0 +1,333 @@
+/**
+ * Standby stratum connections (--pool-standby)
+ *
+ * The next pools, of the current algo, are kept connected, subscribed and
+ * authorized. A single thread receives their jobs (one epoll loop on linux,
+ * select elsewhere), each connection is made by a short lived thread. On
+ * failover, pool_switch() takes the live connection of the new pool instead
+ * of connecting from scratch.
+ */
+#include <stdlib.h>
+#include <memory.h>
+
+#include "miner.h"
+#include "algos.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#define STANDBY_RETRY_TIME 30 /* seconds between failed connections */
+
+extern volatile bool pool_is_switching;
+
+enum standby_state {
+	SB_OFF = 0,
+	SB_CONNECTING,
+	SB_READY,
+};
+
+static struct {
+	volatile int state;
+	time_t retry_time;
+	struct stratum_ctx ctx; // owned by the standby thread until taken
+} standby[MAX_POOLS];
+
+static pthread_mutex_t standby_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef __linux__
+static int standby_epfd = -1;
+#endif
+
+int opt_pool_standby = 0;
+
+// the first opt_pool_standby usable stratum pools after the current one
+static bool standby_wanted(int pooln)
+{
+	int count = 0;
+	for (int i = 1; i < num_pools && count < opt_pool_standby; i++) {
+		int n = (cur_pooln + i) % num_pools;
+		struct pool_infos *p = &pools[n];
+		if (!(p->status & POOL_ST_VALID) || (p->status & (POOL_ST_DISABLED | POOL_ST_REMOVED)))
+			continue;
+		// switching the algo requires more than a connection
+		if (!(p->type & POOL_STRATUM) || p->algo != (int) opt_algo)
+			continue;
+		if (p->algo == ALGO_CRYPTOLIGHT || p->algo == ALGO_CRYPTONIGHT || p->algo == ALGO_WILDKECCAK)
+			continue; // rpc2 login
+		if (n == pooln)
+			return true;
+		count++;
+	}
+	return false;
+}
+
+static void standby_watch(int pooln, bool add)
+{
+#ifdef __linux__
+	struct epoll_event ev = { 0 };
+	ev.events = EPOLLIN;
+	ev.data.u32 = (uint32_t) pooln;
+	epoll_ctl(standby_epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, standby[pooln].ctx.sock, &ev);
+#endif
+}
+
+// called with standby_lock held
+static void standby_drop(int pooln)
+{
+	standby_watch(pooln, false);
+	stratum_disconnect(&standby[pooln].ctx);
+	standby[pooln].state = SB_OFF;
+	standby[pooln].retry_time = time(NULL) + STANDBY_RETRY_TIME;
+}
+
+/* connect, subscribe and authorize, in its own thread to keep the jobs of
+ * the ready pools flowing; the context is not used elsewhere meanwhile */
+static void *standby_connect_thread(void *arg)
+{
+	int pooln = (int) (intptr_t) arg;
+	struct pool_infos *p = &pools[pooln];
+	struct stratum_ctx *sctx = &standby[pooln].ctx;
+	struct timeval tv_start;
+	bool ok;
+
+	pthread_detach(pthread_self());
+
+	sctx->pooln = pooln;
+	gettimeofday(&tv_start, NULL);
+	ok = stratum_connect(sctx, p->url) && stratum_subscribe(sctx) &&
+		stratum_authorize(sctx, p->user, p->pass);
+	if (ok)
+		pool_latency_connect(pooln, &tv_start);
+
+	pthread_mutex_lock(&standby_lock);
+	if (ok && !abort_flag) {
+		standby[pooln].state = SB_READY;
+		standby_watch(pooln, true);
+		if (!opt_quiet)
+			applog(LOG_INFO, "Pool %d %s connected in standby", pooln,
+				strlen(p->name) ? p->name : p->short_url);
+	} else {
+		stratum_disconnect(sctx);
+		standby[pooln].state = SB_OFF;
+		standby[pooln].retry_time = time(NULL) + STANDBY_RETRY_TIME;
+	}
+	pthread_mutex_unlock(&standby_lock);
+	return NULL;
+}
+
+static void standby_connect(int pooln)
+{
+	pthread_t pth;
+
+	pthread_mutex_lock(&standby_lock);
+	standby[pooln].state = SB_CONNECTING;
+	pthread_mutex_unlock(&standby_lock);
+
+	if (unlikely(pthread_create(&pth, NULL, standby_connect_thread, (void*) (intptr_t) pooln))) {
+		applog(LOG_ERR, "standby connect thread create failed");
+		pthread_mutex_lock(&standby_lock);
+		standby[pooln].state = SB_OFF;
+		standby[pooln].retry_time = time(NULL) + STANDBY_RETRY_TIME;
+		pthread_mutex_unlock(&standby_lock);
+	}
+}
+
+static bool standby_line_buffered(struct stratum_ctx *sctx)
+{
+	return sctx->sockbuf && sctx->sockbuf_wpos > sctx->sockbuf_rpos &&
+		memchr(sctx->sockbuf + sctx->sockbuf_rpos, '\n', sctx->sockbuf_wpos - sctx->sockbuf_rpos);
+}
+
+// wait up to 1s for data on the standby sockets
+static void standby_poll(bool *readable)
+{
+	int n;
+#ifdef __linux__
+	struct epoll_event ev[MAX_POOLS];
+	int nev = epoll_wait(standby_epfd, ev, MAX_POOLS, 1000);
+	for (int i = 0; i < nev; i++)
+		readable[ev[i].data.u32] = true;
+#else
+	struct timeval tv = { 1, 0 };
+	curl_socket_t maxfd = 0;
+	bool any = false;
+	fd_set rd;
+
+	FD_ZERO(&rd);
+	pthread_mutex_lock(&standby_lock);
+	for (n = 0; n < num_pools; n++) {
+		if (standby[n].state != SB_READY)
+			continue;
+		FD_SET(standby[n].ctx.sock, &rd);
+		maxfd = max(maxfd, standby[n].ctx.sock);
+		any = true;
+	}
+	pthread_mutex_unlock(&standby_lock);
+	if (!any) {
+		sleep(1);
+		return;
+	}
+	if (select((int) maxfd + 1, &rd, NULL, NULL, &tv) > 0) {
+		for (n = 0; n < num_pools; n++)
+			if (standby[n].state == SB_READY && FD_ISSET(standby[n].ctx.sock, &rd))
+				readable[n] = true;
+	}
+#endif
+	for (n = 0; n < num_pools; n++)
+		if (standby[n].state == SB_READY && standby_line_buffered(&standby[n].ctx))
+			readable[n] = true;
+}
+
+/* --pool-select=latency, move to a standby pool which sees the blocks
+ * clearly before the current one */
+#define STANDBY_SELECT_TIME 60
+#define STANDBY_SELECT_GAIN 50. /* ms */
+static void standby_select()
+{
+	double cur_risk = pool_stale_risk(cur_pooln);
+	double best = 0.;
+	int pooln = -1;
+
+	if (cur_risk < 0. || pool_is_switching)
+		return;
+	for (int n = 0; n < num_pools; n++) {
+		double risk = pool_stale_risk(n);
+		if (n == cur_pooln || risk < 0. || standby[n].state != SB_READY)
+			continue;
+		if (pooln < 0 || risk < best) {
+			best = risk;
+			pooln = n;
+		}
+	}
+	if (pooln >= 0 && best + STANDBY_SELECT_GAIN < cur_risk) {
+		applog(LOG_INFO, "Pool %d stale risk %.0f ms, %.0f ms on pool %d", cur_pooln,
+			cur_risk, best, pooln);
+		pool_switch(-1, pooln);
+	}
+}
+
+static void *standby_thread(void *userdata)
+{
+	time_t select_time = time(NULL);
+
+	while (!abort_flag) {
+		bool readable[MAX_POOLS] = { 0 };
+		time_t now = time(NULL);
+		int n;
+
+		for (n = 0; n < num_pools; n++) {
+			bool wanted = standby_wanted(n);
+			pthread_mutex_lock(&standby_lock);
+			if (!wanted && standby[n].state == SB_READY) {
+				standby_drop(n);
+				standby[n].retry_time = 0;
+			}
+			pthread_mutex_unlock(&standby_lock);
+			if (wanted && standby[n].state == SB_OFF && now >= standby[n].retry_time)
+				standby_connect(n);
+		}
+
+		if (opt_pool_select_latency && now >= select_time + STANDBY_SELECT_TIME) {
+			select_time = now;
+			standby_select();
+		}
+
+		standby_poll(readable);
+
+		for (n = 0; n < num_pools; n++) {
+			struct stratum_ctx *sctx = &standby[n].ctx;
+			if (!readable[n])
+				continue;
+			pthread_mutex_lock(&standby_lock);
+			// may have been taken by pool_switch()
+			while (standby[n].state == SB_READY) {
+				char *s = stratum_recv_line(sctx);
+				if (!s) {
+					if (!opt_quiet)
+						applog(LOG_WARNING, "Pool %d standby connection lost", n);
+					standby_drop(n);
+					break;
+				}
+				// answers are not expected, only notifications
+				stratum_handle_method(sctx, s);
+				if (!sctx->curl) { // client.reconnect
+					standby_drop(n);
+					standby[n].retry_time = 0;
+					break;
+				}
+				if (!standby_line_buffered(sctx))
+					break;
+			}
+			pthread_mutex_unlock(&standby_lock);
+		}
+	}
+
+	pthread_mutex_lock(&standby_lock);
+	for (int n = 0; n < MAX_POOLS; n++)
+		if (standby[n].state == SB_READY)
+			standby_drop(n);
+	pthread_mutex_unlock(&standby_lock);
+	return NULL;
+}
+
+bool pool_standby_start(struct thr_info *thr)
+{
+#ifdef __linux__
+	standby_epfd = epoll_create(MAX_POOLS);
+	if (standby_epfd < 0) {
+		applog(LOG_ERR, "standby epoll init failed");
+		return false;
+	}
+#endif
+	if (unlikely(pthread_create(&thr->pth, NULL, standby_thread, thr))) {
+		applog(LOG_ERR, "standby thread create failed");
+		return false;
+	}
+	return true;
+}
+
+/* first pool from startfrom with a standby connection and a job, -1 if none */
+int pool_standby_next(int startfrom)
+{
+	int ret = -1;
+	if (!opt_pool_standby)
+		return -1;
+	pthread_mutex_lock(&standby_lock);
+	for (int i = 0; i < num_pools; i++) {
+		int n = (startfrom + i) % num_pools;
+		if (n != cur_pooln && standby[n].state == SB_READY && standby[n].ctx.job.job_id) {
+			ret = n;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&standby_lock);
+	return ret;
+}
+
+/**
+ * Move the standby connection of a pool to pools[pooln].stratum, the
+ * previous (disconnected) context of the pool is kept for a later use.
+ */
+bool pool_standby_take(int pooln)
+{
+	struct stratum_ctx sctx;
+	bool ret = false;
+
+	if (!opt_pool_standby || pooln < 0 || pooln >= MAX_POOLS)
+		return false;
+
+	pthread_mutex_lock(&standby_lock);
+	if (standby[pooln].state == SB_READY && standby[pooln].ctx.job.job_id) {
+		standby_watch(pooln, false);
+		sctx = pools[pooln].stratum;
+		pools[pooln].stratum = standby[pooln].ctx;
+		standby[pooln].ctx = sctx;
+		standby[pooln].ctx.curl = NULL;
+		standby[pooln].state = SB_OFF;
+		standby[pooln].retry_time = 0;
+		ret = true;
+	}
+	pthread_mutex_unlock(&standby_lock);
+	return ret;
+}
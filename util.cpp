@@ -34,9 +34,11 @@
 #include <netinet/tcp.h>
 #endif
 #include "miner.h"
-#include "elist.h"
+#include "algos.h"
 
 #include "crypto/xmr-rpc.h"
+#include "sph/sph_hamsi.h"
+#include "sph/sph_fugue.h"
 
 extern pthread_mutex_t stratum_sock_lock;
 extern pthread_mutex_t stratum_work_lock;
@@ -61,20 +63,37 @@ struct header_info {
 	char		*stratum_url;
 };
 
-struct tq_ent {
-	void			*data;
-	struct list_head	q_node;
+/* bounded multi-producer single-consumer queue (D. Vyukov), the consumer
+ * only takes the mutex to sleep when the queue is empty */
+#define TQ_SIZE 256 /* power of 2 */
+
+struct tq_cell {
+	volatile uint32_t seq;
+	void *data;
 };
 
 struct thread_q {
-	struct list_head	q;
+	struct tq_cell cell[TQ_SIZE];
+
+	volatile uint32_t tail; // next push, shared by producers
+	char padding1[128 - sizeof(uint32_t)];
+	uint32_t head; // next pop, owned by the consumer
+	volatile uint32_t waiting;
+	char padding2[128 - 2 * sizeof(uint32_t)];
 
-	bool frozen;
+	volatile bool frozen;
 
 	pthread_mutex_t		mutex;
 	pthread_cond_t		cond;
 };
 
+#ifdef _MSC_VER
+#define tq_cas(ptr, oldv, newv) \
+	(InterlockedCompareExchange((volatile LONG*)(ptr), (LONG)(newv), (LONG)(oldv)) == (LONG)(oldv))
+#else
+#define tq_cas(ptr, oldv, newv) __sync_bool_compare_and_swap(ptr, oldv, newv)
+#endif
+
 void applog(int prio, const char *fmt, ...)
 {
 	va_list ap;
@@ -419,66 +438,298 @@ static int sockopt_keepalive_cb(void *userdata, curl_socket_t fd,
 }
 #endif
 
+/* Pool of the curl handles used for the http requests: a handle keeps
+ * the options and the headers of its last kind of request, and all the
+ * handles share the connections, tls sessions and dns cache, so a call
+ * only sets the options of the request and reuses a kept-alive socket.
+ */
+#define CURL_POOL_MAX 8
+#define CURL_STATS_MAX 16
+
+struct curl_conn {
+	CURL *curl;
+	int conf; // CURL_CONF_*, of the options set
+	struct curl_slist *headers[CURL_CONF_MAX];
+	char err_str[CURL_ERROR_SIZE];
+};
+
+static struct curl_conn *curl_pool[CURL_POOL_MAX];
+static int curl_pool_count = 0;
+static pthread_mutex_t curl_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct curl_stat_data curl_stats[CURL_STATS_MAX];
+static int curl_stats_count = 0;
+
+#if LIBCURL_VERSION_NUM >= 0x073900
+static CURLSH *curl_share = NULL;
+static pthread_mutex_t curl_share_locks[CURL_LOCK_DATA_LAST];
+
+static void curl_share_lock_cb(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	pthread_mutex_lock(&curl_share_locks[data]);
+}
+
+static void curl_share_unlock_cb(CURL *curl, curl_lock_data data, void *userptr)
+{
+	pthread_mutex_unlock(&curl_share_locks[data]);
+}
+
+// called with curl_pool_lock
+static void curl_pool_share()
+{
+	if (curl_share)
+		return;
+	for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&curl_share_locks[i], NULL);
+	curl_share = curl_share_init();
+	if (!curl_share)
+		return;
+	curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, curl_share_lock_cb);
+	curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, curl_share_unlock_cb);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+#else
+/* connections shared since libcurl 7.57, each handle keeps its own */
+static void curl_pool_share() { }
+#endif
+
+static struct curl_conn *curl_conn_of(CURL *curl)
+{
+	char *conn = NULL;
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, &conn);
+	return (struct curl_conn *) conn;
+}
+
+static void curl_conn_attach(struct curl_conn *conn)
+{
+	curl_easy_setopt(conn->curl, CURLOPT_PRIVATE, conn);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	if (curl_share)
+		curl_easy_setopt(conn->curl, CURLOPT_SHARE, curl_share);
+#endif
+}
+
+/* a handle from the pool, or a new one */
+CURL *curl_conn_get()
+{
+	struct curl_conn *conn = NULL;
+
+	pthread_mutex_lock(&curl_pool_lock);
+	curl_pool_share();
+	if (curl_pool_count)
+		conn = curl_pool[--curl_pool_count];
+	pthread_mutex_unlock(&curl_pool_lock);
+	if (conn)
+		return conn->curl;
+
+	conn = (struct curl_conn *) calloc(1, sizeof(*conn));
+	if (!conn)
+		return NULL;
+	conn->curl = curl_easy_init();
+	if (!conn->curl) {
+		free(conn);
+		return NULL;
+	}
+	curl_conn_attach(conn);
+	return conn->curl;
+}
+
+/* give back a handle of curl_conn_get(), it keeps its connections */
+void curl_conn_put(CURL *curl)
+{
+	struct curl_conn *conn;
+
+	if (!curl)
+		return;
+	conn = curl_conn_of(curl);
+	if (conn) {
+		pthread_mutex_lock(&curl_pool_lock);
+		if (curl_pool_count < CURL_POOL_MAX) {
+			curl_pool[curl_pool_count++] = conn;
+			conn = NULL;
+		}
+		pthread_mutex_unlock(&curl_pool_lock);
+		if (!conn)
+			return;
+		for (int i = 0; i < CURL_CONF_MAX; i++)
+			curl_slist_free_all(conn->headers[i]);
+		free(conn);
+	}
+	curl_easy_cleanup(curl);
+}
+
+/* returns true when the options of this kind of request must be set */
+bool curl_conn_setup(CURL *curl, int conf)
+{
+	struct curl_conn *conn = curl_conn_of(curl);
+	if (conn)
+		conn->err_str[0] = '\0';
+	if (conn && conn->conf == conf)
+		return false;
+	curl_easy_reset(curl);
+	if (conn) {
+		curl_conn_attach(conn);
+		curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, conn->err_str);
+		conn->conf = conf;
+	}
+	return true;
+}
+
+/* constant headers of the kind, kept with the handle (owned) */
+struct curl_slist *curl_conn_headers(CURL *curl, int conf, struct curl_slist *(*build)())
+{
+	struct curl_conn *conn = curl_conn_of(curl);
+	if (!conn)
+		return NULL;
+	if (!conn->headers[conf])
+		conn->headers[conf] = build();
+	return conn->headers[conf];
+}
+
+/* error text of the last request, empty if none */
+char *curl_conn_error(CURL *curl)
+{
+	static char none[1] = { 0 };
+	struct curl_conn *conn = curl_conn_of(curl);
+	if (!conn)
+		return none;
+	return conn->err_str;
+}
+
+/* store the time of a request, by endpoint (rpc method or url kind) */
+void curl_conn_stat(CURL *curl, const char *endpoint, bool success)
+{
+	double total = 0.;
+	long connects = 0;
+	struct curl_stat_data *s = NULL;
+
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+	pthread_mutex_lock(&curl_pool_lock);
+	for (int i = 0; i < curl_stats_count; i++) {
+		if (!strcmp(curl_stats[i].endpoint, endpoint)) {
+			s = &curl_stats[i];
+			break;
+		}
+	}
+	if (!s && curl_stats_count < CURL_STATS_MAX) {
+		s = &curl_stats[curl_stats_count++];
+		snprintf(s->endpoint, sizeof(s->endpoint), "%s", endpoint);
+	}
+	if (s) {
+		uint32_t ms = (uint32_t) (total * 1000.);
+		s->count++;
+		if (!success) s->errors++;
+		s->connects += (uint32_t) connects;
+		s->total_ms += ms;
+		s->max_ms = max(s->max_ms, ms);
+		s->last_ms = ms;
+	}
+	pthread_mutex_unlock(&curl_pool_lock);
+
+	if (opt_protocol)
+		applog(LOG_DEBUG, "%s: %.2f ms%s", endpoint, total * 1000.,
+			connects ? ", new connection" : "");
+}
+
+int curl_conn_get_stats(struct curl_stat_data *data, int max_records)
+{
+	int records;
+	pthread_mutex_lock(&curl_pool_lock);
+	records = min(curl_stats_count, max_records);
+	memcpy(data, curl_stats, records * sizeof(*data));
+	pthread_mutex_unlock(&curl_pool_lock);
+	return records;
+}
+
+static struct curl_slist *rpc_headers()
+{
+	struct curl_slist *headers = NULL;
+	headers = curl_slist_append(headers, "Content-Type: application/json");
+	headers = curl_slist_append(headers, "User-Agent: " USER_AGENT);
+	headers = curl_slist_append(headers, "X-Mining-Extensions: longpoll noncerange reject-reason");
+	headers = curl_slist_append(headers, "Accept:"); /* disable Accept hdr*/
+	headers = curl_slist_append(headers, "Expect:"); /* disable Expect hdr*/
+	return headers;
+}
+
+/* "method" of the request, for the stats */
+static void rpc_method_name(const char *rpc_req, char *name, size_t len)
+{
+	const char *p = strstr(rpc_req, "\"method\"");
+	snprintf(name, len, "rpc");
+	if (!p || !(p = strchr(p + 8, '"')))
+		return;
+	p++;
+	size_t n = strcspn(p, "\"");
+	if (n && n < len) {
+		memcpy(name, p, n);
+		name[n] = '\0';
+	}
+}
+
 /* For getwork (longpoll or wallet) - not stratum pools!
  * DO NOT USE DIRECTLY
  */
 static json_t *json_rpc_call(CURL *curl, const char *url,
 		      const char *userpass, const char *rpc_req,
-		      bool longpoll_scan, bool longpoll, bool keepalive, int *curl_err)
+		      bool longpoll_scan, bool longpoll, bool keepalive, bool null_ok, int *curl_err)
 {
 	json_t *val, *err_val, *res_val;
 	int rc;
 	struct data_buffer all_data = { 0 };
 	struct upload_buffer upload_data;
 	json_error_t err;
-	struct curl_slist *headers = NULL;
+	struct curl_slist *own_headers = NULL;
 	char *httpdata;
-	char len_hdr[64], hashrate_hdr[64];
-	char curl_err_str[CURL_ERROR_SIZE] = { 0 };
+	char len_hdr[64], hashrate_hdr[64], endpoint[32];
 	long timeout = longpoll ? opt_timeout : opt_timeout/2;
 	struct header_info hi = { 0 };
 	bool lp_scanning = longpoll_scan && !have_longpoll;
 
-	/* it is assumed that 'curl' is freshly [re]initialized at this pt */
+	/* the handle keeps the constant options of the rpc requests */
+	if (curl_conn_setup(curl, CURL_CONF_RPC)) {
+		if (opt_protocol)
+			curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
+		if (opt_cert) {
+			curl_easy_setopt(curl, CURLOPT_CAINFO, opt_cert);
+			// ignore CN domain name, allow to move cert files
+			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
+		}
+		curl_easy_setopt(curl, CURLOPT_ENCODING, "");
+		curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0);
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+		curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, all_data_cb);
+		curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_data_cb);
+#if LIBCURL_VERSION_NUM >= 0x071200
+		curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, &seek_data_cb);
+#endif
+		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, resp_hdr_cb);
+		if (opt_proxy) {
+			curl_easy_setopt(curl, CURLOPT_PROXY, opt_proxy);
+			curl_easy_setopt(curl, CURLOPT_PROXYTYPE, opt_proxy_type);
+		}
+		curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+		curl_easy_setopt(curl, CURLOPT_POST, 1);
+	}
 
-	if (opt_protocol)
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
 	curl_easy_setopt(curl, CURLOPT_URL, url);
-	if (opt_cert) {
-		curl_easy_setopt(curl, CURLOPT_CAINFO, opt_cert);
-		// ignore CN domain name, allow to move cert files
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
-	}
-	curl_easy_setopt(curl, CURLOPT_ENCODING, "");
-	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 0);
-	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-	curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, all_data_cb);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &all_data);
-	curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_data_cb);
 	curl_easy_setopt(curl, CURLOPT_READDATA, &upload_data);
 #if LIBCURL_VERSION_NUM >= 0x071200
-	curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, &seek_data_cb);
 	curl_easy_setopt(curl, CURLOPT_SEEKDATA, &upload_data);
 #endif
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, curl_err_str);
-	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, resp_hdr_cb);
 	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &hi);
-	if (opt_proxy) {
-		curl_easy_setopt(curl, CURLOPT_PROXY, opt_proxy);
-		curl_easy_setopt(curl, CURLOPT_PROXYTYPE, opt_proxy_type);
-	}
-	if (userpass) {
-		curl_easy_setopt(curl, CURLOPT_USERPWD, userpass);
-		curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-	}
+	curl_easy_setopt(curl, CURLOPT_USERPWD, userpass);
 #if LIBCURL_VERSION_NUM >= 0x070f06
-	if (keepalive)
-		curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, sockopt_keepalive_cb);
+	curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, keepalive ? sockopt_keepalive_cb : NULL);
 #endif
-	curl_easy_setopt(curl, CURLOPT_POST, 1);
 
 	if (opt_protocol)
 		applog(LOG_DEBUG, "JSON protocol request:\n%s", rpc_req);
@@ -489,22 +740,28 @@ static json_t *json_rpc_call(CURL *curl, const char *url,
 	sprintf(len_hdr, "Content-Length: %lu", (unsigned long) upload_data.len);
 	sprintf(hashrate_hdr, "X-Mining-Hashrate: %llu", (unsigned long long) global_hashrate);
 
-	headers = curl_slist_append(headers, "Content-Type: application/json");
-	headers = curl_slist_append(headers, len_hdr);
-	headers = curl_slist_append(headers, "User-Agent: " USER_AGENT);
-	headers = curl_slist_append(headers, "X-Mining-Extensions: longpoll noncerange reject-reason");
-	headers = curl_slist_append(headers, hashrate_hdr);
-	headers = curl_slist_append(headers, "Accept:"); /* disable Accept hdr*/
-	headers = curl_slist_append(headers, "Expect:"); /* disable Expect hdr*/
+	/* the request headers are linked before the kept ones */
+	struct curl_slist *headers = curl_conn_headers(curl, CURL_CONF_RPC, rpc_headers);
+	if (!headers)
+		headers = own_headers = rpc_headers();
+	struct curl_slist hdr_len = { len_hdr, headers };
+	struct curl_slist hdr_hashrate = { hashrate_hdr, &hdr_len };
 
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, &hdr_hashrate);
+
+	if (longpoll)
+		snprintf(endpoint, sizeof(endpoint), "longpoll");
+	else
+		rpc_method_name(rpc_req, endpoint, sizeof(endpoint));
 
 	rc = curl_easy_perform(curl);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+	curl_conn_stat(curl, endpoint, rc == 0);
 	if (curl_err != NULL)
 		*curl_err = rc;
 	if (rc) {
 		if (!(longpoll && rc == CURLE_OPERATION_TIMEDOUT)) {
-			applog(LOG_ERR, "HTTP request failed: %s", curl_err_str);
+			applog(LOG_ERR, "HTTP request failed: %s", curl_conn_error(curl));
 			goto err_out;
 		}
 	}
@@ -561,7 +818,7 @@ static json_t *json_rpc_call(CURL *curl, const char *url,
 	res_val = json_object_get(val, "result");
 	err_val = json_object_get(val, "error");
 
-	if (!res_val || json_is_null(res_val) ||
+	if (!res_val || (json_is_null(res_val) && !null_ok) ||
 	    (err_val && !json_is_null(err_val))) {
 		char *s = NULL;
 
@@ -598,8 +855,7 @@ static json_t *json_rpc_call(CURL *curl, const char *url,
 		json_object_set_new(val, "reject-reason", json_string(hi.reason));
 
 	databuf_free(&all_data);
-	curl_slist_free_all(headers);
-	curl_easy_reset(curl);
+	curl_slist_free_all(own_headers);
 	return val;
 
 err_out:
@@ -607,8 +863,7 @@ err_out:
 	free(hi.reason);
 	free(hi.stratum_url);
 	databuf_free(&all_data);
-	curl_slist_free_all(headers);
-	curl_easy_reset(curl);
+	curl_slist_free_all(own_headers);
 	return NULL;
 }
 
@@ -621,7 +876,17 @@ json_t *json_rpc_call_pool(CURL *curl, struct pool_infos *pool, const char *req,
 	snprintf(userpass, sizeof(userpass), "%s%c%s", pool->user,
 		strlen(pool->pass)?':':'\0', pool->pass);
 
-	return json_rpc_call(curl, pool->url, userpass, req, longpoll_scan, false, false, curl_err);
+	return json_rpc_call(curl, pool->url, userpass, req, longpoll_scan, false, false, false, curl_err);
+}
+
+/* same, for the calls with a null result on success (submitblock) */
+json_t *json_rpc_call_pool_null(CURL *curl, struct pool_infos *pool, const char *req, int *curl_err)
+{
+	char userpass[512];
+	snprintf(userpass, sizeof(userpass), "%s%c%s", pool->user,
+		strlen(pool->pass)?':':'\0', pool->pass);
+
+	return json_rpc_call(curl, pool->url, userpass, req, false, false, false, true, curl_err);
 }
 
 /* called only from longpoll thread, we have the lp_url */
@@ -634,7 +899,7 @@ json_t *json_rpc_longpoll(CURL *curl, char *lp_url, struct pool_infos *pool, con
 	// on pool rotate by time-limit, this keepalive can be a problem
 	bool keepalive = pool->time_limit == 0 || pool->time_limit > opt_timeout;
 
-	return json_rpc_call(curl, lp_url, userpass, req, false, true, keepalive, curl_err);
+	return json_rpc_call(curl, lp_url, userpass, req, false, true, keepalive, false, curl_err);
 }
 
 json_t *json_load_url(char* cfg_url, json_error_t *err)
@@ -827,6 +1092,47 @@ bool fulltest(const uint32_t *hash, const uint32_t *target)
 	return rc;
 }
 
+/* cpu scan (--cpu-scan) with a batch hash of the header nonces, 8 per call */
+int scanhash_cpu_batch(int thr_id, struct work *work, uint32_t max_nonce, unsigned long *hashes_done,
+	void (*hash_batch)(void *output, const void *input, const uint32_t *nonces, int count))
+{
+	uint32_t _ALIGN(64) endiandata[20];
+	uint32_t _ALIGN(64) vhash[8][8];
+	uint32_t _ALIGN(32) nonces[8];
+	uint32_t *pdata = work->data;
+	uint32_t *ptarget = work->target;
+	const uint32_t first_nonce = pdata[19];
+	const uint32_t Htarg = ptarget[7];
+	uint32_t n = first_nonce;
+
+	for (int k=0; k < 19; k++) {
+		be32enc(&endiandata[k], pdata[k]);
+	}
+
+	do {
+		for (int k = 0; k < 8; k++)
+			nonces[k] = n + k;
+		hash_batch(vhash, endiandata, nonces, 8);
+
+		for (int k = 0; k < 8; k++) {
+			if (vhash[k][7] <= Htarg && fulltest(vhash[k], ptarget)) {
+				work->nonces[0] = nonces[k];
+				work->valid_nonces = 1;
+				work_set_target_ratio(work, vhash[k]);
+				pdata[19] = nonces[k] + 1;
+				*hashes_done = pdata[19] - first_nonce;
+				return 1;
+			}
+		}
+		n += 8;
+
+	} while ((uint64_t) n + 8 <= max_nonce && !work_restart[thr_id].restart);
+
+	pdata[19] = n;
+	*hashes_done = pdata[19] - first_nonce;
+	return 0;
+}
+
 // Only used by stratum pools
 void diff_to_target(uint32_t *target, double diff)
 {
@@ -879,8 +1185,40 @@ double target_to_diff(uint32_t* target)
 #define socket_blocks() (errno == EAGAIN || errno == EWOULDBLOCK)
 #endif
 
-static bool send_line(curl_socket_t sock, char *s)
+#ifdef WIN32
+#define socket_set_blocks() WSASetLastError(WSAEWOULDBLOCK)
+#else
+#define socket_set_blocks() (errno = EAGAIN)
+#endif
+
+/* tls streams are read and written by curl, errors as the socket ones */
+static ssize_t stratum_tls_io(struct stratum_ctx *sctx, char *buf, size_t len, bool write)
 {
+	size_t n = 0;
+	CURLcode rc;
+
+	if (write)
+		rc = curl_easy_send(sctx->curl, buf, len, &n);
+	else
+		rc = curl_easy_recv(sctx->curl, buf, len, &n);
+	if (rc == CURLE_AGAIN) {
+		socket_set_blocks();
+		return -1;
+	}
+	if (rc != CURLE_OK) {
+#ifdef WIN32
+		WSASetLastError(WSAECONNRESET);
+#else
+		errno = ECONNRESET;
+#endif
+		return write ? -1 : 0;
+	}
+	return (ssize_t) n;
+}
+
+static bool send_line(struct stratum_ctx *sctx, char *s)
+{
+	curl_socket_t sock = sctx->sock;
 	ssize_t len, sent = 0;
 	
 	len = (ssize_t)strlen(s);
@@ -895,7 +1233,10 @@ static bool send_line(curl_socket_t sock, char *s)
 		FD_SET(sock, &wd);
 		if (select((int)sock + 1, NULL, &wd, NULL, &timeout) < 1)
 			return false;
-		n = send(sock, s + sent, len, 0);
+		if (sctx->tls)
+			n = stratum_tls_io(sctx, s + sent, len, true);
+		else
+			n = send(sock, s + sent, len, 0);
 		if (n < 0) {
 			if (!socket_blocks())
 				return false;
@@ -916,8 +1257,10 @@ bool stratum_send_line(struct stratum_ctx *sctx, char *s)
 		applog(LOG_DEBUG, "> %s", s);
 
 	pthread_mutex_lock(&stratum_sock_lock);
-	ret = send_line(sctx->sock, s);
+	ret = send_line(sctx, s);
 	pthread_mutex_unlock(&stratum_sock_lock);
+	if (ret)
+		stratum_record(sctx, '>', s);
 
 	return ret;
 }
@@ -939,35 +1282,72 @@ static bool socket_full(curl_socket_t sock, int timeout)
 bool stratum_socket_full(struct stratum_ctx *sctx, int timeout)
 {
 	if (!sctx->sockbuf) return false;
-	return strlen(sctx->sockbuf) || socket_full(sctx->sock, timeout);
+	return sctx->sockbuf_wpos > sctx->sockbuf_rpos || socket_full(sctx->sock, timeout);
+}
+
+#define RBUFSIZE 16384
+#define RECVSIZE (RBUFSIZE / 4)
+
+static void stratum_buffer_reset(struct stratum_ctx *sctx)
+{
+	sctx->sockbuf_rpos = sctx->sockbuf_wpos = sctx->sockbuf_scan = 0;
 }
 
-#define RBUFSIZE 2048
-#define RECVSIZE (RBUFSIZE - 4)
+/* next complete line of the receive buffer, terminated in place */
+static char *stratum_buffer_line(struct stratum_ctx *sctx)
+{
+	while (sctx->sockbuf_scan < sctx->sockbuf_wpos) {
+		char *line = sctx->sockbuf + sctx->sockbuf_rpos;
+		char *nl = (char*) memchr(sctx->sockbuf + sctx->sockbuf_scan, '\n',
+			sctx->sockbuf_wpos - sctx->sockbuf_scan);
+		if (!nl) {
+			sctx->sockbuf_scan = sctx->sockbuf_wpos;
+			break;
+		}
+		*nl = '\0';
+		sctx->sockbuf_rpos = sctx->sockbuf_scan = (nl - sctx->sockbuf) + 1;
+		if (*line) // skip empty lines
+			return line;
+	}
+	return NULL;
+}
 
-static void stratum_buffer_append(struct stratum_ctx *sctx, const char *s)
+/* make room for one recv, lines are kept contiguous so the consumed part
+ * is dropped (and only then the pending bytes moved) instead of wrapping */
+static void stratum_buffer_reserve(struct stratum_ctx *sctx)
 {
-	size_t old, snew;
+	size_t pending;
+
+	if (sctx->sockbuf_size - sctx->sockbuf_wpos >= RECVSIZE)
+		return;
 
-	old = strlen(sctx->sockbuf);
-	snew = old + strlen(s) + 1;
-	if (snew >= sctx->sockbuf_size) {
-		sctx->sockbuf_size = snew + (RBUFSIZE - (snew % RBUFSIZE));
+	pending = sctx->sockbuf_wpos - sctx->sockbuf_rpos;
+	if (sctx->sockbuf_rpos) {
+		memmove(sctx->sockbuf, sctx->sockbuf + sctx->sockbuf_rpos, pending);
+		sctx->sockbuf_scan -= sctx->sockbuf_rpos;
+		sctx->sockbuf_wpos = pending;
+		sctx->sockbuf_rpos = 0;
+	}
+	if (sctx->sockbuf_size - sctx->sockbuf_wpos < RECVSIZE) {
+		sctx->sockbuf_size *= 2;
 		sctx->sockbuf = (char*)realloc(sctx->sockbuf, sctx->sockbuf_size);
 	}
-	strcpy(sctx->sockbuf + old, s);
 }
 
 char *stratum_recv_line(struct stratum_ctx *sctx)
 {
-	ssize_t len, buflen;
-	char *tok, *sret = NULL;
+	char *sret = NULL;
 	int timeout = opt_timeout;
 
 	if (!sctx->sockbuf)
 		return NULL;
 
-	if (!strstr(sctx->sockbuf, "\n")) {
+	// the previous line is released now
+	if (sctx->sockbuf_rpos == sctx->sockbuf_wpos)
+		stratum_buffer_reset(sctx);
+
+	sret = stratum_buffer_line(sctx);
+	if (!sret) {
 		bool ret = true;
 		time_t rstart = time(NULL);
 		if (!socket_full(sctx->sock, timeout)) {
@@ -975,47 +1355,54 @@ char *stratum_recv_line(struct stratum_ctx *sctx)
 			goto out;
 		}
 		do {
-			char s[RBUFSIZE];
+			size_t len;
 			ssize_t n;
 
-			memset(s, 0, RBUFSIZE);
-			n = recv(sctx->sock, s, RECVSIZE, 0);
+			stratum_buffer_reserve(sctx);
+			len = sctx->sockbuf_size - sctx->sockbuf_wpos;
+			if (sctx->tls) {
+				// the tls session is not safe for a concurrent send
+				pthread_mutex_lock(&stratum_sock_lock);
+				n = stratum_tls_io(sctx, sctx->sockbuf + sctx->sockbuf_wpos, len, false);
+				pthread_mutex_unlock(&stratum_sock_lock);
+			} else {
+				n = recv(sctx->sock, sctx->sockbuf + sctx->sockbuf_wpos, (int) len, 0);
+			}
 			if (!n) {
 				ret = false;
 				break;
 			}
 			if (n < 0) {
+				// tls: the end of the record was read
+				if (sctx->tls && (sret = stratum_buffer_line(sctx)) != NULL)
+					break;
 				if (!socket_blocks() || !socket_full(sctx->sock, 1)) {
 					ret = false;
 					break;
 				}
-			} else
-				stratum_buffer_append(sctx, s);
-		} while (time(NULL) - rstart < timeout && !strstr(sctx->sockbuf, "\n"));
+			} else {
+				sctx->sockbuf_wpos += n;
+				// a tls record read in part is not seen by select, read the rest first
+				if (!sctx->tls || (size_t) n < len)
+					sret = stratum_buffer_line(sctx);
+			}
+		} while (!sret && time(NULL) - rstart < timeout);
 
 		if (!ret) {
 			if (opt_debug) applog(LOG_ERR, "stratum_recv_line failed");
 			goto out;
 		}
+		if (!sret) {
+			applog(LOG_ERR, "stratum_recv_line failed to parse a newline-terminated string");
+			goto out;
+		}
 	}
 
-	buflen = (ssize_t)strlen(sctx->sockbuf);
-	tok = strtok(sctx->sockbuf, "\n");
-	if (!tok) {
-		applog(LOG_ERR, "stratum_recv_line failed to parse a newline-terminated string");
-		goto out;
-	}
-	sret = strdup(tok);
-	len = (ssize_t)strlen(sret);
-
-	if (buflen > len + 1)
-		memmove(sctx->sockbuf, sctx->sockbuf + len + 1, buflen - len + 1);
-	else
-		sctx->sockbuf[0] = '\0';
-
 out:
 	if (sret && opt_protocol)
 		applog(LOG_DEBUG, "< %s", sret);
+	if (sret)
+		stratum_record(sctx, '<', sret);
 	return sret;
 }
 
@@ -1029,6 +1416,36 @@ static curl_socket_t opensocket_grab_cb(void *clientp, curlsocktype purpose,
 }
 #endif
 
+#if LIBCURL_VERSION_NUM >= 0x071700
+/* tls sessions of the stratum pools, kept across the reconnections */
+static CURLSH *stratum_tls_share = NULL;
+static pthread_mutex_t stratum_tls_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void stratum_tls_lock_cb(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	pthread_mutex_lock(&stratum_tls_lock);
+}
+
+static void stratum_tls_unlock_cb(CURL *curl, curl_lock_data data, void *userptr)
+{
+	pthread_mutex_unlock(&stratum_tls_lock);
+}
+
+static CURLSH *stratum_tls_sessions()
+{
+	if (!stratum_tls_share) {
+		CURLSH *sh = curl_share_init();
+		if (!sh)
+			return NULL;
+		curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, stratum_tls_lock_cb);
+		curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, stratum_tls_unlock_cb);
+		curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		stratum_tls_share = sh;
+	}
+	return stratum_tls_share;
+}
+#endif
+
 bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 {
 	CURL *curl;
@@ -1048,7 +1465,8 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 		sctx->sockbuf = (char*)calloc(RBUFSIZE, 1);
 		sctx->sockbuf_size = RBUFSIZE;
 	}
-	sctx->sockbuf[0] = '\0';
+	stratum_buffer_reset(sctx);
+	sctx->notified = false;
 	pthread_mutex_unlock(&stratum_sock_lock);
 
 	if (url != sctx->url) {
@@ -1057,7 +1475,8 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 	}
 	free(sctx->curl_url);
 	sctx->curl_url = (char*)malloc(strlen(url)+1);
-	sprintf(sctx->curl_url, "http%s", strstr(url, "://"));
+	sctx->tls = !strncasecmp(url, "stratum+ssl://", 14) || !strncasecmp(url, "stratum+tls://", 14);
+	sprintf(sctx->curl_url, "%s%s", sctx->tls ? "https" : "http", strstr(url, "://"));
 
 	if (opt_protocol)
 		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
@@ -1085,6 +1504,22 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 	curl_easy_setopt(curl, CURLOPT_OPENSOCKETFUNCTION, opensocket_grab_cb);
 	curl_easy_setopt(curl, CURLOPT_OPENSOCKETDATA, &sctx->sock);
 #endif
+	if (sctx->tls) {
+		// verified as the https getwork, --no-cert-check for self-signed pools
+		if (opt_cert) {
+			curl_easy_setopt(curl, CURLOPT_CAINFO, opt_cert);
+			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
+		}
+		if (opt_no_cert_check) {
+			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
+		}
+#if LIBCURL_VERSION_NUM >= 0x071700
+		// session resumption on reconnect, a shorter handshake
+		if (stratum_tls_sessions())
+			curl_easy_setopt(curl, CURLOPT_SHARE, stratum_tls_share);
+#endif
+	}
 	curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 1);
 
 	rc = curl_easy_perform(curl);
@@ -1099,6 +1534,13 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 	/* CURLINFO_LASTSOCKET is broken on Win64; only use it as a last resort */
 	curl_easy_getinfo(curl, CURLINFO_LASTSOCKET, (long *)&sctx->sock);
 #endif
+	if (sctx->tls && opt_debug) {
+		double tcp = 0., tls = 0.;
+		curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &tcp);
+		curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &tls);
+		applog(LOG_DEBUG, "Stratum tls handshake in %.1f ms", (tls - tcp) * 1000.);
+	}
+	stratum_record_event(sctx, "connect");
 
 	return true;
 }
@@ -1106,31 +1548,86 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 void stratum_free_job(struct stratum_ctx *sctx)
 {
 	pthread_mutex_lock(&stratum_work_lock);
-	if (sctx->job.job_id) {
-		free(sctx->job.job_id);
-	}
-	if (sctx->job.merkle_count) {
-		for (int i = 0; i < sctx->job.merkle_count; i++) {
-			free(sctx->job.merkle[i]);
-			sctx->job.merkle[i] = NULL;
-		}
-		free(sctx->job.merkle);
-	}
-	free(sctx->job.coinbase);
-	// note: xnonce2 is not allocated
+	// note: job storage belongs to sctx->jobbuf and is reused
 	memset(&(sctx->job.job_id), 0, sizeof(struct stratum_job));
 	pthread_mutex_unlock(&stratum_work_lock);
 }
 
+#define JOBBUF_COINBASE_MIN 1024
+#define JOBBUF_MERKLE_MIN   16
+
+/* the notify slot not referenced by sctx->job, grown only when too small */
+struct stratum_job_buf* stratum_job_reserve(struct stratum_ctx *sctx, size_t job_id_len,
+	size_t coinbase_size, int merkle_count)
+{
+	struct stratum_job_buf *jb = &sctx->jobbuf[sctx->jobbuf_next];
+
+	if (jb->coinbase && jb->coinbase == sctx->job.coinbase)
+		jb = &sctx->jobbuf[sctx->jobbuf_next ^= 1];
+
+	if (job_id_len + 1 > jb->job_id_alloc) {
+		size_t size = max(job_id_len + 1, (size_t) 64);
+		char *p = (char*) realloc(jb->job_id, size);
+		if (!p) return NULL;
+		jb->job_id = p;
+		jb->job_id_alloc = size;
+	}
+	if (coinbase_size > jb->coinbase_alloc) {
+		size_t size = max(coinbase_size, (size_t) JOBBUF_COINBASE_MIN);
+		uchar *p = (uchar*) realloc(jb->coinbase, size);
+		if (!p) return NULL;
+		jb->coinbase = p;
+		jb->coinbase_alloc = size;
+	}
+	if (merkle_count > jb->merkle_alloc || !jb->merkle) {
+		int count = max(merkle_count, JOBBUF_MERKLE_MIN);
+		uchar *p = (uchar*) realloc(jb->merkle, (size_t) count * 32);
+		uchar **pp;
+		if (!p) return NULL;
+		jb->merkle = p;
+		pp = (uchar**) realloc(jb->merkle_ptr, count * sizeof(uchar*));
+		if (!pp) return NULL;
+		jb->merkle_ptr = pp;
+		for (int i = 0; i < count; i++)
+			jb->merkle_ptr[i] = &jb->merkle[32 * i];
+		jb->merkle_alloc = count;
+	}
+	return jb;
+}
+
+/* make a filled slot the current job, called with stratum_work_lock held */
+void stratum_job_publish(struct stratum_ctx *sctx, struct stratum_job_buf *jb,
+	size_t coinbase_size, size_t xnonce2_offset, int merkle_count)
+{
+	struct stratum_job *job = &sctx->job;
+	uchar *xnonce2 = jb->coinbase + xnonce2_offset;
+
+	// keep the extranonce2 sequence of a refreshed job
+	if (job->job_id && job->xnonce2 && !strcmp(job->job_id, jb->job_id))
+		memcpy(xnonce2, job->xnonce2, sctx->xnonce2_size);
+	else
+		memset(xnonce2, 0, sctx->xnonce2_size);
+
+	job->job_id = jb->job_id;
+	job->coinbase = jb->coinbase;
+	job->coinbase_size = coinbase_size;
+	job->xnonce2 = xnonce2;
+	job->merkle = jb->merkle_ptr;
+	job->merkle_count = merkle_count;
+
+	sctx->jobbuf_next = (jb == &sctx->jobbuf[0]) ? 1 : 0;
+	sctx->job_seq++;
+}
+
 void stratum_disconnect(struct stratum_ctx *sctx)
 {
 	pthread_mutex_lock(&stratum_sock_lock);
 	if (sctx->curl) {
+		stratum_record_event(sctx, "disconnect");
 		pools[sctx->pooln].disconnects++;
 		curl_easy_cleanup(sctx->curl);
 		sctx->curl = NULL;
-		if (sctx->sockbuf)
-			sctx->sockbuf[0] = '\0';
+		stratum_buffer_reset(sctx);
 		// free(sctx->sockbuf);
 		// sctx->sockbuf = NULL;
 	}
@@ -1208,6 +1705,7 @@ skip_n2:
 	}
 	hex2bin(sctx->xnonce1, xnonce1, sctx->xnonce1_size);
 	sctx->xnonce2_size = xn2_size;
+	sctx->job_seq++; // the built works are no more valid
 	pthread_mutex_unlock(&stratum_work_lock);
 
 	if (pndx == 0 && opt_debug) /* pool dynamic change */
@@ -1219,6 +1717,51 @@ out:
 	return false;
 }
 
+extern bool opt_version_rolling;
+
+/* ask the version-rolling extension (BIP 310), optional: the answer is
+ * read with the next ones, pools without the extension can ignore it */
+static void stratum_configure(struct stratum_ctx *sctx)
+{
+	sctx->vr_mask = 0;
+	sctx->vr_pending = false;
+	if (!opt_version_rolling || (opt_algo != ALGO_SHA256D && opt_algo != ALGO_SHA256T))
+		return;
+
+	sctx->vr_pending = stratum_send_line(sctx, (char*) "{\"id\": 4, \"method\": \"mining.configure\", \"params\": "
+		"[[\"version-rolling\"], {\"version-rolling.mask\": \"1fffe000\", \"version-rolling.min-bit-count\": 2}]}");
+}
+
+/* the mining.configure answer, expected until the first job */
+static bool stratum_configure_answer(struct stratum_ctx *sctx, const char *s)
+{
+	json_t *val, *res_val;
+	json_error_t err;
+	const char *mask;
+
+	if (!sctx->vr_pending)
+		return false;
+	val = JSON_LOADS(s, &err);
+	if (!val)
+		return false;
+	if (json_integer_value(json_object_get(val, "id")) != 4 || json_object_get(val, "method")) {
+		json_decref(val);
+		return false;
+	}
+	res_val = json_object_get(val, "result");
+	mask = json_string_value(json_object_get(res_val, "version-rolling.mask"));
+	if (json_is_true(json_object_get(res_val, "version-rolling")) && mask) {
+		pthread_mutex_lock(&stratum_work_lock);
+		sctx->vr_mask = (uint32_t) strtoul(mask, NULL, 16);
+		pthread_mutex_unlock(&stratum_work_lock);
+	}
+	sctx->vr_pending = false;
+	if (opt_debug)
+		applog(LOG_DEBUG, "Stratum version-rolling mask %08x", sctx->vr_mask);
+	json_decref(val);
+	return true;
+}
+
 bool stratum_subscribe(struct stratum_ctx *sctx)
 {
 	char *s, *sret = NULL;
@@ -1229,6 +1772,8 @@ bool stratum_subscribe(struct stratum_ctx *sctx)
 
 	if (sctx->rpc2) return true;
 
+	stratum_configure(sctx);
+
 start:
 	s = (char*)malloc(128 + (sctx->session_id ? strlen(sctx->session_id) : 0));
 	if (retry)
@@ -1241,17 +1786,19 @@ start:
 	if (!stratum_send_line(sctx, s))
 		goto out;
 
-	if (!socket_full(sctx->sock, 10)) {
-		applog(LOG_ERR, "stratum_subscribe timed out");
-		goto out;
-	}
-
-	sret = stratum_recv_line(sctx);
-	if (!sret)
-		goto out;
+	// the configure answer and mining.set_version_mask can come first
+	do {
+		if (!stratum_socket_full(sctx, 10)) {
+			applog(LOG_ERR, "stratum_subscribe timed out");
+			goto out;
+		}
+		sret = stratum_recv_line(sctx);
+		if (!sret)
+			goto out;
+	} while (stratum_configure_answer(sctx, sret) ||
+		stratum_handle_method(sctx, sret));
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1334,13 +1881,13 @@ bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *p
 		sret = stratum_recv_line(sctx);
 		if (!sret)
 			goto out;
+		if (stratum_configure_answer(sctx, sret))
+			continue;
 		if (!stratum_handle_method(sctx, sret))
 			break;
-		free(sret);
 	}
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1398,7 +1945,6 @@ bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *p
 			}
 			json_decref(extra);
 		}
-		free(sret);
 	}
 
 out:
@@ -1439,17 +1985,131 @@ static uint32_t getblocheight(struct stratum_ctx *sctx)
 	return height;
 }
 
+struct str_span {
+	const char *p;
+	size_t len;
+};
+
+struct stratum_notify_args {
+	struct str_span job_id, prevhash, claim, coinb1, coinb2;
+	struct str_span version, nbits, stime, nreward;
+	int merkle_count;
+	bool clean;
+};
+
+static inline int hexval(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// hex2bin for a non terminated string, without strtol
+static bool hex2bin_span(uchar *p, const char *hex, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		int hi = hexval(hex[2*i]), lo = hexval(hex[2*i + 1]);
+		if (hi < 0 || lo < 0)
+			return false;
+		p[i] = (uchar) ((hi << 4) | lo);
+	}
+	return true;
+}
+
+static bool stratum_notify_apply(struct stratum_ctx *sctx, const struct stratum_notify_args *a,
+	struct stratum_job_buf *jb)
+{
+	const size_t coinb1_size = a->coinb1.len / 2;
+	const size_t coinb2_size = a->coinb2.len / 2;
+	const size_t xnonce2_offset = coinb1_size + sctx->xnonce1_size;
+	const size_t coinbase_size = xnonce2_offset + sctx->xnonce2_size + coinb2_size;
+	const bool has_nreward = a->nreward.p && a->nreward.len == 4;
+	uchar prevhash[32], claim[32], version[4], nbits[4], stime[4], nreward[2];
+	int ntime;
+
+	// the sizes are checked by the parsers, the hex digits here, before any write
+	if (!hex2bin_span(prevhash, a->prevhash.p, 32) || !hex2bin_span(version, a->version.p, 4) ||
+	    !hex2bin_span(nbits, a->nbits.p, 4) || !hex2bin_span(stime, a->stime.p, 4) ||
+	    (a->claim.p && !hex2bin_span(claim, a->claim.p, 32)) ||
+	    (has_nreward && !hex2bin_span(nreward, a->nreward.p, 2))) {
+		applog(LOG_ERR, "Stratum notify: invalid parameters");
+		return false;
+	}
+
+	/* store stratum server time diff */
+	memcpy(&ntime, stime, 4);
+	ntime = swab32(ntime) - (uint32_t) time(0);
+	if (ntime > sctx->srvtime_diff) {
+		sctx->srvtime_diff = ntime;
+		if (opt_protocol && ntime > 20)
+			applog(LOG_DEBUG, "stratum time is at least %ds in the future", ntime);
+	}
+
+	// the spare slot is not referenced by the current job, fill it unlocked
+	memcpy(jb->job_id, a->job_id.p, a->job_id.len);
+	jb->job_id[a->job_id.len] = '\0';
+	if (!hex2bin_span(jb->coinbase, a->coinb1.p, coinb1_size) ||
+	    !hex2bin_span(jb->coinbase + xnonce2_offset + sctx->xnonce2_size, a->coinb2.p, coinb2_size)) {
+		applog(LOG_ERR, "Stratum notify: invalid coinbase");
+		return false;
+	}
+
+	pthread_mutex_lock(&stratum_work_lock);
+
+	memcpy(jb->coinbase + coinb1_size, sctx->xnonce1, sctx->xnonce1_size);
+	stratum_job_publish(sctx, jb, coinbase_size, xnonce2_offset, a->merkle_count);
+
+	memcpy(sctx->job.prevhash, prevhash, 32);
+	if (a->claim.p) memcpy(sctx->job.claim, claim, 32);
+
+	sctx->job.height = getblocheight(sctx);
+
+	memcpy(sctx->job.version, version, 4);
+	memcpy(sctx->job.nbits, nbits, 4);
+	memcpy(sctx->job.ntime, stime, 4);
+	if (has_nreward)
+		memcpy(sctx->job.nreward, nreward, 2);
+	sctx->job.clean = a->clean;
+
+	sctx->job.diff = sctx->next_diff;
+
+	pthread_mutex_unlock(&stratum_work_lock);
+
+	pool_latency_notify(sctx->pooln, sctx->job.prevhash, !sctx->notified);
+	sctx->notified = true;
+	// a pool ignoring mining.configure
+	sctx->vr_pending = false;
+
+	return true;
+}
+
+static bool stratum_notify_valid(const struct stratum_notify_args *a)
+{
+	if (!a->job_id.p || !a->prevhash.p || !a->coinb1.p || !a->coinb2.p ||
+	    !a->version.p || !a->nbits.p || !a->stime.p ||
+	    a->prevhash.len != 64 || a->version.len != 8 ||
+	    a->nbits.len != 8 || a->stime.len != 8) {
+		applog(LOG_ERR, "Stratum notify: invalid parameters");
+		return false;
+	}
+	return true;
+}
+
+static struct str_span json_span(json_t *val)
+{
+	struct str_span v;
+	v.p = json_string_value(val);
+	v.len = v.p ? strlen(v.p) : 0;
+	return v;
+}
+
 static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 {
-	const char *job_id, *prevhash, *coinb1, *coinb2, *version, *nbits, *stime;
-	const char *claim = NULL, *nreward = NULL;
-	size_t coinb1_size, coinb2_size;
-	bool clean, ret = false;
-	int merkle_count, i, p=0;
+	struct stratum_notify_args a = { 0 };
+	struct stratum_job_buf *jb;
 	json_t *merkle_arr;
-	uchar **merkle = NULL;
-	// uchar(*merkle_tree)[32] = { 0 };
-	int ntime;
+	int i, p=0;
 	char algo[64] = { 0 };
 	get_currentalgo(algo, sizeof(algo));
 	bool has_claim = !strcasecmp(algo, "lbry");
@@ -1458,105 +2118,198 @@ static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 		return equi_stratum_notify(sctx, params);
 	}
 
-	job_id = json_string_value(json_array_get(params, p++));
-	prevhash = json_string_value(json_array_get(params, p++));
+	a.job_id = json_span(json_array_get(params, p++));
+	a.prevhash = json_span(json_array_get(params, p++));
 	if (has_claim) {
-		claim = json_string_value(json_array_get(params, p++));
-		if (!claim || strlen(claim) != 64) {
+		a.claim = json_span(json_array_get(params, p++));
+		if (!a.claim.p || a.claim.len != 64) {
 			applog(LOG_ERR, "Stratum notify: invalid claim parameter");
-			goto out;
+			return false;
 		}
 	}
-	coinb1 = json_string_value(json_array_get(params, p++));
-	coinb2 = json_string_value(json_array_get(params, p++));
+	a.coinb1 = json_span(json_array_get(params, p++));
+	a.coinb2 = json_span(json_array_get(params, p++));
 	merkle_arr = json_array_get(params, p++);
 	if (!merkle_arr || !json_is_array(merkle_arr))
-		goto out;
-	merkle_count = (int) json_array_size(merkle_arr);
-	version = json_string_value(json_array_get(params, p++));
-	nbits = json_string_value(json_array_get(params, p++));
-	stime = json_string_value(json_array_get(params, p++));
-	clean = json_is_true(json_array_get(params, p)); p++;
-	nreward = json_string_value(json_array_get(params, p++));
-
-	if (!job_id || !prevhash || !coinb1 || !coinb2 || !version || !nbits || !stime ||
-	    strlen(prevhash) != 64 || strlen(version) != 8 ||
-	    strlen(nbits) != 8 || strlen(stime) != 8) {
-		applog(LOG_ERR, "Stratum notify: invalid parameters");
-		goto out;
-	}
+		return false;
+	a.merkle_count = (int) json_array_size(merkle_arr);
+	a.version = json_span(json_array_get(params, p++));
+	a.nbits = json_span(json_array_get(params, p++));
+	a.stime = json_span(json_array_get(params, p++));
+	a.clean = json_is_true(json_array_get(params, p)); p++;
+	a.nreward = json_span(json_array_get(params, p++));
+
+	if (!stratum_notify_valid(&a))
+		return false;
 
-	/* store stratum server time diff */
-	hex2bin((uchar *)&ntime, stime, 4);
-	ntime = swab32(ntime) - (uint32_t) time(0);
-	if (ntime > sctx->srvtime_diff) {
-		sctx->srvtime_diff = ntime;
-		if (opt_protocol && ntime > 20)
-			applog(LOG_DEBUG, "stratum time is at least %ds in the future", ntime);
-	}
+	jb = stratum_job_reserve(sctx, a.job_id.len,
+		a.coinb1.len/2 + sctx->xnonce1_size + sctx->xnonce2_size + a.coinb2.len/2, a.merkle_count);
+	if (!jb)
+		return false;
 
-	if (merkle_count)
-		merkle = (uchar**) malloc(merkle_count * sizeof(char *));
-	for (i = 0; i < merkle_count; i++) {
-		const char *s = json_string_value(json_array_get(merkle_arr, i));
-		if (!s || strlen(s) != 64) {
-			while (i--)
-				free(merkle[i]);
-			free(merkle);
+	for (i = 0; i < a.merkle_count; i++) {
+		struct str_span m = json_span(json_array_get(merkle_arr, i));
+		if (!m.p || m.len != 64 || !hex2bin_span(jb->merkle_ptr[i], m.p, 32)) {
 			applog(LOG_ERR, "Stratum notify: invalid Merkle branch");
-			goto out;
+			return false;
 		}
-		merkle[i] = (uchar*) malloc(32);
-		hex2bin(merkle[i], s, 32);
 	}
 
-	pthread_mutex_lock(&stratum_work_lock);
+	return stratum_notify_apply(sctx, &a, jb);
+}
 
-	coinb1_size = strlen(coinb1) / 2;
-	coinb2_size = strlen(coinb2) / 2;
-	sctx->job.coinbase_size = coinb1_size + sctx->xnonce1_size +
-	                          sctx->xnonce2_size + coinb2_size;
+/* mining.notify fast path: the line is scanned in place, without jansson
+ * and without allocation. Only what a notify needs is understood (flat
+ * strings without escapes, scalars and arrays of those), anything else
+ * is left to the generic stratum_handle_method() path. */
 
-	sctx->job.coinbase = (uchar*) realloc(sctx->job.coinbase, sctx->job.coinbase_size);
-	sctx->job.xnonce2 = sctx->job.coinbase + coinb1_size + sctx->xnonce1_size;
-	hex2bin(sctx->job.coinbase, coinb1, coinb1_size);
-	memcpy(sctx->job.coinbase + coinb1_size, sctx->xnonce1, sctx->xnonce1_size);
+static inline const char* jscan_ws(const char *s)
+{
+	while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') s++;
+	return s;
+}
 
-	if (!sctx->job.job_id || strcmp(sctx->job.job_id, job_id))
-		memset(sctx->job.xnonce2, 0, sctx->xnonce2_size);
-	hex2bin(sctx->job.xnonce2 + sctx->xnonce2_size, coinb2, coinb2_size);
+static const char* jscan_str(const char *s, struct str_span *v)
+{
+	const char *e;
+	if (*s != '"') return NULL;
+	for (e = s + 1; *e != '"'; e++)
+		if (!*e || *e == '\\') return NULL;
+	v->p = s + 1;
+	v->len = (size_t) (e - v->p);
+	return e + 1;
+}
+
+static const char* jscan_skip(const char *s)
+{
+	struct str_span v;
+	if (*s == '"')
+		return jscan_str(s, &v);
+	if (*s == '[') {
+		s = jscan_ws(s + 1);
+		if (*s == ']') return s + 1;
+		for (;;) {
+			s = jscan_skip(s);
+			if (!s) return NULL;
+			s = jscan_ws(s);
+			if (*s == ']') return s + 1;
+			if (*s != ',') return NULL;
+			s = jscan_ws(s + 1);
+		}
+	}
+	if (!isalnum(*s) && *s != '-') return NULL;
+	while (isalnum(*s) || *s == '-' || *s == '+' || *s == '.') s++;
+	return s;
+}
 
-	free(sctx->job.job_id);
-	sctx->job.job_id = strdup(job_id);
-	hex2bin(sctx->job.prevhash, prevhash, 32);
-	if (has_claim) hex2bin(sctx->job.claim, claim, 32);
+// next element of an array, NULL at the end or on error
+static const char* jscan_elem(const char *s, bool first)
+{
+	s = jscan_ws(s);
+	if (*s == ']') return NULL;
+	if (!first) {
+		if (*s != ',') return NULL;
+		s = jscan_ws(s + 1);
+	}
+	return s;
+}
 
-	sctx->job.height = getblocheight(sctx);
+static const char* jscan_elem_str(const char *s, bool first, struct str_span *v)
+{
+	s = jscan_elem(s, first);
+	return s ? jscan_str(s, v) : NULL;
+}
+
+static bool stratum_notify_fast(struct stratum_ctx *sctx, const char *line, bool *handled)
+{
+	struct stratum_notify_args a = { 0 };
+	struct stratum_job_buf *jb;
+	struct str_span key, method = { 0 };
+	const char *params = NULL, *merkle, *s;
+	char algo[64] = { 0 };
+	int i;
 
-	for (i = 0; i < sctx->job.merkle_count; i++)
-		free(sctx->job.merkle[i]);
-	free(sctx->job.merkle);
-	sctx->job.merkle = merkle;
-	sctx->job.merkle_count = merkle_count;
+	*handled = false;
+	if (sctx->rpc2 || sctx->is_equihash)
+		return false;
 
-	hex2bin(sctx->job.version, version, 4);
-	hex2bin(sctx->job.nbits, nbits, 4);
-	hex2bin(sctx->job.ntime, stime, 4);
-	if(nreward != NULL)
-	{
-		if(strlen(nreward) == 4)
-			hex2bin(sctx->job.nreward, nreward, 2);
+	s = jscan_ws(line);
+	if (*s != '{') return false;
+	s = jscan_ws(s + 1);
+	while (*s != '}') {
+		s = jscan_str(s, &key);
+		if (!s) return false;
+		s = jscan_ws(s);
+		if (*s != ':') return false;
+		s = jscan_ws(s + 1);
+		if (key.len == 6 && !memcmp(key.p, "method", 6))
+			s = jscan_str(s, &method);
+		else {
+			if (key.len == 6 && !memcmp(key.p, "params", 6))
+				params = s;
+			s = jscan_skip(s);
+		}
+		if (!s) return false;
+		s = jscan_ws(s);
+		if (*s == ',') s = jscan_ws(s + 1);
+		else if (*s != '}') return false;
 	}
-	sctx->job.clean = clean;
+	if (!params || method.len != 13 || strncasecmp(method.p, "mining.notify", 13))
+		return false;
 
-	sctx->job.diff = sctx->next_diff;
+	get_currentalgo(algo, sizeof(algo));
 
-	pthread_mutex_unlock(&stratum_work_lock);
+	if (*params != '[') return false;
+	s = params + 1;
+	s = jscan_elem_str(s, true, &a.job_id);
+	if (s) s = jscan_elem_str(s, false, &a.prevhash);
+	if (s && !strcasecmp(algo, "lbry")) {
+		s = jscan_elem_str(s, false, &a.claim);
+		if (s && a.claim.len != 64) return false;
+	}
+	if (s) s = jscan_elem_str(s, false, &a.coinb1);
+	if (s) s = jscan_elem_str(s, false, &a.coinb2);
+	if (s) s = jscan_elem(s, false);
+	if (!s || *s != '[') return false;
+	merkle = s + 1;
+	for (s = merkle; ; a.merkle_count++) {
+		struct str_span m;
+		const char *e = jscan_elem(s, !a.merkle_count);
+		if (!e) break;
+		s = jscan_str(e, &m);
+		if (!s || m.len != 64) return false;
+	}
+	s = jscan_ws(s);
+	if (*s != ']') return false;
+	s = jscan_elem_str(s + 1, false, &a.version);
+	if (s) s = jscan_elem_str(s, false, &a.nbits);
+	if (s) s = jscan_elem_str(s, false, &a.stime);
+	if (s) s = jscan_elem(s, false);
+	if (!s) return false;
+	a.clean = !strncmp(s, "true", 4);
+	s = jscan_skip(s);
+	if (s && (s = jscan_elem(s, false)) != NULL && *s == '"')
+		jscan_str(s, &a.nreward);
+
+	if (a.prevhash.len != 64 || a.version.len != 8 || a.nbits.len != 8 || a.stime.len != 8)
+		return false; // let the generic path report it
+
+	*handled = true;
+	jb = stratum_job_reserve(sctx, a.job_id.len,
+		a.coinb1.len/2 + sctx->xnonce1_size + sctx->xnonce2_size + a.coinb2.len/2, a.merkle_count);
+	if (!jb)
+		return false;
 
-	ret = true;
+	for (i = 0, s = merkle; i < a.merkle_count; i++) {
+		struct str_span m;
+		s = jscan_str(jscan_elem(s, !i), &m);
+		if (!hex2bin_span(jb->merkle_ptr[i], m.p, 32)) {
+			applog(LOG_ERR, "Stratum notify: invalid Merkle branch");
+			return false;
+		}
+	}
 
-out:
-	return ret;
+	return stratum_notify_apply(sctx, &a, jb);
 }
 
 extern volatile time_t g_work_time;
@@ -1575,6 +2328,19 @@ static bool stratum_set_difficulty(struct stratum_ctx *sctx, json_t *params)
 	return true;
 }
 
+static bool stratum_set_version_mask(struct stratum_ctx *sctx, json_t *params)
+{
+	const char *mask = json_string_value(json_array_get(params, 0));
+	if (!mask)
+		return false;
+
+	pthread_mutex_lock(&stratum_work_lock);
+	sctx->vr_mask = (uint32_t) strtoul(mask, NULL, 16);
+	pthread_mutex_unlock(&stratum_work_lock);
+
+	return true;
+}
+
 static bool stratum_reconnect(struct stratum_ctx *sctx, json_t *params)
 {
 	json_t *port_val;
@@ -1592,7 +2358,7 @@ static bool stratum_reconnect(struct stratum_ctx *sctx, json_t *params)
 	
 	free(sctx->url);
 	sctx->url = (char*)malloc(32 + strlen(host));
-	sprintf(sctx->url, "stratum+tcp://%s:%d", host, port);
+	sprintf(sctx->url, "stratum+%s://%s:%d", sctx->tls ? "ssl" : "tcp", host, port);
 
 	applog(LOG_NOTICE, "Server requested reconnection to %s", sctx->url);
 
@@ -1837,6 +2603,11 @@ bool stratum_handle_method(struct stratum_ctx *sctx, const char *s)
 	const char *method;
 	bool ret = false;
 
+	bool handled;
+	ret = stratum_notify_fast(sctx, s, &handled);
+	if (handled)
+		return ret;
+
 	val = JSON_LOADS(s, &err);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
@@ -1871,6 +2642,10 @@ bool stratum_handle_method(struct stratum_ctx *sctx, const char *s)
 		ret = stratum_parse_extranonce(sctx, params, 0);
 		goto out;
 	}
+	if (!strcasecmp(method, "mining.set_version_mask")) {
+		ret = stratum_set_version_mask(sctx, params);
+		goto out;
+	}
 	if (!strcasecmp(method, "client.reconnect")) {
 		ret = stratum_reconnect(sctx, params);
 		goto out;
@@ -1920,7 +2695,8 @@ struct thread_q *tq_new(void)
 	if (!tq)
 		return NULL;
 
-	INIT_LIST_HEAD(&tq->q);
+	for (uint32_t i = 0; i < TQ_SIZE; i++)
+		tq->cell[i].seq = i;
 	pthread_mutex_init(&tq->mutex, NULL);
 	pthread_cond_init(&tq->cond, NULL);
 
@@ -1929,16 +2705,9 @@ struct thread_q *tq_new(void)
 
 void tq_free(struct thread_q *tq)
 {
-	struct tq_ent *ent, *iter;
-
 	if (!tq)
 		return;
 
-	list_for_each_entry_safe(ent, iter, &tq->q, q_node, struct tq_ent, struct tq_ent) {
-		list_del(&ent->q_node);
-		free(ent);
-	}
-
 	pthread_cond_destroy(&tq->cond);
 	pthread_mutex_destroy(&tq->mutex);
 
@@ -1968,59 +2737,83 @@ void tq_thaw(struct thread_q *tq)
 
 bool tq_push(struct thread_q *tq, void *data)
 {
-	struct tq_ent *ent;
-	bool rc = true;
-
-	ent = (struct tq_ent *)calloc(1, sizeof(*ent));
-	if (!ent)
-		return false;
+	struct tq_cell *cell;
+	uint32_t pos;
 
-	ent->data = data;
-	INIT_LIST_HEAD(&ent->q_node);
+	for (;;) {
+		int32_t dif;
+		if (tq->frozen)
+			return false;
+		pos = tq->tail;
+		cell = &tq->cell[pos & (TQ_SIZE - 1)];
+		dif = (int32_t) (cell->seq - pos);
+		memory_barrier();
+		if (dif == 0) {
+			if (tq_cas(&tq->tail, pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			// full, wait for the consumer
+			usleep(100);
+		}
+		// else another producer took this cell
+	}
 
-	pthread_mutex_lock(&tq->mutex);
+	cell->data = data;
+	memory_barrier();
+	cell->seq = pos + 1;
+	memory_barrier();
 
-	if (!tq->frozen) {
-		list_add_tail(&ent->q_node, &tq->q);
-	} else {
-		free(ent);
-		rc = false;
+	if (tq->waiting) {
+		pthread_mutex_lock(&tq->mutex);
+		pthread_cond_signal(&tq->cond);
+		pthread_mutex_unlock(&tq->mutex);
 	}
 
-	pthread_cond_signal(&tq->cond);
-	pthread_mutex_unlock(&tq->mutex);
+	return true;
+}
 
-	return rc;
+// consumer side, false if empty (or the next push is not complete)
+static bool tq_take(struct thread_q *tq, void **data)
+{
+	uint32_t pos = tq->head;
+	struct tq_cell *cell = &tq->cell[pos & (TQ_SIZE - 1)];
+
+	if ((int32_t) (cell->seq - (pos + 1)) < 0)
+		return false;
+	memory_barrier();
+	*data = cell->data;
+	memory_barrier();
+	cell->seq = pos + TQ_SIZE;
+	tq->head = pos + 1;
+	return true;
 }
 
 void *tq_pop(struct thread_q *tq, const struct timespec *abstime)
 {
-	struct tq_ent *ent;
 	void *rval = NULL;
 	int rc;
 
-	pthread_mutex_lock(&tq->mutex);
-
-	if (!list_empty(&tq->q))
-		goto pop;
+	if (tq_take(tq, &rval))
+		return rval;
 
-	if (abstime)
-		rc = pthread_cond_timedwait(&tq->cond, &tq->mutex, abstime);
-	else
-		rc = pthread_cond_wait(&tq->cond, &tq->mutex);
-	if (rc)
-		goto out;
-	if (list_empty(&tq->q))
-		goto out;
-
-pop:
-	ent = list_entry(tq->q.next, struct tq_ent, q_node);
-	rval = ent->data;
+	pthread_mutex_lock(&tq->mutex);
 
-	list_del(&ent->q_node);
-	free(ent);
+	// a producer seeing waiting set will signal, check again after
+	tq->waiting = 1;
+	memory_barrier();
+	while (!tq_take(tq, &rval)) {
+		// woken by tq_freeze(), or a timeout
+		if (tq->frozen)
+			break;
+		if (abstime)
+			rc = pthread_cond_timedwait(&tq->cond, &tq->mutex, abstime);
+		else
+			rc = pthread_cond_wait(&tq->cond, &tq->mutex);
+		if (rc)
+			break;
+	}
 
-out:
+	tq->waiting = 0;
 	pthread_mutex_unlock(&tq->mutex);
 	return rval;
 }
@@ -2344,6 +3137,13 @@ void print_hash_tests(void)
 
 	printf("\n");
 
+	// constant tables read per hash, the L1 working set of these steps
+	printf(CL_WHT "CPU HASH TABLES SIZE:" CL_N "\n");
+	printf("%s%11s%s: %u bytes\n", CL_GRN, "hamsi512", CL_N, (uint32_t) sph_hamsi512_tables_size());
+	printf("%s%11s%s: %u bytes\n", CL_GRN, "fugue512", CL_N, (uint32_t) sph_fugue_tables_size());
+
+	printf("\n");
+
 	do_gpu_tests();
 
 	free(scratchbuf);
@@ -37,11 +37,9 @@ extern void x13_fugue512_cpu_init(int thr_id, uint32_t threads);
 extern void x13_fugue512_cpu_hash_64(int thr_id, uint32_t threads, uint32_t startNounce, uint32_t *d_nonceVector, uint32_t *d_hash, int order);
 extern void x13_fugue512_cpu_free(int thr_id);
 
-// HSR CPU Hash
-extern "C" void hsr_hash(void *output, const void *input)
+// blake1-bmw2-grs3-skein4-jh5-keccak6-luffa7-cubehash8-shavite9-simd10-echo11
+static void hsr_hash_x11(uint32_t *hash, const void *input)
 {
-	// blake1-bmw2-grs3-skein4-jh5-keccak6-luffa7-cubehash8-shavite9-simd10-echo11-hamsi12-fugue13
-
 	sph_blake512_context ctx_blake;
 	sph_bmw512_context ctx_bmw;
 	sph_groestl512_context ctx_groestl;
@@ -53,12 +51,6 @@ extern "C" void hsr_hash(void *output, const void *input)
 	sph_shavite512_context ctx_shavite;
 	sph_simd512_context ctx_simd;
 	sph_echo512_context ctx_echo;
-	sm3_ctx_t ctx_sm3;
-	sph_hamsi512_context ctx_hamsi;
-	sph_fugue512_context ctx_fugue;
-
-	uint32_t hash[32];
-	memset(hash, 0, sizeof hash);
 
 	sph_blake512_init(&ctx_blake);
 	sph_blake512(&ctx_blake, input, 80);
@@ -103,11 +95,13 @@ extern "C" void hsr_hash(void *output, const void *input)
 	sph_echo512_init(&ctx_echo);
 	sph_echo512(&ctx_echo, (const void*) hash, 64);
 	sph_echo512_close(&ctx_echo, (void*) hash);
+}
 
-	sm3_init(&ctx_sm3);
-	sm3_update(&ctx_sm3, (const unsigned char*) hash, 64);
-	memset(hash, 0, sizeof hash);
-	sm3_close(&ctx_sm3, (void*) hash);
+// hamsi13-fugue14, on the zero padded sm3 digest
+static void hsr_hash_tail(uint32_t *hash)
+{
+	sph_hamsi512_context ctx_hamsi;
+	sph_fugue512_context ctx_fugue;
 
 	sph_hamsi512_init(&ctx_hamsi);
 	sph_hamsi512(&ctx_hamsi, (const void*) hash, 64);
@@ -116,10 +110,66 @@ extern "C" void hsr_hash(void *output, const void *input)
 	sph_fugue512_init(&ctx_fugue);
 	sph_fugue512(&ctx_fugue, (const void*) hash, 64);
 	sph_fugue512_close(&ctx_fugue, (void*) hash);
+}
+
+// HSR CPU Hash
+extern "C" void hsr_hash(void *output, const void *input)
+{
+	sm3_ctx_t ctx_sm3;
+
+	uint32_t hash[32];
+	memset(hash, 0, sizeof hash);
+
+	hsr_hash_x11(hash, input);
+
+	sm3_init(&ctx_sm3);
+	sm3_update(&ctx_sm3, (const unsigned char*) hash, 64);
+	memset(hash, 0, sizeof hash);
+	sm3_close(&ctx_sm3, (void*) hash);
+
+	hsr_hash_tail(hash);
 
 	memcpy(output, hash, 32);
 }
 
+// HSR CPU Hash of count nonces for the same (big endian encoded) header,
+// the sm3 step of the groups of 8 done 8 lanes at once
+extern "C" void hsr_hash_batch(void *output, const void *input, const uint32_t *nonces, int count)
+{
+	uint32_t _ALIGN(64) hash[8][16];
+	uint32_t _ALIGN(64) data[20];
+	int n = 0;
+
+	memcpy(data, input, 76);
+
+	for (; n + 8 <= count; n += 8) {
+		memset(hash, 0, sizeof hash);
+
+		for (int i = 0; i < 8; i++) {
+			be32enc(&data[19], nonces[n + i]);
+			hsr_hash_x11(hash[i], data);
+		}
+
+		sm3_hash64_8way(hash, hash, sizeof(hash[0]));
+
+		for (int i = 0; i < 8; i++) {
+			memset(&hash[i][8], 0, 32);
+			hsr_hash_tail(hash[i]);
+			memcpy((uint8_t*) output + (n + i) * 32, hash[i], 32);
+		}
+	}
+	for (; n < count; n++) {
+		be32enc(&data[19], nonces[n]);
+		hsr_hash((uint8_t*) output + n * 32, data);
+	}
+}
+
+// CPU scan (--cpu-scan)
+extern "C" int scanhash_hsr_cpu(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done)
+{
+	return scanhash_cpu_batch(thr_id, work, max_nonce, hashes_done, hsr_hash_batch);
+}
+
 static bool init[MAX_GPUS] = { 0 };
 
 extern "C" int scanhash_hsr(int thr_id, struct work* work, uint32_t max_nonce, unsigned long *hashes_done)
@@ -51,6 +51,10 @@
 
 #include "sm3.h"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 void sm3_init(sm3_ctx_t *ctx)
 {
 	ctx->digest[0] = 0x7380166F;
@@ -218,3 +222,146 @@ void sm3(const unsigned char *msg, size_t msglen,
 
 	memset(&ctx, 0, sizeof(sm3_ctx_t));
 }
+
+/*
+ * Multi-buffer interface, 8 independent lanes.
+ *
+ * The state and message words are word-interleaved (digest[i][lane],
+ * block[j][lane]) so one AVX2 register holds the same word of all lanes.
+ * Message words are expected already converted from big endian.
+ */
+
+static const uint32_t sm3_iv[8] = {
+	0x7380166F, 0x4914B2B9, 0x172442D7, 0xDA8A0600,
+	0xA96F30BC, 0x163138AA, 0xE38DEE4D, 0xB0FB0E4E
+};
+
+#ifdef __AVX2__
+
+/* T(j) <<< (j mod 32), the scalar macro relies on x86 shift masking */
+static uint32_t sm3_rotl_t(uint32_t T, int j)
+{
+	int n = j & 31;
+	return n ? ROTATELEFT(T, n) : T;
+}
+
+#define ROTL8(x,n) _mm256_or_si256(_mm256_slli_epi32(x,n), _mm256_srli_epi32(x,32-(n)))
+#define XOR8(a,b)  _mm256_xor_si256(a,b)
+#define ADD8(a,b)  _mm256_add_epi32(a,b)
+
+#define P0_8(x) XOR8(XOR8(x, ROTL8(x,9)), ROTL8(x,17))
+#define P1_8(x) XOR8(XOR8(x, ROTL8(x,15)), ROTL8(x,23))
+
+#define SM3_8WAY_ROUND(j, FF, GG) { \
+	__m256i A12 = ROTL8(A,12); \
+	__m256i SS1 = ROTL8(ADD8(ADD8(A12, E), _mm256_set1_epi32(sm3_rotl_t(T, j))), 7); \
+	__m256i SS2 = XOR8(SS1, A12); \
+	__m256i TT1 = ADD8(ADD8(FF, D), ADD8(SS2, XOR8(W[j], W[j+4]))); \
+	__m256i TT2 = ADD8(ADD8(GG, H), ADD8(SS1, W[j])); \
+	D = C; C = ROTL8(B,9); B = A; A = TT1; \
+	H = G; G = ROTL8(F,19); F = E; E = P0_8(TT2); \
+}
+
+void sm3_compress8(uint32_t digest[8][8], const uint32_t block[16][8])
+{
+	__m256i W[68];
+	__m256i *V = (__m256i*) digest;
+	__m256i A = _mm256_loadu_si256(&V[0]);
+	__m256i B = _mm256_loadu_si256(&V[1]);
+	__m256i C = _mm256_loadu_si256(&V[2]);
+	__m256i D = _mm256_loadu_si256(&V[3]);
+	__m256i E = _mm256_loadu_si256(&V[4]);
+	__m256i F = _mm256_loadu_si256(&V[5]);
+	__m256i G = _mm256_loadu_si256(&V[6]);
+	__m256i H = _mm256_loadu_si256(&V[7]);
+	uint32_t T;
+	int j;
+
+	for (j = 0; j < 16; j++) {
+		W[j] = _mm256_loadu_si256((const __m256i*) block[j]);
+	}
+	for (j = 16; j < 68; j++) {
+		__m256i x = XOR8(XOR8(W[j-16], W[j-9]), ROTL8(W[j-3],15));
+		W[j] = XOR8(XOR8(P1_8(x), ROTL8(W[j-13],7)), W[j-6]);
+	}
+
+	T = 0x79CC4519;
+	for (j = 0; j < 16; j++) {
+		SM3_8WAY_ROUND(j, XOR8(XOR8(A,B),C), XOR8(XOR8(E,F),G));
+	}
+
+	T = 0x7A879D8A;
+	for (j = 16; j < 64; j++) {
+		/* FF1 = majority, GG1 = choose */
+		__m256i ff = _mm256_or_si256(_mm256_and_si256(A,B), _mm256_and_si256(_mm256_or_si256(A,B),C));
+		__m256i gg = _mm256_or_si256(_mm256_and_si256(E,F), _mm256_andnot_si256(E,G));
+		SM3_8WAY_ROUND(j, ff, gg);
+	}
+
+	_mm256_storeu_si256(&V[0], XOR8(_mm256_loadu_si256(&V[0]), A));
+	_mm256_storeu_si256(&V[1], XOR8(_mm256_loadu_si256(&V[1]), B));
+	_mm256_storeu_si256(&V[2], XOR8(_mm256_loadu_si256(&V[2]), C));
+	_mm256_storeu_si256(&V[3], XOR8(_mm256_loadu_si256(&V[3]), D));
+	_mm256_storeu_si256(&V[4], XOR8(_mm256_loadu_si256(&V[4]), E));
+	_mm256_storeu_si256(&V[5], XOR8(_mm256_loadu_si256(&V[5]), F));
+	_mm256_storeu_si256(&V[6], XOR8(_mm256_loadu_si256(&V[6]), G));
+	_mm256_storeu_si256(&V[7], XOR8(_mm256_loadu_si256(&V[7]), H));
+}
+
+#else
+
+/* no AVX2, compress each lane with the scalar code */
+void sm3_compress8(uint32_t digest[8][8], const uint32_t block[16][8])
+{
+	uint32_t lane_digest[8];
+	uint32_t lane_block[16];
+	int i, j;
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 8; j++)
+			lane_digest[j] = digest[j][i];
+		for (j = 0; j < 16; j++)
+			lane_block[j] = cpu_to_be32(block[j][i]);
+		sm3_compress(lane_digest, (const unsigned char*) lane_block);
+		for (j = 0; j < 8; j++)
+			digest[j][i] = lane_digest[j];
+	}
+}
+
+#endif /* __AVX2__ */
+
+/*
+ * Hash 8 messages of 64 bytes. Lane i is read from src + i*stride and its
+ * 32 bytes digest written to dst + i*stride, dst may be equal to src.
+ */
+void sm3_hash64_8way(void *dst, const void *src, size_t stride)
+{
+	uint32_t digest[8][8];
+	uint32_t block[16][8];
+	int i, j;
+
+	for (j = 0; j < 8; j++)
+		for (i = 0; i < 8; i++)
+			digest[j][i] = sm3_iv[j];
+
+	for (i = 0; i < 8; i++) {
+		const uint32_t *p = (const uint32_t*) ((const unsigned char*) src + i * stride);
+		for (j = 0; j < 16; j++)
+			block[j][i] = be32_to_cpu(p[j]);
+	}
+	sm3_compress8(digest, block);
+
+	/* constant padding block of a 512-bit message */
+	memset(block, 0, sizeof(block));
+	for (i = 0; i < 8; i++) {
+		block[0][i] = 0x80000000;
+		block[15][i] = 512;
+	}
+	sm3_compress8(digest, block);
+
+	for (i = 0; i < 8; i++) {
+		uint32_t *p = (uint32_t*) ((unsigned char*) dst + i * stride);
+		for (j = 0; j < 8; j++)
+			p[j] = cpu_to_be32(digest[j][i]);
+	}
+}
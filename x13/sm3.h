@@ -82,6 +82,10 @@ void sm3_compress(uint32_t digest[8], const unsigned char block[SM3_BLOCK_SIZE])
 void sm3(const unsigned char *data, size_t datalen,
 	unsigned char digest[SM3_DIGEST_LENGTH]);
 
+/* 8 lanes, word-interleaved state (AVX2 when available) */
+void sm3_compress8(uint32_t digest[8][8], const uint32_t block[16][8]);
+void sm3_hash64_8way(void *dst, const void *src, size_t stride);
+
 #ifdef CPU_BIGENDIAN
 
 #define cpu_to_be16(v) (v)